@@ -0,0 +1,282 @@
+#include <opencv2//core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "BitMask.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+static inline int popcount64(uint64 x)
+{
+#ifdef _MSC_VER
+	return (int)__popcnt64(x);
+#else
+	return __builtin_popcountll(x);
+#endif
+}
+
+static inline int lowestBit(uint64 x)    //x != 0
+{
+#ifdef _MSC_VER
+	unsigned long ind;
+	_BitScanForward64(&ind, x);
+	return (int)ind;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+static inline int highestBit(uint64 x)   //x != 0
+{
+#ifdef _MSC_VER
+	unsigned long ind;
+	_BitScanReverse64(&ind, x);
+	return (int)ind;
+#else
+	return 63 - __builtin_clzll(x);
+#endif
+}
+
+BitMask::BitMask()
+{
+	firstWord = 0;
+	wordsPerRow = 0;
+}
+
+BitMask::BitMask(Mat mask, int threshold)
+{
+	CV_Assert(mask.type() == CV_8UC1);
+
+	Rect bounds = threshold == 0 ? boundingRect(mask) : boundingRect(mask > threshold);
+
+	frameSize = mask.size();
+	pack(mask, Point(0, 0), threshold, bounds);
+}
+
+BitMask::BitMask(Mat mask, int threshold, Rect roi)
+{
+	CV_Assert(mask.type() == CV_8UC1);
+
+	frameSize = mask.size();
+	pack(mask, Point(0, 0), threshold, roi);
+}
+
+BitMask::BitMask(Mat mask, Point origin, Size p_frameSize)
+{
+	CV_Assert(mask.empty() || mask.type() == CV_8UC1);
+
+	frameSize = p_frameSize;
+	pack(mask, origin, 0, Rect(origin, mask.size()));
+}
+
+void BitMask::pack(Mat mask, Point origin, int threshold, Rect roi)
+{
+	box = roi & Rect(origin, mask.size()) & Rect(0, 0, frameSize.width, frameSize.height);
+
+	if (box.empty())
+	{
+		box = Rect();
+		firstWord = 0;
+		wordsPerRow = 0;
+		return;
+	}
+
+	firstWord = box.x / 64;
+	wordsPerRow = (box.x + box.width + 63) / 64 - firstWord;
+	words.assign((size_t)box.height * wordsPerRow, 0);
+
+	for (int i = 0; i < box.height; i++)
+	{
+		const uchar* src = mask.ptr<uchar>(box.y - origin.y + i) - origin.x;
+		uint64* dst = &words[(size_t)i * wordsPerRow] - firstWord;
+
+		for (int j = box.x; j < box.x + box.width; j++)
+		{
+			if (src[j] > threshold)
+			{
+				dst[j >> 6] |= (uint64)1 << (j & 63);
+			}
+		}
+	}
+}
+
+const uint64* BitMask::rowWords(int row) const
+{
+	if (row < box.y || row >= box.y + box.height)
+	{
+		return NULL;
+	}
+
+	return &words[(size_t)(row - box.y) * wordsPerRow];
+}
+
+Rect BitMask::getBox() const
+{
+	return box;
+}
+
+Size BitMask::getFrameSize() const
+{
+	return frameSize;
+}
+
+bool BitMask::get(int row, int col) const
+{
+	const uint64* w = rowWords(row);
+
+	if (w == NULL || col < box.x || col >= box.x + box.width)
+	{
+		return false;
+	}
+
+	return (w[(col >> 6) - firstWord] >> (col & 63)) & 1;
+}
+
+bool BitMask::empty() const
+{
+	for (size_t k = 0; k < words.size(); k++)
+	{
+		if (words[k] != 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int BitMask::count() const
+{
+	int n = 0;
+
+	for (size_t k = 0; k < words.size(); k++)
+	{
+		n += popcount64(words[k]);
+	}
+
+	return n;
+}
+
+int BitMask::countAnd(const BitMask& other) const
+{
+	CV_Assert(frameSize == other.frameSize);
+
+	int firstRow = max(box.y, other.box.y);
+	int lastRow = min(box.y + box.height, other.box.y + other.box.height);
+
+	int w0 = max(firstWord, other.firstWord);
+	int w1 = min(firstWord + wordsPerRow, other.firstWord + other.wordsPerRow);
+
+	int n = 0;
+
+	for (int i = firstRow; i < lastRow; i++)
+	{
+		const uint64* a = rowWords(i) - firstWord;
+		const uint64* b = other.rowWords(i) - other.firstWord;
+
+		for (int w = w0; w < w1; w++)
+		{
+			n += popcount64(a[w] & b[w]);
+		}
+	}
+
+	return n;
+}
+
+int BitMask::firstSetCol(int row, int firstCol, int lastCol) const
+{
+	const uint64* w = rowWords(row);
+
+	firstCol = max(firstCol, box.x);
+	lastCol = min(lastCol, box.x + box.width - 1);
+
+	if (w == NULL || firstCol > lastCol)
+	{
+		return -1;
+	}
+
+	w -= firstWord;
+
+	for (int k = firstCol >> 6; k <= lastCol >> 6; k++)
+	{
+		uint64 bits = w[k];
+
+		if (k == firstCol >> 6)
+		{
+			bits &= ~(uint64)0 << (firstCol & 63);
+		}
+
+		if (k == lastCol >> 6)
+		{
+			bits &= ~(uint64)0 >> (63 - (lastCol & 63));
+		}
+
+		if (bits != 0)
+		{
+			return 64 * k + lowestBit(bits);
+		}
+	}
+
+	return -1;
+}
+
+int BitMask::lastSetCol(int row, int firstCol, int lastCol) const
+{
+	const uint64* w = rowWords(row);
+
+	firstCol = max(firstCol, box.x);
+	lastCol = min(lastCol, box.x + box.width - 1);
+
+	if (w == NULL || firstCol > lastCol)
+	{
+		return -1;
+	}
+
+	w -= firstWord;
+
+	for (int k = lastCol >> 6; k >= firstCol >> 6; k--)
+	{
+		uint64 bits = w[k];
+
+		if (k == firstCol >> 6)
+		{
+			bits &= ~(uint64)0 << (firstCol & 63);
+		}
+
+		if (k == lastCol >> 6)
+		{
+			bits &= ~(uint64)0 >> (63 - (lastCol & 63));
+		}
+
+		if (bits != 0)
+		{
+			return 64 * k + highestBit(bits);
+		}
+	}
+
+	return -1;
+}
+
+Mat BitMask::toMat(uchar value) const
+{
+	Mat mask(frameSize, CV_8UC1, Scalar(0));
+
+	for (int i = 0; i < box.height; i++)
+	{
+		const uint64* w = &words[(size_t)i * wordsPerRow];
+		uchar* dst = mask.ptr<uchar>(box.y + i);
+
+		for (int k = 0; k < wordsPerRow; k++)
+		{
+			for (uint64 bits = w[k]; bits != 0; bits &= bits - 1)
+			{
+				dst[64 * (firstWord + k) + lowestBit(bits)] = value;
+			}
+		}
+	}
+
+	return mask;
+}
@@ -0,0 +1,61 @@
+#ifndef BIT_MASK_H
+#define BIT_MASK_H
+
+#include <vector>
+
+#include <opencv2//core.hpp>
+
+using namespace cv;
+
+// Binary mask packed 64 pixels per word and cropped to a box inside a frame. Words are aligned to
+// multiples of 64 frame columns, so two masks of the same frame can be combined word by word
+// whatever their boxes; bits of a word that fall outside the box are always zero.
+class BitMask
+{
+	Rect box;
+	Size frameSize;
+
+	int firstWord;      //frame column of the first word is 64 * firstWord
+	int wordsPerRow;
+	std::vector<uint64> words;
+
+	void pack(Mat mask, Point origin, int threshold, Rect roi);
+
+	const uint64* rowWords(int row) const;
+
+public:
+
+	BitMask();
+
+	// pixels > threshold, cropped to their bounding box
+	BitMask(Mat mask, int threshold = 0);
+
+	// pixels > threshold inside roi only; the box is roi clipped to the frame
+	BitMask(Mat mask, int threshold, Rect roi);
+
+	// nonzero pixels of a mask that only covers the part of a frameSize frame starting at origin
+	BitMask(Mat mask, Point origin, Size p_frameSize);
+
+	Rect getBox() const;
+
+	Size getFrameSize() const;
+
+	bool get(int row, int col) const;
+
+	bool empty() const;
+
+	int count() const;
+
+	// number of pixels set in both masks
+	int countAnd(const BitMask& other) const;
+
+	// first / last column in [firstCol, lastCol] set on row, -1 if none
+	int firstSetCol(int row, int firstCol, int lastCol) const;
+
+	int lastSetCol(int row, int firstCol, int lastCol) const;
+
+	// full-frame CV_8UC1 mask with value where set
+	Mat toMat(uchar value = 1) const;
+};
+
+#endif
@@ -0,0 +1,285 @@
+#include <climits>
+
+#include "BlockMatcher.h"
+
+#include <opencv2/core/hal/intrin.hpp>
+
+using namespace std;
+
+static const int ANN_RANDOM_SAMPLES = 4;      //random candidates tried before the local search
+static const int ANN_SEARCH_ROUNDS = 2;       //passes of shrinking-radius search around the best candidate
+
+// Sum of squared differences of two zero-padded boundaries of len bytes (a multiple of 16).
+// The differences saturate at zero like the uchar Mat subtraction the search used before.
+static int boundarySSD(const uchar* a, const uchar* b, int len)
+{
+	int ssd = 0;
+	int i = 0;
+
+#if CV_SIMD128
+	v_int32x4 acc = v_setzero_s32();
+	for (; i < len; i += 16)
+	{
+		v_uint8x16 diff = v_load(a + i) - v_load(b + i);
+
+		v_uint16x8 lo, hi;
+		v_expand(diff, lo, hi);
+
+		v_int16x8 lo16 = v_reinterpret_as_s16(lo);
+		v_int16x8 hi16 = v_reinterpret_as_s16(hi);
+		acc = acc + v_dotprod(lo16, lo16) + v_dotprod(hi16, hi16);
+	}
+	ssd = v_reduce_sum(acc);
+#endif
+
+	for (; i < len; i++)
+	{
+		int diff = max((int)a[i] - (int)b[i], 0);
+		ssd += diff * diff;
+	}
+
+	return ssd;
+}
+
+BlockMatcher::BlockMatcher(Mat p_textureReference, int p_blockSize, double p_blockStep)
+{
+	CV_Assert(p_textureReference.type() == CV_8UC3 && p_blockSize > 0 && p_blockStep > 0);
+
+	textureReference = p_textureReference;
+	blockSize = p_blockSize;
+	blockStep = p_blockStep;
+	stepsPerBlock = max(cvRound(1 / blockStep), 1);
+
+	nBlocksVerticalRef = textureReference.rows / blockSize; //rounded down so that blocks are always inside the reference texture
+	nBlocksHorRef = textureReference.cols / blockSize;
+
+	CV_Assert(nBlocksVerticalRef > 0 && nBlocksHorRef > 0);
+
+	//same accumulated positions as stepping a double by blockStep
+	for (double v = 0; v <= nBlocksVerticalRef - 1; v += blockStep)
+	{
+		candidateV.push_back(v);
+	}
+
+	for (double h = 0; h <= nBlocksHorRef - 1; h += blockStep)
+	{
+		candidateH.push_back(h);
+	}
+
+	boundaryStride = (3 * blockSize + 15) / 16 * 16;
+
+	int nCandidates = (int)(candidateV.size() * candidateH.size());
+	firstRows.assign((size_t)nCandidates * boundaryStride, 0);
+	firstCols.assign((size_t)nCandidates * boundaryStride, 0);
+
+	for (int iv = 0; iv < (int)candidateV.size(); iv++)
+	{
+		for (int ih = 0; ih < (int)candidateH.size(); ih++)
+		{
+			int ind = iv * (int)candidateH.size() + ih;
+			int x = (int)(candidateH[ih] * blockSize);
+			int y = (int)(candidateV[iv] * blockSize);
+
+			uchar* row = &firstRows[(size_t)ind * boundaryStride];
+			uchar* col = &firstCols[(size_t)ind * boundaryStride];
+
+			const uchar* src = textureReference.ptr<uchar>(y) + 3 * x;
+			copy(src, src + 3 * blockSize, row);
+
+			for (int k = 0; k < blockSize; k++)
+			{
+				const uchar* pixel = textureReference.ptr<uchar>(y + k) + 3 * x;
+				col[3 * k] = pixel[0];
+				col[3 * k + 1] = pixel[1];
+				col[3 * k + 2] = pixel[2];
+			}
+		}
+	}
+
+	integral(textureReference, integralReference, CV_64F);
+}
+
+void BlockMatcher::getBoundaries(Mat texture, int v, int h, vector<uchar>& upperLastRow, vector<uchar>& leftLastCol) const
+{
+	upperLastRow.clear();
+	leftLastCol.clear();
+
+	if (v > 0)
+	{
+		upperLastRow.assign(boundaryStride, 0);
+
+		const uchar* src = texture.ptr<uchar>(v * blockSize - 1) + 3 * h * blockSize;
+		copy(src, src + 3 * blockSize, upperLastRow.begin());
+	}
+
+	if (h > 0)
+	{
+		leftLastCol.assign(boundaryStride, 0);
+
+		for (int k = 0; k < blockSize; k++)
+		{
+			const uchar* pixel = texture.ptr<uchar>(v * blockSize + k) + 3 * (h * blockSize - 1);
+			leftLastCol[3 * k] = pixel[0];
+			leftLastCol[3 * k + 1] = pixel[1];
+			leftLastCol[3 * k + 2] = pixel[2];
+		}
+	}
+}
+
+int BlockMatcher::boundaryCost(const uchar* upperLastRow, const uchar* leftLastCol, int ind) const
+{
+	//L2 norms truncated to int after each term, as the cost always was
+	int cost = 0;
+
+	if (upperLastRow) // there is an upper neighbor
+	{
+		cost = cost + sqrt((double)boundarySSD(upperLastRow, &firstRows[(size_t)ind * boundaryStride], boundaryStride));
+	}
+
+	if (leftLastCol) // there is a left neighbor
+	{
+		cost = cost + sqrt((double)boundarySSD(leftLastCol, &firstCols[(size_t)ind * boundaryStride], boundaryStride));
+	}
+
+	return cost;
+}
+
+void BlockMatcher::findBlockClosestToAverage(double* chosenBlockV_ptr, double* chosenBlockH_ptr) const
+{
+	double minDiff = INT_MAX;
+
+	Scalar avgReference = mean(textureReference);
+
+	double area = blockSize * blockSize;
+
+	for (double v = 0; v <= nBlocksVerticalRef - 1; v += 0.2)
+	{
+		for (double h = 0; h <= nBlocksHorRef - 1; h += 0.2)
+		{
+			int x = int(h*blockSize);
+			int y = int(v*blockSize);
+
+			//block sum from the integral image
+			Vec3d sum = integralReference.at<Vec3d>(y + blockSize, x + blockSize) - integralReference.at<Vec3d>(y, x + blockSize)
+				- integralReference.at<Vec3d>(y + blockSize, x) + integralReference.at<Vec3d>(y, x);
+
+			double currDiff = 0;
+			for (int c = 0; c < 3; c++)
+			{
+				double d = avgReference[c] - sum[c] / area;
+				currDiff += d * d;
+			}
+			currDiff = sqrt(currDiff);
+
+			if (currDiff < minDiff)
+			{
+				minDiff = currDiff;
+				*chosenBlockV_ptr = v;
+				*chosenBlockH_ptr = h;
+			}
+		}
+	}
+}
+
+void BlockMatcher::findBestMatchingBlock(Mat texture, int v, int h, double* chosenBlockV_ptr, double* chosenBlockH_ptr) const
+{
+	vector<uchar> upperLastRow, leftLastCol;
+	getBoundaries(texture, v, h, upperLastRow, leftLastCol);
+
+	const uchar* upper = upperLastRow.empty() ? NULL : &upperLastRow[0];
+	const uchar* left = leftLastCol.empty() ? NULL : &leftLastCol[0];
+
+	int nCandH = (int)candidateH.size();
+
+	int minCost = INT_MAX;
+	for (int iv = 0; iv < (int)candidateV.size(); iv++)
+	{
+		for (int ih = 0; ih < nCandH; ih++)
+		{
+			if (candidateV[iv] == v && candidateH[ih] == h)
+			{
+				continue; //do not pick same block
+			}
+
+			int currCost = boundaryCost(upper, left, iv * nCandH + ih);
+
+			if (currCost < minCost)
+			{
+				minCost = currCost;
+				*chosenBlockV_ptr = candidateV[iv];
+				*chosenBlockH_ptr = candidateH[ih];
+			}
+		}
+	}
+}
+
+void BlockMatcher::findApproximateMatchingBlock(Mat texture, int v, int h, double leftChosenV, double leftChosenH, double upperChosenV, double upperChosenH, unsigned seed, double* chosenBlockV_ptr, double* chosenBlockH_ptr) const
+{
+	vector<uchar> upperLastRow, leftLastCol;
+	getBoundaries(texture, v, h, upperLastRow, leftLastCol);
+
+	const uchar* upper = upperLastRow.empty() ? NULL : &upperLastRow[0];
+	const uchar* left = leftLastCol.empty() ? NULL : &leftLastCol[0];
+
+	int nCandV = (int)candidateV.size();
+	int nCandH = (int)candidateH.size();
+
+	int bestV = -1;
+	int bestH = -1;
+	int minCost = INT_MAX;
+
+	auto tryCandidate = [&](int iv, int ih)
+	{
+		iv = min(max(iv, 0), nCandV - 1);
+		ih = min(max(ih, 0), nCandH - 1);
+
+		if (candidateV[iv] == v && candidateH[ih] == h)
+		{
+			return; //do not pick same block
+		}
+
+		int currCost = boundaryCost(upper, left, iv * nCandH + ih);
+
+		if (currCost < minCost)
+		{
+			minCost = currCost;
+			bestV = iv;
+			bestH = ih;
+		}
+	};
+
+	//propagation: the reference block next to the one chosen for a neighbour continues it seamlessly
+	if (leftChosenV >= 0)
+	{
+		tryCandidate(cvRound(leftChosenV / blockStep), cvRound(leftChosenH / blockStep) + stepsPerBlock);
+	}
+
+	if (upperChosenV >= 0)
+	{
+		tryCandidate(cvRound(upperChosenV / blockStep) + stepsPerBlock, cvRound(upperChosenH / blockStep));
+	}
+
+	RNG rng(seed);
+
+	for (int k = 0; k < ANN_RANDOM_SAMPLES; k++)
+	{
+		tryCandidate(rng.uniform(0, nCandV), rng.uniform(0, nCandH));
+	}
+
+	for (int round = 0; round < ANN_SEARCH_ROUNDS && bestV >= 0; round++)
+	{
+		for (int radius = max(nCandV, nCandH); radius >= 1; radius /= 2)
+		{
+			tryCandidate(bestV + rng.uniform(-radius, radius + 1), bestH + rng.uniform(-radius, radius + 1));
+		}
+	}
+
+	if (bestV < 0) //only possible when the grid holds nothing but the block itself
+	{
+		findBestMatchingBlock(texture, v, h, chosenBlockV_ptr, chosenBlockH_ptr);
+		return;
+	}
+
+	*chosenBlockV_ptr = candidateV[bestV];
+	*chosenBlockH_ptr = candidateH[bestH];
+}
@@ -0,0 +1,53 @@
+#ifndef BLOCK_MATCHER_H
+#define BLOCK_MATCHER_H
+
+#include <vector>
+
+#include <opencv2//core.hpp>
+#include <opencv2/imgproc.hpp>
+
+using namespace cv;
+
+// Block search over a texture reference for synthesizeTexture. Candidate blocks lie on a grid
+// blockStep blocks apart; their first row and first column are copied once into contiguous
+// arrays, so matching a block against its left and upper neighbours only touches those arrays.
+class BlockMatcher
+{
+	Mat textureReference;
+	Mat integralReference;
+
+	int blockSize;
+	double blockStep;
+	int stepsPerBlock;
+
+	int nBlocksVerticalRef;
+	int nBlocksHorRef;
+
+	std::vector<double> candidateV;   //grid positions in blocks, v and h separately since the grid is separable
+	std::vector<double> candidateH;
+
+	int boundaryStride;              //bytes per stored boundary, padded with zeros to whole SIMD registers
+	std::vector<uchar> firstRows;    //per candidate: first row, BGR interleaved
+	std::vector<uchar> firstCols;    //per candidate: first column, BGR interleaved
+
+	int boundaryCost(const uchar* upperLastRow, const uchar* leftLastCol, int ind) const;
+	void getBoundaries(Mat texture, int v, int h, std::vector<uchar>& upperLastRow, std::vector<uchar>& leftLastCol) const;
+
+public:
+
+	BlockMatcher(Mat p_textureReference, int p_blockSize, double p_blockStep);
+
+	// first block of the texture: the block whose mean is closest to the mean of the reference
+	void findBlockClosestToAverage(double* chosenBlockV_ptr, double* chosenBlockH_ptr) const;
+
+	// exhaustive search for the candidate whose first row / column best continue the already
+	// synthesized upper / left neighbours of block (v, h) in texture
+	void findBestMatchingBlock(Mat texture, int v, int h, double* chosenBlockV_ptr, double* chosenBlockH_ptr) const;
+
+	// PatchMatch-style approximate search: tries the continuations of the blocks chosen for the
+	// left and upper neighbours (negative when there is none), then random samples around the best
+	// candidate at shrinking radii. Deterministic for a given seed.
+	void findApproximateMatchingBlock(Mat texture, int v, int h, double leftChosenV, double leftChosenH, double upperChosenV, double upperChosenH, unsigned seed, double* chosenBlockV_ptr, double* chosenBlockH_ptr) const;
+};
+
+#endif
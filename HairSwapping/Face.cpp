@@ -3,10 +3,27 @@
 #include <opencv2/imgproc.hpp>
 #include "Face.h"
 
-Face::Face(Mat p_faceMask, Mat p_skinMask, int p_leftEdge, int p_rightEdge, int p_upperPointX, int p_upperPointY, int p_leftEdgeEye, int p_rightEdgeEye, int p_bottomEye, int p_topEye, int p_hairTypicalBottom, int p_headSize, Rect p_regionA, Rect p_regionB, Rect p_regionC)
+Face::Face(Mat p_faceMask, Rect p_faceBox, Mat p_skinMask, Rect p_skinBox, Size p_frameSize, int p_leftEdge, int p_rightEdge, int p_upperPointX, int p_upperPointY, int p_leftEdgeEye, int p_rightEdgeEye, int p_bottomEye, int p_topEye, int p_hairTypicalBottom, int p_headSize, Rect p_regionA, Rect p_regionB, Rect p_regionC)
 	{
 		faceMask = p_faceMask;
 		skinMask = p_skinMask;
+		faceBox = p_faceBox;
+		skinBox = p_skinBox;
+		frameSize = p_frameSize;
+
+		faceSpans = buildSpans(faceMask, faceBox);
+		skinSpans = buildSpans(skinMask, skinBox);
+
+		skinMaskBits = BitMask(skinMask, skinBox.tl(), frameSize);
+
+		faceTopEdge = Mat(1, faceBox.width, CV_32SC1, Scalar(INT_MAX));
+		for (int i = faceBox.height - 1; i >= 0; i--)
+		{
+			for (int j = faceSpans.at<int>(i, FIRST_COL); j <= faceSpans.at<int>(i, LAST_COL); j++)
+			{
+				faceTopEdge.at<int>(0, j - faceBox.x) = faceBox.y + i;
+			}
+		}
 
 		leftEdge = p_leftEdge;
 		rightEdge = p_rightEdge;
@@ -27,77 +44,199 @@ Face::Face(Mat p_faceMask, Mat p_skinMask, int p_leftEdge, int p_rightEdge, int
 
 	}
 
-	Mat Face::getFaceMask()
+	Mat Face::toFrame(Mat mask, Rect box) const
+	{
+		Mat frame(frameSize, CV_8UC1, Scalar(0));
+
+		if (!box.empty())
+		{
+			mask.copyTo(frame(box));
+		}
+
+		return frame;
+	}
+
+	Mat Face::getFaceMask() const
+	{
+		return toFrame(faceMask, faceBox);
+	}
+
+	Mat Face::getSkinMask() const
+	{
+		return toFrame(skinMask, skinBox);
+	}
+
+	Mat Face::getFaceMaskROI() const
 	{
 		return faceMask;
 	}
 
-	Mat Face::getSkinMask()
+	Mat Face::getSkinMaskROI() const
 	{
 		return skinMask;
 	}
 
-	int Face::getLeftEdge()
+	Rect Face::getFaceBox() const
+	{
+		return faceBox;
+	}
+
+	Rect Face::getSkinBox() const
+	{
+		return skinBox;
+	}
+
+	const BitMask& Face::getSkinMaskBits() const
+	{
+		return skinMaskBits;
+	}
+
+	Mat Face::buildSpans(Mat mask, Rect box)
+	{
+		Mat spans(box.height, 2, CV_32SC1);
+
+		for (int i = 0; i < box.height; i++)
+		{
+			const uchar* row = mask.ptr<uchar>(i);
+
+			int first = 0;
+			while (first < box.width && row[first] == 0)
+			{
+				first++;
+			}
+
+			int last = box.width - 1;
+			while (last >= first && row[last] == 0)
+			{
+				last--;
+			}
+
+			if (first > last) //empty row
+			{
+				first = INT_MAX;
+				last = 0;
+			}
+			else
+			{
+				CV_DbgAssert(countNonZero(mask.row(i)) == last - first + 1);
+
+				first += box.x;
+				last += box.x;
+			}
+
+			spans.at<int>(i, FIRST_COL) = first;
+			spans.at<int>(i, LAST_COL) = last;
+		}
+
+		return spans;
+	}
+
+	int Face::spanCol(Mat spans, Rect box, int row, int col)
+	{
+		if (row < box.y || row >= box.y + box.height)
+		{
+			return col == FIRST_COL ? INT_MAX : 0; //row outside the mask
+		}
+
+		return spans.at<int>(row - box.y, col);
+	}
+
+	int Face::getFaceFirstCol(int row) const
+	{
+		return spanCol(faceSpans, faceBox, row, FIRST_COL);
+	}
+
+	int Face::getFaceLastCol(int row) const
+	{
+		return spanCol(faceSpans, faceBox, row, LAST_COL);
+	}
+
+	int Face::getSkinFirstCol(int row) const
+	{
+		return spanCol(skinSpans, skinBox, row, FIRST_COL);
+	}
+
+	int Face::getSkinLastCol(int row) const
+	{
+		return spanCol(skinSpans, skinBox, row, LAST_COL);
+	}
+
+	int Face::getFaceTopRow(int col) const
+	{
+		if (col < faceBox.x || col >= faceBox.x + faceBox.width)
+		{
+			return INT_MAX;
+		}
+
+		return faceTopEdge.at<int>(0, col - faceBox.x);
+	}
+
+	bool Face::isFacePixel(int row, int col) const
+	{
+		return col >= getFaceFirstCol(row) && col <= getFaceLastCol(row);
+	}
+
+	int Face::getLeftEdge() const
 	{
 		return leftEdge;
 	}
 
-	int Face::getRightEdge()
+	int Face::getRightEdge() const
 	{
 		return rightEdge;
 	}
 
-	int Face::getUpperPointX()
+	int Face::getUpperPointX() const
 	{
 		return upperPointX;
 	}
 
-	int Face::getUpperPointY()
+	int Face::getUpperPointY() const
 	{
 		return upperPointY;
 	}
 
-	int Face::getLeftEdgeEye()
+	int Face::getLeftEdgeEye() const
 	{
 		return leftEdgeEye;
 	}
 
-	int Face::getRightEdgeEye()
+	int Face::getRightEdgeEye() const
 	{
 		return rightEdgeEye;
 	}
 
-	int Face::getTopEye()
+	int Face::getTopEye() const
 	{
 		return topEye;
 	}
 
-	int Face::getBottomEye()
+	int Face::getBottomEye() const
 	{
 		return bottomEye;
 	}
 
-	int Face::getHairTypicalBottom()
+	int Face::getHairTypicalBottom() const
 	{
 		return hairTypicalBottom;
 	}
 
-	int Face::getHeadSize()
+	int Face::getHeadSize() const
 	{
 		return headSize;
 	}
 
-	Rect Face::getRegionA()
+	Rect Face::getRegionA() const
 	{
 		return regionA;
 	}
 
-	Rect Face::getRegionB()
+	Rect Face::getRegionB() const
 	{
 		return regionB;
 	}
 
-	Rect Face::getRegionC()
+	Rect Face::getRegionC() const
 	{
 		return regionC;
 	}
@@ -107,7 +246,7 @@ Face::Face(Mat p_faceMask, Mat p_skinMask, int p_leftEdge, int p_rightEdge, int
 		facePixels = p_facePixels;
 	}
 
-	Mat Face::getFacePixels()
+	Mat Face::getFacePixels() const
 	{
 		return facePixels;
 	}
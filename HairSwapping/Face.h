@@ -1,16 +1,38 @@
 #ifndef FACE_H
 #define FACE_H
 
+#include "BitMask.h"
+
 using namespace cv;
 
+static const int FIRST_COL = 0;
+static const int LAST_COL = 1;
+
 class Face
 {
 	
 
+	//masks only cover their bounding box; faceBox / skinBox place them in the frame
 	Mat faceMask;
 	Mat skinMask;
+	Rect faceBox;
+	Rect skinBox;
+	Size frameSize;
+
 	Mat facePixels;
 
+	//both masks are filled outlines, so every row is a single run: per box row [first, last] frame
+	//column, INT_MAX and 0 for rows outside the mask, as in findIndForhead
+	Mat faceSpans;
+	Mat skinSpans;
+	Mat faceTopEdge;   //per box column, first frame row of the face mask (INT_MAX if none)
+
+	BitMask skinMaskBits;
+
+	static Mat buildSpans(Mat mask, Rect box);
+	static int spanCol(Mat spans, Rect box, int row, int col);
+	Mat toFrame(Mat mask, Rect box) const;
+
 	int upperPointX; //Jx
 	int upperPointY; //Jy
 
@@ -32,41 +54,65 @@ class Face
 
 public:
 
-	Face(Mat p_faceMask, Mat p_skinMask, int p_leftEdge, int p_rightEdge, int p_upperPointX, int p_upperPointY, int p_leftEdgeEye, int p_rightEdgeEye, int p_bottomEye, int p_topEye, int p_hairTypicalBottom, int p_headSize, Rect p_regionA, Rect p_regionB, Rect p_regionC);
+	Face(Mat p_faceMask, Rect p_faceBox, Mat p_skinMask, Rect p_skinBox, Size p_frameSize, int p_leftEdge, int p_rightEdge, int p_upperPointX, int p_upperPointY, int p_leftEdgeEye, int p_rightEdgeEye, int p_bottomEye, int p_topEye, int p_hairTypicalBottom, int p_headSize, Rect p_regionA, Rect p_regionB, Rect p_regionC);
+
+	//full-frame masks, built on every call
+	Mat getFaceMask() const;
+
+	Mat getSkinMask() const;
+
+	//masks over their bounding boxes only, no copy
+	Mat getFaceMaskROI() const;
+
+	Mat getSkinMaskROI() const;
+
+	Rect getFaceBox() const;
+
+	Rect getSkinBox() const;
+
+	const BitMask& getSkinMaskBits() const;
+
+	int getFaceFirstCol(int row) const;
+
+	int getFaceLastCol(int row) const;
+
+	int getSkinFirstCol(int row) const;
+
+	int getSkinLastCol(int row) const;
 
-	Mat getFaceMask();
+	int getFaceTopRow(int col) const;
 
-	Mat getSkinMask();
+	bool isFacePixel(int row, int col) const;
 
-	int getLeftEdge();
+	int getLeftEdge() const;
 
-	int getRightEdge();
+	int getRightEdge() const;
 
-	int getUpperPointX();
+	int getUpperPointX() const;
 
-	int getUpperPointY();
+	int getUpperPointY() const;
 
-	int getLeftEdgeEye();
+	int getLeftEdgeEye() const;
 
-	int getRightEdgeEye();
+	int getRightEdgeEye() const;
 
-	int getTopEye();
+	int getTopEye() const;
 
-	int getBottomEye();
+	int getBottomEye() const;
 
-	int getHairTypicalBottom();
+	int getHairTypicalBottom() const;
 
-	int getHeadSize();
+	int getHeadSize() const;
 
-	Rect getRegionA();
+	Rect getRegionA() const;
 
-	Rect getRegionB();
+	Rect getRegionB() const;
 
-	Rect getRegionC();
+	Rect getRegionC() const;
 
 	void setFacePixels(Mat p_facePixels);
 
-	Mat getFacePixels();
+	Mat getFacePixels() const;
 	
 };
 
@@ -17,6 +17,8 @@ Face detectFace(Mat_<unsigned char> img, const char * path, const char* dataDir)
 	
 	Mat faceMask;
 	Mat skinMask;
+	Rect faceBox;
+	Rect skinBox;
 
 	int upperPointX;
 	int upperPointY;
@@ -65,9 +67,9 @@ Face detectFace(Mat_<unsigned char> img, const char * path, const char* dataDir)
 			landmarks[2 * l + 1] = std::stoi(curr_landmark);
 		}	
 
-		faceMask = detectUpperBoundaries(img, landmarks, &upperPointX, &upperPointY);
+		faceMask = detectUpperBoundaries(img, landmarks, &upperPointX, &upperPointY, &faceBox);
 
-		skinMask = detectSkinMask(img, landmarks);
+		skinMask = detectSkinMask(img, landmarks, &skinBox);
 
 		leftEdgeX = landmarks[2 * LEFT_EDGE_IND];
 		leftEdgeY = landmarks[2 * LEFT_EDGE_IND+1];
@@ -186,50 +188,46 @@ Face detectFace(Mat_<unsigned char> img, const char * path, const char* dataDir)
 	cv::imshow("face", img);
 	cv::waitKey();*/
 
-	Face face(faceMask, skinMask, leftEdgeX, rightEdgeX, upperPointX, upperPointY, leftEyeEdgeX, rightEyeEdgex, bottomEyeY, topEyeY, hairTypicalBottom, headSize, RectA, RectB, RectC);
+	Face face(faceMask, faceBox, skinMask, skinBox, img.size(), leftEdgeX, rightEdgeX, upperPointX, upperPointY, leftEyeEdgeX, rightEyeEdgex, bottomEyeY, topEyeY, hairTypicalBottom, headSize, RectA, RectB, RectC);
 	return face;
 
 }
 
-Mat  detectSkinMask(Mat img, float landmarks[])
+Mat rasterizePolygon(std::vector<Point> polygon, Size frameSize, Rect* box)
 {
-	Mat skinMask(img.rows, img.cols, CV_8UC1, Scalar(0));
+	//only the bounding box of the polygon is allocated
+	*box = boundingRect(polygon) & Rect(Point(0, 0), frameSize);
 
-	cv::line(skinMask, Point(landmarks[0], landmarks[1]), Point(landmarks[2* (IND_LOWER_BOUND_MIDDLE*2)], landmarks[2 *(IND_LOWER_BOUND_MIDDLE * 2)+1]), Scalar(255, 255, 255), 1, 8); // segment from M to I
-	
-	int nSkinPoints = sizeof(noseIndSequence) / sizeof(int);
+	Mat mask(box->height, box->width, CV_8UC1, Scalar(0));
 
-	for (int i = 0; i < IND_LOWER_BOUND_MIDDLE * 2; i++)
+	if (!box->empty())
 	{
-		int point1_X = landmarks[2 * i];
-		int point1_Y = landmarks[2 * i + 1];
-
-		int point2_X = landmarks[2 * i + 2];
-		int point2_Y = landmarks[2 * i + 3];
-
-		cv::line(skinMask, Point(point1_X, point1_Y), Point(point2_X, point2_Y), Scalar(255, 255, 255), 1, 8); // segment from M to I
+		std::vector<std::vector<Point> > polygons(1, polygon);
+		fillPoly(mask, polygons, Scalar(255), 8, 0, -box->tl());
 	}
-	
 
-	Mat im_floodfill = skinMask.clone();
-	floodFill(im_floodfill, cv::Point(0, 0), Scalar(255));
+	return mask;
+}
+
+Mat  detectSkinMask(Mat img, float landmarks[], Rect* skinBox)
+{
+	//lower face outline, closed by the segment from the last point back to M
+	std::vector<Point> outline;
 
-	// Invert floodfilled image
-	bitwise_not(im_floodfill, skinMask);
+	for (int i = 0; i <= IND_LOWER_BOUND_MIDDLE * 2; i++)
+	{
+		outline.push_back(Point(landmarks[2 * i], landmarks[2 * i + 1]));
+	}
 
-	return skinMask;
+	return rasterizePolygon(outline, img.size(), skinBox);
 }
 
 
-Mat detectUpperBoundaries(Mat_<unsigned char> img, float landmarks[], int *upperPoint_X, int *upperPoint_Y)
+Mat detectUpperBoundaries(Mat_<unsigned char> img, float landmarks[], int *upperPoint_X, int *upperPoint_Y, Rect* faceBox)
 {
-	Mat faceMask(img.rows, img.cols, CV_8UC1, Scalar(0));
-
 	int lowerBoundMiddleX = landmarks[IND_LOWER_BOUND_MIDDLE * 2];
 	int lowerBoundMiddleY = landmarks[IND_LOWER_BOUND_MIDDLE * 2 + 1];
 	
-	std::map<int, int> mapKeyPoints;
-
 	int baseNoseX = landmarks[BASE_OF_NOSE_IND * 2];
 	int baseNoseY = landmarks[BASE_OF_NOSE_IND * 2 + 1];
 
@@ -259,33 +257,27 @@ Mat detectUpperBoundaries(Mat_<unsigned char> img, float landmarks[], int *upper
 	img(cvRound(I_Y), cvRound(I_X)) = 255;
 	img(cvRound(K_Y), cvRound(K_X)) = 255;
 	
-	//draw boundaries for upper face
-	cv::ellipse(faceMask, Point(I_X, M_Y), Size(I_X - M_X, M_Y - I_Y), 0, 180, 270 , Scalar(255,255,255), 1, 8, 0); // segment from M to I
-	cv::ellipse(faceMask, Point(J_X, I_Y), Size(J_X - I_X, I_Y - J_Y), 0, 180, 270, Scalar(255, 255, 255), 1, 8, 0); //segment from I to J
-	cv::ellipse(faceMask, Point(J_X, K_Y), Size(K_X - J_X, K_Y - J_Y), 0, 270, 360, Scalar(255, 255, 255), 1, 8, 0); //segment from J to K
-	cv::ellipse(faceMask, Point(K_X, N_Y), Size(N_X - K_X, N_Y - K_Y), 0, 270, 360, Scalar(255, 255, 255), 1, 8, 0); //segment from K to N
+	//boundaries for upper face, from M over the forehead to N
+	std::vector<Point> outline;
+	std::vector<Point> arc;
+
+	ellipse2Poly(Point(I_X, M_Y), Size(I_X - M_X, M_Y - I_Y), 0, 180, 270, 1, arc); // segment from M to I
+	outline.insert(outline.end(), arc.begin(), arc.end());
+	ellipse2Poly(Point(J_X, I_Y), Size(J_X - I_X, I_Y - J_Y), 0, 180, 270, 1, arc); //segment from I to J
+	outline.insert(outline.end(), arc.begin(), arc.end());
+	ellipse2Poly(Point(J_X, K_Y), Size(K_X - J_X, K_Y - J_Y), 0, 270, 360, 1, arc); //segment from J to K
+	outline.insert(outline.end(), arc.begin(), arc.end());
+	ellipse2Poly(Point(K_X, N_Y), Size(N_X - K_X, N_Y - K_Y), 0, 270, 360, 1, arc); //segment from K to N
+	outline.insert(outline.end(), arc.begin(), arc.end());
 	
-	//draw boundaries for lower face																												 																										 //draw boundaries for upper face//draw boundaries for upper face
-	for (int i = 0; i < IND_LOWER_BOUND_MIDDLE * 2; i++)
+	//boundaries for lower face, back from N to M
+	for (int i = IND_LOWER_BOUND_MIDDLE * 2; i >= 0; i--)
 	{
-		int point1_X = landmarks[2*i];
-		int point1_Y = landmarks[2 *i +1];
-
-		int point2_X = landmarks[2 * i + 2];
-		int point2_Y = landmarks[2 * i + 3];
-
-		cv::line(faceMask, Point(point1_X, point1_Y), Point(point2_X, point2_Y), Scalar(255, 255, 255), 1, 8);
+		outline.push_back(Point(landmarks[2 * i], landmarks[2 * i + 1]));
 	}
 
-	Mat im_floodfill = faceMask.clone();
-	floodFill(im_floodfill, cv::Point(0, 0), Scalar(255));
-
-	// Invert floodfilled image to get the faceMask
-	bitwise_not(im_floodfill, faceMask);
-
-	return faceMask;
+	return rasterizePolygon(outline, img.size(), faceBox);
 }
 
 
 
-
@@ -48,8 +48,10 @@ static const int REGION_C_OFFSET_FROM_NOSE = 2;
 
 Face detectFace(Mat_<unsigned char> img, const char * path, const char* dataDir);
 
-Mat detectUpperBoundaries(Mat_<unsigned char> img, float landmarks[], int *upperPoint_X, int *upperPoint_Y);
+Mat detectUpperBoundaries(Mat_<unsigned char> img, float landmarks[], int *upperPoint_X, int *upperPoint_Y, Rect* faceBox);
 
-Mat  detectSkinMask(Mat img, float landmarks[]);
+Mat  detectSkinMask(Mat img, float landmarks[], Rect* skinBox);
+
+Mat rasterizePolygon(std::vector<Point> polygon, Size frameSize, Rect* box);
 
 #endif //FACE_RECOGNITION_H
\ No newline at end of file
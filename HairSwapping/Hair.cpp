@@ -4,31 +4,41 @@
 
 #include "Hair.h"
 
-Hair::Hair(Mat p_hairMask, Mat p_hairPixels, Mat p_hairMaskNoMatting, int p_hairConnectionPointLocationX, int p_hairConnectionPointLocationY, int p_hairConnectionPointDistanceToJ_X, int p_hairConnectionPointDistanceToJ_Y)
+Hair::Hair(Mat p_hairMask, std::vector<Mat> p_hairLayers, BitMask p_hairMaskNoMatting, int p_hairConnectionPointLocationX, int p_hairConnectionPointLocationY, int p_hairConnectionPointDistanceToJ_X, int p_hairConnectionPointDistanceToJ_Y, Scalar p_hairMean, Scalar p_hairStd)
 {
 	hairMaskNoMatting = p_hairMaskNoMatting;
-	hairMask = p_hairMask;
-	hairPixels = p_hairPixels;
+	hairMask = BitMask(p_hairMask);
+	hairLayers = p_hairLayers;
 	hairConnectionPointLocationX = p_hairConnectionPointLocationX;
 	hairConnectionPointLocationY = p_hairConnectionPointLocationY;
 	hairConnectionPointDistanceToJ_X = p_hairConnectionPointDistanceToJ_X;
 	hairConnectionPointDistanceToJ_Y = p_hairConnectionPointDistanceToJ_Y;
-
-	meanStdDev(hairPixels, hairMean, hairStd, hairMask);
+	hairMean = p_hairMean;
+	hairStd = p_hairStd;
 
 }
 
-Mat Hair::getHairPixels()
+std::vector<Mat> Hair::getHairLayers()
 {
-	return hairPixels;
+	return hairLayers;
 }
 
 Mat Hair::getHairMask()
 {
-	return hairMask;
+	return hairMask.toMat();
 }
 
 Mat Hair::getHairMaskNoMatting()
+{
+	return hairMaskNoMatting.toMat();
+}
+
+const BitMask& Hair::getHairMaskBits()
+{
+	return hairMask;
+}
+
+const BitMask& Hair::getHairMaskNoMattingBits()
 {
 	return hairMaskNoMatting;
 }
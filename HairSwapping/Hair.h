@@ -5,14 +5,21 @@
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "BitMask.h"
+
 using namespace cv;
 
+static const int HAIR_LAYER_ALPHA = 3;   //index of the alpha plane in the hair layers
+
 class Hair
 {
 
-	Mat hairMaskNoMatting;
-	Mat hairMask;
-	Mat hairPixels;
+	//0/1 masks, bit-packed and cropped to the hair
+	BitMask hairMaskNoMatting;
+	BitMask hairMask;
+
+	//planar hair layer: B, G, R premultiplied by alpha, then the 8-bit alpha plane
+	std::vector<Mat> hairLayers;
 
 	int hairConnectionPointLocationX;
 	int hairConnectionPointLocationY;
@@ -30,14 +37,19 @@ public:
 
 	}
 
-	Hair(Mat p_hairMask, Mat p_hairPixels, Mat p_hairMaskNoMatting, int p_hairConnectionPointLocationX, int p_hairConnectionPointLocationY, int p_hairConnectionPointDistanceToJ_X, int p_hairConnectionPointDistanceToJ_Y);
+	Hair(Mat p_hairMask, std::vector<Mat> p_hairLayers, BitMask p_hairMaskNoMatting, int p_hairConnectionPointLocationX, int p_hairConnectionPointLocationY, int p_hairConnectionPointDistanceToJ_X, int p_hairConnectionPointDistanceToJ_Y, Scalar p_hairMean, Scalar p_hairStd);
 	
-	Mat getHairPixels();
+	std::vector<Mat> getHairLayers();
 
+	//full-frame 0/1 masks, unpacked on every call
 	Mat getHairMask();
 
 	Mat getHairMaskNoMatting();
 
+	const BitMask& getHairMaskBits();
+
+	const BitMask& getHairMaskNoMattingBits();
+
 	int getHairConnectionPointLocationX();
 
 	int getHairConnectionPointLocationY();
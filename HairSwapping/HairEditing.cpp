@@ -32,35 +32,16 @@ Mat swapHair(Hair hair, Face face, int modelHeadSize, Mat synthesizedFace)
 	int refPointX = connXModel + distModelTargetX;
 	int refPointY = connYModel + distModelTargetY;
 
-	Mat hairMask = hair.getHairMask();
-
-	//Mat hairPixels(modelImg.rows, modelImg.cols, CV_8UC3, Scalar(BACKGROUND_HAIR_B, BACKGROUND_HAIR_G, BACKGROUND_HAIR_R));
-	//modelImg.copyTo(hairPixels, hairMask);
-	
-	Mat hairMaskShifted;
-	Mat hairPixelsShifted;
-
-	
-
-	//alpha value will hold the mask, and will prevent errors when the hair color == backgroundColor, or when scaling smoothes the background
-	//mat hairAlpha = createAlphaImage(hairPixels, hairMask);
-
-	Mat hairAlpha = hair.getHairPixels();
-
-	//cv::namedWindow("hairAlpha", CV_WINDOW_AUTOSIZE);
-	//cv::imshow("hairAlpha", hairAlpha);
-	//cv::waitKey();
-
-	Mat translationMatrix = (Mat_<double>(2, 3) << 1, 0, distModelTargetX, 0, 1, distModelTargetY);
-	warpAffine(hairAlpha, hairPixelsShifted, translationMatrix, hairMask.size(), 1, 0, Scalar(BACKGROUND_HAIR_B, BACKGROUND_HAIR_G, BACKGROUND_HAIR_R,0));
+	//premultiplied colour planes and alpha, warped plane by plane during the search
+	std::vector<Mat> hairLayers = hair.getHairLayers();
 	
 	std::vector<std::vector<Point> > contours;
 
-	Mat contourImg = face.getFaceMask().clone()*255;
+	Mat contourImg = face.getFaceMask()*255;
 
 	findContours(contourImg, contours, CV_RETR_LIST, CV_CHAIN_APPROX_SIMPLE);	
 
-	Mat hairSwap = findBestScaleAndPosition(synthesizedFace, hairAlpha, face, modelHeadSize, contours[0], refPointX, refPointY, distModelTargetX, distModelTargetY);
+	Mat hairSwap = findBestScaleAndPosition(synthesizedFace, hairLayers, face, modelHeadSize, contours[0], refPointX, refPointY, distModelTargetX, distModelTargetY);
 
 	return hairSwap;
 
@@ -76,64 +57,40 @@ Mat convertTo3channels(Mat mat)
 
 }
 
-
-Mat trySwapHair(Mat synthesizedFace, Mat scaledHair, Mat scaledHairMask, Face face, Mat skinPixels, std::vector<Point> contours, int* energyHoles, int* energyHairOverlap)
+void compositeHair(Mat background, std::vector<Mat> hairLayers, Mat& composite)
 {
+	//premultiplied "over": hair + background * (1 - alpha), in one pass over the planes
+	CV_Assert(background.type() == CV_8UC3 && hairLayers.size() == HAIR_LAYER_ALPHA + 1 && hairLayers[HAIR_LAYER_ALPHA].size() == background.size());
 
-	clock_t  tStartSwap, tEndSwap, tStartHoles, tEndHoles, tStartOverlap, tEndOverlap;
-
-	Mat hairSwap;
-	Mat weightedScaledHair;
-	Mat weightedSynthesizedFace;
-	Mat alphaMask;
-	Mat background_mask;
-	
-	//int type0 = scaledHairMask.type();
-
-	//tStartSwap = clock();
+	composite.create(background.size(), CV_8UC3);
 
-	scaledHairMask.convertTo(alphaMask, CV_32FC1, 1.0 / 255); // alpha mask
-	alphaMask = convertTo3channels(alphaMask);
-
-	scaledHair.convertTo(scaledHair, CV_32FC3);
-
-	/*cv::namedWindow("scaledHair", CV_WINDOW_AUTOSIZE);
-	cv::imshow("scaledHair", scaledHair/255);
-	cv::waitKey();*/
-	
-	multiply(scaledHair , alphaMask, weightedScaledHair);
-
-	weightedScaledHair.convertTo(weightedScaledHair, CV_8UC3);
-
-	/*cv::namedWindow("weightedScaledHair", CV_WINDOW_AUTOSIZE);
-	cv::imshow("weightedScaledHair", weightedScaledHair);
-	cv::waitKey();*/
-
-	background_mask = Scalar::all(1.0) - alphaMask;
-
-	multiply(background_mask, synthesizedFace, weightedSynthesizedFace);
-
-	weightedSynthesizedFace.convertTo(weightedSynthesizedFace, CV_8UC3);
-
-	/*cv::namedWindow("weightedSynthesizedFace", CV_WINDOW_AUTOSIZE);
-	cv::imshow("weightedSynthesizedFace", weightedSynthesizedFace);
-	cv::waitKey();*/
-	 
-	add(weightedSynthesizedFace, weightedScaledHair, hairSwap);
+	for (int i = 0; i < background.rows; i++)
+	{
+		const uchar* bg = background.ptr<uchar>(i);
+		const uchar* hairB = hairLayers[0].ptr<uchar>(i);
+		const uchar* hairG = hairLayers[1].ptr<uchar>(i);
+		const uchar* hairR = hairLayers[2].ptr<uchar>(i);
+		const uchar* alpha = hairLayers[HAIR_LAYER_ALPHA].ptr<uchar>(i);
+		uchar* dst = composite.ptr<uchar>(i);
+
+		for (int j = 0; j < background.cols; j++)
+		{
+			int transparency = 255 - alpha[j];
 
-	hairSwap.convertTo(hairSwap, CV_8UC3);
+			dst[3 * j] = saturate_cast<uchar>(hairB[j] + (bg[3 * j] * transparency + 127) / 255);
+			dst[3 * j + 1] = saturate_cast<uchar>(hairG[j] + (bg[3 * j + 1] * transparency + 127) / 255);
+			dst[3 * j + 2] = saturate_cast<uchar>(hairR[j] + (bg[3 * j + 2] * transparency + 127) / 255);
+		}
+	}
+}
 
-	//tEndSwap = clock();
-	//
-	//double dif = double (tEndSwap - tStartSwap) / CLOCKS_PER_SEC;
-	//printf("Time swap = %.5lf seconds. ", dif);
+Mat trySwapHair(Mat synthesizedFace, std::vector<Mat> hairLayers, const Face& face, Mat skinPixels, std::vector<Point> contours, int* energyHoles, int* energyHairOverlap)
+{
+	Mat hairSwap;
+	compositeHair(synthesizedFace, hairLayers, hairSwap);
 
-	//cv::namedWindow("hairSwap", CV_WINDOW_AUTOSIZE);
-	//cv::imshow("hairSwap", hairSwap);
-	//cv::waitKey();
+	Mat scaledHairMask = hairLayers[HAIR_LAYER_ALPHA];
 
-	//scaledHair.copyTo(hairSwap, scaledHairMask);
-	
 	//tStartHoles = clock();
 
 	*energyHoles = calculateEnergyHoles(hairSwap, scaledHairMask, contours, face, skinPixels);
@@ -170,12 +127,9 @@ Mat createAlphaImage(Mat mat, Mat alpha)
 	return alphaImage;
 }
 
-Mat findBestScaleAndPosition(Mat synthesizedFace, Mat hairPixels, Face face, int modelHeadSize, std::vector<Point> contours, int refPointX, int refPointY, int refTx, int refTy)
+Mat findBestScaleAndPosition(Mat synthesizedFace, std::vector<Mat> hairLayers, const Face& face, int modelHeadSize, std::vector<Point> contours, int refPointX, int refPointY, int refTx, int refTy)
 {
 
-	Mat floatSynthesizedFace;
-	synthesizedFace.convertTo(floatSynthesizedFace, CV_32FC3); // needs to be float for alpha blending
-
 	int hairBottom = face.getHairTypicalBottom();
 
 	Mat skinPixels;
@@ -185,7 +139,7 @@ Mat findBestScaleAndPosition(Mat synthesizedFace, Mat hairPixels, Face face, int
 	int minEnergy = synthesizedFace.cols*synthesizedFace.rows;
 	int bestEnergyHoles = minEnergy;
 	int bestEnergyHairOverlap = minEnergy;
-	Mat bestScaledHair;
+	std::vector<Mat> bestScaledHair;
 
 	double headSizeRatio = (double) face.getHeadSize() / modelHeadSize;
 
@@ -202,7 +156,7 @@ Mat findBestScaleAndPosition(Mat synthesizedFace, Mat hairPixels, Face face, int
 
 	for (double sX = MIN_SCALE; sX <= MAX_SCALE; sX += STEP_S)
 	{
-		Mat scaledHairX = scaleHair(hairPixels, refPointX, refPointY, refTx, refTy, sX, 1, Scalar(BACKGROUND_HAIR_B, BACKGROUND_HAIR_G, BACKGROUND_HAIR_R, 0));
+		std::vector<Mat> scaledHairX = scaleHairLayers(hairLayers, refPointX, refPointY, refTx, refTy, sX, 1);
 
 		for (double sY = MIN_SCALE; sY <= MAX_SCALE; sY += STEP_S)
 		{
@@ -211,7 +165,7 @@ Mat findBestScaleAndPosition(Mat synthesizedFace, Mat hairPixels, Face face, int
 
 			//tStartScale = clock();
 
-			Mat scaledHair = scaleHair(scaledHairX, refPointX, refPointY, refTx, refTy, 1, sY, Scalar(BACKGROUND_HAIR_B, BACKGROUND_HAIR_G, BACKGROUND_HAIR_R, 0));
+			std::vector<Mat> scaledHair = scaleHairLayers(scaledHairX, refPointX, refPointY, refTx, refTy, 1, sY);
 
 			/*tEndScale = clock();
 
@@ -222,21 +176,18 @@ Mat findBestScaleAndPosition(Mat synthesizedFace, Mat hairPixels, Face face, int
 			{
 				for (int ty = -MAX_TY; ty <= MAX_TY; ty += STEP_T)
 				{
-					Mat translatedHair, currHairMask;
+					std::vector<Mat> translatedHair(scaledHair.size());
 					Mat translationMatrix = (Mat_<double>(2, 3) << 1, 0, tx+refTx, 0, 1, ty + refTy);
-					warpAffine(scaledHair, translatedHair, translationMatrix, hairPixels.size(), 1, 0, Scalar(BACKGROUND_HAIR_B, BACKGROUND_HAIR_G, BACKGROUND_HAIR_R, 0));
-			
-					std::vector<cv::Mat> matChannels;
-					cv::split(translatedHair, matChannels);
-					Mat hairAlphaMask = matChannels[3];
-					matChannels.erase(matChannels.begin() + 3);
-					Mat scaledTranslatedHair3D;
-					merge(matChannels, scaledTranslatedHair3D);
+
+					for (size_t k = 0; k < scaledHair.size(); k++)
+					{
+						warpAffine(scaledHair[k], translatedHair[k], translationMatrix, hairLayers[k].size(), 1, 0, Scalar(0)); //premultiplied background is 0 in every plane
+					}
 
 					int energyHoles;
 					int energyHairOverlap;
 
-					Mat currHairSwap = trySwapHair(floatSynthesizedFace, scaledTranslatedHair3D, hairAlphaMask, face, skinPixels, contours, &energyHoles, &energyHairOverlap);
+					Mat currHairSwap = trySwapHair(synthesizedFace, translatedHair, face, skinPixels, contours, &energyHoles, &energyHairOverlap);
 
 					int currEnergy = (int)(ENERGY_WEIGHT*energyHoles) + energyHairOverlap;
 
@@ -275,46 +226,30 @@ Mat findBestScaleAndPosition(Mat synthesizedFace, Mat hairPixels, Face face, int
 	return BestMatch;
 }
 
-int calculateEnergyHairOverlap(Mat scaledHairMask, Face face, Mat skinPixels)
+int calculateEnergyHairOverlap(Mat scaledHairMask, const Face& face, Mat skinPixels)
 {
-	Mat hairOnSkin;
-	Mat skinMask = face.getSkinMask();
-	
-	int leftEdge = face.getLeftEdge();
-	int rightEdge = face.getRightEdge();
+	//ignore some columns on the edge of face
+	int firstAllowedCol = face.getLeftEdge() + NUMBER_OF_FACE_COLUMNS_ALLOWED_HAIR;
+	int lastAllowedCol = face.getRightEdge() - NUMBER_OF_FACE_COLUMNS_ALLOWED_HAIR - 1;
 
-	//get face roi, ignoring some columns on the edge of face
-	Rect leftRect(0, 0, leftEdge + NUMBER_OF_FACE_COLUMNS_ALLOWED_HAIR, skinMask.rows);
-	Rect rightRect(rightEdge - NUMBER_OF_FACE_COLUMNS_ALLOWED_HAIR, 0, skinMask.cols - (rightEdge - NUMBER_OF_FACE_COLUMNS_ALLOWED_HAIR), skinMask.rows);
+	const BitMask& skinBits = face.getSkinMaskBits();
 
-	skinMask(leftRect) = Scalar(0, 0, 0);
-	skinMask(rightRect) = Scalar(0, 0, 0);
+	Rect skinBox = skinBits.getBox();
+	Rect allowedRect(firstAllowedCol, skinBox.y, lastAllowedCol - firstAllowedCol + 1, skinBox.height);
 
-	/*cv::namedWindow("skinMask", CV_WINDOW_AUTOSIZE);
-	cv::imshow("skinMask", skinMask);
-	cv::waitKey();*/
-	
-
-	scaledHairMask.copyTo(hairOnSkin, skinMask);
-
-	Mat hairOnSkinNonTransparent(hairOnSkin.rows, hairOnSkin.cols, CV_8UC1, Scalar(0));
-	hairOnSkinNonTransparent.setTo(1, hairOnSkin > ALPHA_THRESHOLD);
+	//only the non-transparent hair over the allowed part of the skin box is packed
+	BitMask hairBits(scaledHairMask, ALPHA_THRESHOLD, allowedRect & skinBox);
 
-	Scalar Energy = sum(hairOnSkinNonTransparent);
-	
-	return Energy[0];
+	return hairBits.countAnd(skinBits);
 }
 
-int calculateEnergyHoles(Mat hairSwap, Mat hairMask, std::vector<Point> contours, Face face, Mat skinPixels)
+int calculateEnergyHoles(Mat hairSwap, Mat hairMask, std::vector<Point> contours, const Face& face, Mat skinPixels)
 {
 
 	std::unordered_set<int> holes_hashSet;
 
 	int Energy = 0;
 
-	Mat faceMask = face.getFaceMask();
-	faceMask = faceMask / 255 * 128;
-	
 	for (int c = 0; c < contours.size(); c++)
 	{
 		int x = contours[c].x;
@@ -325,7 +260,7 @@ int calculateEnergyHoles(Mat hairSwap, Mat hairMask, std::vector<Point> contours
 			continue;
 		}	
 
-		searchHoles(hairSwap, faceMask, hairMask, x, y, &holes_hashSet);
+		searchHoles(hairSwap, face, hairMask, x, y, &holes_hashSet);
 	}
 
 	Energy = holes_hashSet.size();
@@ -333,21 +268,21 @@ int calculateEnergyHoles(Mat hairSwap, Mat hairMask, std::vector<Point> contours
 	return Energy;
 }
 
-void searchHoles(Mat hairSwap, Mat faceMask, Mat hairMask, int x, int y, std::unordered_set<int> *holes_hashSet)
+void searchHoles(Mat hairSwap, const Face& face, Mat hairMask, int x, int y, std::unordered_set<int> *holes_hashSet)
 {
 	// look for background pixels enclosed by hair and skin
 	//the hashset avoids double-counting background pixels
 
 	int offset = 1;
 	int leftPixelPosition = max(x - offset, 0);
-	int rightPixelPosition = min(x + offset, faceMask.cols - 1);
+	int rightPixelPosition = min(x + offset, hairMask.cols - 1);
 	int topPixelPosition = max(y - offset, 0);
 
-	uchar faceMask_rightPixel = faceMask.at<uchar>(y, rightPixelPosition);
+	bool faceMask_rightPixel = face.isFacePixel(y, rightPixelPosition);
 
-	uchar faceMask_topPixel = faceMask.at<uchar>(topPixelPosition, x);
+	bool faceMask_topPixel = topPixelPosition >= face.getFaceTopRow(x);   //contour points are on the face, so everything between the top edge and them is too
 
-	uchar faceMask_leftPixel = faceMask.at<uchar>(y, leftPixelPosition);
+	bool faceMask_leftPixel = face.isFacePixel(y, leftPixelPosition);
 
 	/*Mat currFaceMask = faceMask.clone();
 	currFaceMask.at<uchar>(y, x) = 255;*/
@@ -359,7 +294,7 @@ void searchHoles(Mat hairSwap, Mat faceMask, Mat hairMask, int x, int y, std::un
 	cv::imshow("faceMask", faceMask);
 	cv::waitKey();*/
 	
-	if (faceMask_leftPixel == 0)   //this is a left edge,  search to the left
+	if (!faceMask_leftPixel)   //this is a left edge,  search to the left
 	{
 		int x_interest = x - 1;
 		int y_interest = y;		
@@ -369,7 +304,7 @@ void searchHoles(Mat hairSwap, Mat faceMask, Mat hairMask, int x, int y, std::un
 		searchLineForHoles(hairMask, x_interest, y_interest, lastHairPixelInd, holes_hashSet, contourType);
 	}
 
-	if (faceMask_topPixel == 0)   //this is a top edge,  search up
+	if (!faceMask_topPixel)   //this is a top edge,  search up
 	{
 		int x_interest = x;
 		int y_interest = y-1;	
@@ -379,7 +314,7 @@ void searchHoles(Mat hairSwap, Mat faceMask, Mat hairMask, int x, int y, std::un
 		searchLineForHoles(hairMask, x_interest, y_interest, lastHairPixelInd, holes_hashSet, contourType);
 	}
 
-	if (faceMask_rightPixel == 0)   //this is a right edge,  search to the right
+	if (!faceMask_rightPixel)   //this is a right edge,  search to the right
 	{
 		int x_interest = x + 1;
 		int y_interest = y;	
@@ -573,11 +508,11 @@ Mat scaleHair(Mat img, int refPointX, int refPointY, int refTx, int refTy, doubl
 	double newWidth = img.cols*scaleX;
 	double newHeight = img.rows*scaleY;
 
-	Scalar markerColor = Scalar(0, 0, 255);
+	//Scalar markerColor = Scalar(0, 0, 255);
 
 	//setMarker(img, refPointX, refPointY, markerColor);
 
-	Scalar positionOriginal = findMarkerPosition(img, markerColor);
+	//Scalar positionOriginal = findMarkerPosition(img, markerColor);
 	
 	Mat scalingMatrix = (Mat_<double>(2, 3) << scaleX, 0, 0, 0, scaleY, 0);
 	Mat translationMatrix = (Mat_<double>(2, 3) << 1, 0, tx, 0, 1, ty);
@@ -677,3 +612,15 @@ Mat scaleHair(Mat img, int refPointX, int refPointY, int refTx, int refTy, doubl
 	
 	return corrected;
 }
+
+std::vector<Mat> scaleHairLayers(std::vector<Mat> hairLayers, int refPointX, int refPointY, int refTx, int refTy, double scaleX, double scaleY)
+{
+	std::vector<Mat> scaled(hairLayers.size());
+
+	for (size_t k = 0; k < hairLayers.size(); k++)
+	{
+		scaled[k] = scaleHair(hairLayers[k], refPointX, refPointY, refTx, refTy, scaleX, scaleY, Scalar(0));
+	}
+
+	return scaled;
+}
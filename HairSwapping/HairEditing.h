@@ -5,12 +5,12 @@
 
 Mat swapHair(Hair hair, Face face, int modelHeadSize, Mat synthesizedFace);
 
-Mat findBestScaleAndPosition(Mat synthesizedFace, Mat hairPixels, Face face, int modelHeadSize, std::vector<Point> contours, int refPointX, int refPointY, int refTx, int refTy);
+Mat findBestScaleAndPosition(Mat synthesizedFace, std::vector<Mat> hairLayers, const Face& face, int modelHeadSize, std::vector<Point> contours, int refPointX, int refPointY, int refTx, int refTy);
 
-int calculateEnergyHoles(Mat hairSwap, Mat hairMask, std::vector<Point> contours, Face face, Mat skinPixels);
-int calculateEnergyHairOverlap(Mat hairMask, Face face, Mat skinPixels);
+int calculateEnergyHoles(Mat hairSwap, Mat hairMask, std::vector<Point> contours, const Face& face, Mat skinPixels);
+int calculateEnergyHairOverlap(Mat hairMask, const Face& face, Mat skinPixels);
 
-void searchHoles(Mat hairSwap, Mat faceMask, Mat hairMask, int x, int y, std::unordered_set<int> *holes_hashSet);
+void searchHoles(Mat hairSwap, const Face& face, Mat hairMask, int x, int y, std::unordered_set<int> *holes_hashSet);
 
 void insertIntoHashSet(int y, int x, int nCols, std::unordered_set<int> *holes_hashSet);
 
@@ -20,10 +20,14 @@ void searchLineForHoles(Mat hairMask, int x_interest, int y_interest, int lastHa
 
 Mat convertTo3channels(Mat mat);
 
-Mat trySwapHair(Mat synthesizedFace, Mat scaledHair, Mat scaledHairMask, Face face, Mat skinPixels, std::vector<Point> contours, int* energyHoles, int* energyHairOverlap);
+void compositeHair(Mat background, std::vector<Mat> hairLayers, Mat& composite);
+
+Mat trySwapHair(Mat synthesizedFace, std::vector<Mat> hairLayers, const Face& face, Mat skinPixels, std::vector<Point> contours, int* energyHoles, int* energyHairOverlap);
 
 Mat scaleHair(Mat img, int refPointX, int refPointY, int refTx, int refTy, double scaleX, double scaleY, Scalar backgroundColor);
 
+std::vector<Mat> scaleHairLayers(std::vector<Mat> hairLayers, int refPointX, int refPointY, int refTx, int refTy, double scaleX, double scaleY);
+
 Mat createAlphaImage(Mat mat, Mat alpha);
 
 static const int CONTOUR_TYPE_LEFTPIXEL = 0;
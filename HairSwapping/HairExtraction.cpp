@@ -15,7 +15,7 @@
 using namespace std;
 using namespace cv;
 
-int extractHair(Mat img, Face face, Mat *labels, Hair *hair)
+int extractHair(Mat img, Face face, Mat *labels, Hair *hair, int role)
 {
 	Mat centers(N_CENTERS, 3, CV_8UC1);
     
@@ -54,9 +54,9 @@ int extractHair(Mat img, Face face, Mat *labels, Hair *hair)
 	
 	Mat hairImageMask = findHairPixels(pixelSequence, labelsSequence, img.rows, img.cols, face.getUpperPointX(), face.getUpperPointY());
 	
-	Scalar checkSum = sum(hairImageMask);
+	BitMask hairMaskNoMatting(hairImageMask);
 
-	if (checkSum[0] == 0 && checkSum[1] == 0 && checkSum[2] == 0)
+	if (hairMaskNoMatting.empty())
 	{
 		return -1;
 	}
@@ -107,19 +107,20 @@ int extractHair(Mat img, Face face, Mat *labels, Hair *hair)
 	cv::imshow("hairPixels1", hairPixels1);*/
 	//cv::waitKey();
 
-	Mat hairPixels;
+	std::vector<Mat> hairLayers;
 
-	Mat hairImageMaskNoMatting = hairImageMask.clone();
-
-	if (USE_MATTING)
+	if (USE_MATTING && role == HAIR_ROLE_MODEL) //targets keep the segmentation mask, no layers
 	{
-		hairPixels = performMatting(&hairImageMask, img);
+		hairLayers = performMatting(&hairImageMask, img);
 	}
 
+	Scalar hairMean, hairStd;
+	meanStdDev(img, hairMean, hairStd, hairImageMask);
+
 	/*Mat hairPixels(img.rows, img.cols, CV_8UC3, Scalar(255, 255, 255));
 	img.copyTo(hairPixels, hairImageMask);*/
 	
-	*hair = findConnectionPoint(hairImageMask, hairImageMaskNoMatting, hairPixels, face);
+	*hair = findConnectionPoint(hairImageMask, hairMaskNoMatting, hairLayers, hairMean, hairStd, face);
 
 	//int upperPointX = face.getUpperPointX();
 	//int upperPointY = face.getUpperPointY();
@@ -228,7 +229,7 @@ Mat findHairPixels(Mat pixelSequence, Mat labels, int nRows, int nCols, int uppe
 	return hairImageMask;
 }
 
-Hair findConnectionPoint(Mat hairMask, Mat hairImageMaskNoMatting, Mat hairPixels, Face face)
+Hair findConnectionPoint(Mat hairMask, BitMask hairMaskNoMatting, std::vector<Mat> hairLayers, Scalar hairMean, Scalar hairStd, Face face)
 {
 
 	int hairConnectionPointLocationX;
@@ -262,10 +263,10 @@ Hair findConnectionPoint(Mat hairMask, Mat hairImageMaskNoMatting, Mat hairPixel
 		}
 	}
 	
-	return Hair(hairMask, hairPixels, hairImageMaskNoMatting, hairConnectionPointLocationX, hairConnectionPointLocationY, hairConnectionPointDistanceToJ_X, hairConnectionPointDistanceToJ_Y);
+	return Hair(hairMask, hairLayers, hairMaskNoMatting, hairConnectionPointLocationX, hairConnectionPointLocationY, hairConnectionPointDistanceToJ_X, hairConnectionPointDistanceToJ_Y, hairMean, hairStd);
 }
 
-Mat performMatting(Mat *hairImageMask, Mat Image)
+std::vector<Mat> performMatting(Mat *hairImageMask, Mat Image)
 {
 	//Refer to the paper 'Shared Sampling for Real-Time Alpha Matting'
 
@@ -295,34 +296,27 @@ Mat performMatting(Mat *hairImageMask, Mat Image)
 	cv::Mat foreground, alpha;
 	globalMatting(Image, trimap, foreground, alpha);
 
-	// filter the result with fast guided filter
-	alpha = guidedFilter(Image, alpha, 10, 1e-5);
-	for (int x = 0; x < trimap.cols; ++x)
-		for (int y = 0; y < trimap.rows; ++y)
-		{
-			if (trimap.at<uchar>(y, x) == 0)
-				alpha.at<uchar>(y, x) = 0;
-			else if (trimap.at<uchar>(y, x) == 255)
-				alpha.at<uchar>(y, x) = 255;
-		}
+	// filter the result with fast guided filter, only where the trimap is unknown;
+	// s = 4 (window radius 10 / 4 on the subsampled guide) is the ratio He & Sun recommend
+	alpha = guidedFilterTrimap(Image, alpha, trimap, 10, 1e-5, -1, 4);
 
 	//cv::imwrite("foreground.png", foreground);
 	//cv::imwrite("alpha.png", alpha);
 
 	threshold(alpha, *hairImageMask, 0.0, 1.0, cv::THRESH_BINARY);
 
-	std::vector<cv::Mat> matChannels;
-	cv::split(Image, matChannels);
+	//planar layers, colour premultiplied by alpha so that warps and compositing need no split/merge
+	std::vector<cv::Mat> hairLayers;
+	cv::split(Image, hairLayers);
 
-	matChannels.push_back(alpha);
-
-	Mat alphaImage;
-
-	cv::merge(matChannels, alphaImage);
+	for (size_t c = 0; c < hairLayers.size(); c++)
+	{
+		multiply(hairLayers[c], alpha, hairLayers[c], 1.0 / 255);
+	}
 
-	//cv::imwrite("alphaImage.png", alphaImage);
+	hairLayers.push_back(alpha);
 
-	return alphaImage;
+	return hairLayers;
 }
 
 int findHairBlob(vector<vector<Point2i>> blobs, int upperPointX, int upperPointY)
@@ -8,7 +8,12 @@ using namespace cv;
 #ifndef HAIR_EXTRACTION_H
 #define HAIR_EXTRACTION_H
 
-int extractHair(Mat img, Face face, Mat *labels, Hair *hair);
+//what the extracted hair is used for: a model's hair is pasted onto other faces and needs the alpha
+//matte and colour layers, a target's hair is only removed, for which the segmentation mask is enough
+static const int HAIR_ROLE_MODEL = 0;
+static const int HAIR_ROLE_TARGET = 1;
+
+int extractHair(Mat img, Face face, Mat *labels, Hair *hair, int role = HAIR_ROLE_MODEL);
 void getBackgroundCenter(Mat img, Mat centers);
 void getClothesCenter(Mat img, Mat centers);
 void getSkinCenter(Mat img, Mat skinMask, Mat centers);
@@ -23,8 +28,8 @@ Mat reconstructImage1D(Mat pixelSequence, int nRows, int nCols);
 Mat findHairPixels(Mat pixelSequence, Mat labels, int nRows, int nCols, int upperPointX, int upperPointY);
 void FindBlobs(Mat &binary, vector < vector<Point2i> > &blobs);
 int findHairBlob(vector<vector<Point2i>> blobs, int upperPointX, int upperPointY);
-Mat performMatting(Mat *hairImageMask, Mat Image);
-Hair findConnectionPoint(Mat hairMask, Mat hairImageMaskNoMatting, Mat hairPixels, Face face);
+std::vector<Mat> performMatting(Mat *hairImageMask, Mat Image);
+Hair findConnectionPoint(Mat hairMask, BitMask hairMaskNoMatting, std::vector<Mat> hairLayers, Scalar hairMean, Scalar hairStd, Face face);
 static const int OFFSET_HAIR = 20;
 static const int N_CENTERS = 4;
 
@@ -0,0 +1,449 @@
+#include "PoissonBlending.h"
+
+using namespace std;
+
+static const int POISSON_MAX_ITERATIONS = 50;
+static const double POISSON_TOLERANCE = 1e-3;   //largest update of a CG step, in gray levels, at which the solve stops
+
+static const int PYRAMID_LEVELS = 5;            //band-pass levels of pyramidClone, at most
+
+static const int SMOOTHING_SWEEPS = 2;          //red-black Gauss-Seidel sweeps before and after each coarse correction
+static const int COARSEST_SWEEPS = 25;
+
+// All grids below hold a one pixel frame of Dirichlet boundary values around the unknowns, and the
+// equation in the interior is
+//     f(y - 1, x) + f(y + 1, x) + f(y, x - 1) + f(y, x + 1) - 4 f(y, x) = rhs(y, x)
+
+static void applyLaplacian(const Mat_<float>& f, Mat_<float>& out)
+{
+	out = Mat_<float>::zeros(f.size());
+
+	for (int y = 1; y < f.rows - 1; y++)
+	{
+		const float* up = f[y - 1];
+		const float* curr = f[y];
+		const float* down = f[y + 1];
+		float* o = out[y];
+
+		for (int x = 1; x < f.cols - 1; x++)
+		{
+			o[x] = up[x] + down[x] + curr[x - 1] + curr[x + 1] - 4 * curr[x];
+		}
+	}
+}
+
+// reverse runs the black points first, so a forward pass followed by a reverse pass is symmetric
+static void smoothRedBlack(Mat_<float>& f, const Mat_<float>& rhs, int sweeps, bool reverse)
+{
+	for (int s = 0; s < sweeps; s++)
+	{
+		for (int k = 0; k < 2; k++)
+		{
+			int color = reverse ? 1 - k : k;
+
+			for (int y = 1; y < f.rows - 1; y++)
+			{
+				const float* up = f[y - 1];
+				const float* down = f[y + 1];
+				float* curr = f[y];
+				const float* r = rhs[y];
+
+				for (int x = 1 + (y + color + 1) % 2; x < f.cols - 1; x += 2)
+				{
+					curr[x] = (up[x] + down[x] + curr[x - 1] + curr[x + 1] - r[x]) * 0.25f;
+				}
+			}
+		}
+	}
+}
+
+// One V-cycle for f starting from zero with zero boundary. Coarse unknown (J, I) sits on fine point
+// (2J, 2I); residuals are restricted by full weighting and corrections interpolated bilinearly.
+static void vCycle(Mat_<float>& f, const Mat_<float>& rhs)
+{
+	int coarseRows = (f.rows - 2) / 2;
+	int coarseCols = (f.cols - 2) / 2;
+
+	if (coarseRows < 2 || coarseCols < 2)
+	{
+		for (int s = 0; s < COARSEST_SWEEPS; s++)
+		{
+			smoothRedBlack(f, rhs, 1, false);
+			smoothRedBlack(f, rhs, 1, true);
+		}
+		return;
+	}
+
+	smoothRedBlack(f, rhs, SMOOTHING_SWEEPS, false);
+
+	Mat_<float> lap;
+	applyLaplacian(f, lap);
+
+	Mat_<float> residual = Mat_<float>::zeros(f.size());
+	for (int y = 1; y < f.rows - 1; y++)
+	{
+		for (int x = 1; x < f.cols - 1; x++)
+		{
+			residual(y, x) = rhs(y, x) - lap(y, x);
+		}
+	}
+
+	//the coarse grid spacing is doubled, which scales the right hand side by 4
+	Mat_<float> coarseRhs = Mat_<float>::zeros(coarseRows + 2, coarseCols + 2);
+	for (int J = 1; J <= coarseRows; J++)
+	{
+		const float* up = residual[2 * J - 1];
+		const float* curr = residual[2 * J];
+		const float* down = residual[2 * J + 1];
+
+		for (int I = 1; I <= coarseCols; I++)
+		{
+			int x = 2 * I;
+			coarseRhs(J, I) = 0.25f * (4 * curr[x] + 2 * (up[x] + down[x] + curr[x - 1] + curr[x + 1])
+				+ up[x - 1] + up[x + 1] + down[x - 1] + down[x + 1]);
+		}
+	}
+
+	Mat_<float> coarse = Mat_<float>::zeros(coarseRows + 2, coarseCols + 2);
+	vCycle(coarse, coarseRhs);
+
+	for (int y = 1; y < f.rows - 1; y++)
+	{
+		int J0 = y / 2;
+		int J1 = (y + 1) / 2;
+		float* curr = f[y];
+
+		for (int x = 1; x < f.cols - 1; x++)
+		{
+			int I0 = x / 2;
+			int I1 = (x + 1) / 2;
+
+			//the coarse frame is zero, which also covers a fine boundary one pixel short of it
+			curr[x] += 0.25f * (coarse(J0, I0) + coarse(J0, I1) + coarse(J1, I0) + coarse(J1, I1));
+		}
+	}
+
+	smoothRedBlack(f, rhs, SMOOTHING_SWEEPS, true);
+}
+
+static double dotInterior(const Mat_<float>& a, const Mat_<float>& b)
+{
+	double sum = 0;
+
+	for (int y = 1; y < a.rows - 1; y++)
+	{
+		for (int x = 1; x < a.cols - 1; x++)
+		{
+			sum += (double)a(y, x) * b(y, x);
+		}
+	}
+
+	return sum;
+}
+
+// Solves the Poisson equation for the interior of f, whose frame holds the boundary values and whose
+// interior holds the initial guess. Flexible conjugate gradients with one V-cycle as preconditioner:
+// a V-cycle alone converges slowly when a grid has an even number of unknowns, the outer CG does not.
+static void solvePoisson(Mat_<float>& f, const Mat_<float>& rhs)
+{
+	if (f.rows < 3 || f.cols < 3)
+	{
+		return;
+	}
+
+	Mat_<float> lap;
+	applyLaplacian(f, lap);
+
+	Mat_<float> r = Mat_<float>::zeros(f.size());
+	for (int y = 1; y < f.rows - 1; y++)
+	{
+		for (int x = 1; x < f.cols - 1; x++)
+		{
+			r(y, x) = rhs(y, x) - lap(y, x);
+		}
+	}
+
+	Mat_<float> z = Mat_<float>::zeros(f.size());
+	vCycle(z, r);
+
+	Mat_<float> p = z.clone();
+	Mat_<float> Ap;
+	double rz = dotInterior(r, z);
+
+	for (int it = 0; it < POISSON_MAX_ITERATIONS && rz != 0; it++)
+	{
+		applyLaplacian(p, Ap);
+
+		double pAp = dotInterior(p, Ap);
+		if (pAp == 0)
+		{
+			break;
+		}
+
+		float alpha = (float)(rz / pAp);
+		float maxUpdate = 0;
+
+		for (int y = 1; y < f.rows - 1; y++)
+		{
+			for (int x = 1; x < f.cols - 1; x++)
+			{
+				float update = alpha * p(y, x);
+				f(y, x) += update;
+				r(y, x) -= alpha * Ap(y, x);
+				maxUpdate = max(maxUpdate, std::abs(update));
+			}
+		}
+
+		if (maxUpdate < POISSON_TOLERANCE)
+		{
+			break;
+		}
+
+		Mat_<float> zNew = Mat_<float>::zeros(f.size());
+		vCycle(zNew, r);
+
+		//Polak-Ribiere form of beta, which keeps CG stable with a preconditioner that is not exactly symmetric
+		double rzNew = dotInterior(r, zNew);
+		double beta = (rzNew - dotInterior(r, z)) / rz;
+
+		z = zNew;
+		rz = rzNew;
+		p = z + beta * p;
+	}
+}
+
+// Where src lands in dst, as seamlessClone places it: the bounding box roiS of the mask (without its
+// outermost pixels) is centred on p, giving roiD. Returns false when the mask is empty.
+static bool cloneRegions(Mat src, Mat dst, Mat mask, Point p, Mat& maskRoi, Rect& roiS, Rect& roiD)
+{
+	CV_Assert(src.type() == CV_8UC3 && dst.type() == CV_8UC3 && src.size() == mask.size());
+
+	Mat maskGray;
+	if (mask.channels() == 3)
+	{
+		cvtColor(mask, maskGray, COLOR_BGR2GRAY);
+	}
+	else
+	{
+		maskGray = mask.clone();
+	}
+
+	//the outermost pixels of the mask never count, as in seamlessClone
+	maskGray.row(0).setTo(0);
+	maskGray.row(maskGray.rows - 1).setTo(0);
+	maskGray.col(0).setTo(0);
+	maskGray.col(maskGray.cols - 1).setTo(0);
+
+	roiS = boundingRect(maskGray);
+	if (roiS.area() == 0)
+	{
+		return false;
+	}
+
+	roiD = Rect(p.x - roiS.width / 2, p.y - roiS.height / 2, roiS.width, roiS.height);
+	CV_Assert((roiD & Rect(0, 0, dst.cols, dst.rows)) == roiD);
+
+	maskRoi = maskGray(roiS);
+
+	return true;
+}
+
+// blend starts as dst. When the caller passes dst itself as blend, the clone is written in place
+// and the frame is not copied; both clone functions read dst(roiD) before they write blend(roiD).
+static void initBlend(const Mat& dst, Mat& blend)
+{
+	bool inPlace = blend.data == dst.data && blend.size() == dst.size() && blend.type() == dst.type() && blend.step == dst.step;
+	if (!inPlace)
+	{
+		dst.copyTo(blend);
+	}
+}
+
+void poissonClone(Mat src, Mat dst, Mat mask, Point p, Mat& blend, int flags)
+{
+	CV_Assert(flags == NORMAL_CLONE || flags == MIXED_CLONE);
+
+	initBlend(dst, blend);
+
+	Mat maskRoi;
+	Rect roiS, roiD;
+	if (!cloneRegions(src, dst, mask, p, maskRoi, roiS, roiD))
+	{
+		return;
+	}
+
+	Mat srcRoi = Mat::zeros(roiS.size(), src.type());
+	src(roiS).copyTo(srcRoi, maskRoi);
+
+	//source gradients count inside the eroded mask, destination gradients outside the mask and
+	//the thin band in between is left without guidance, which is how seamlessClone weights them
+	Mat eroded;
+	erode(maskRoi, eroded, Mat::ones(3, 3, CV_8UC1), Point(-1, -1), 3);
+
+	Mat_<float> weightSrc, weightDst;
+	eroded.convertTo(weightSrc, CV_32F, 1.0 / 255);
+	maskRoi.convertTo(weightDst, CV_32F, -1.0 / 255, 1.0);
+
+	Mat srcFloat, dstFloat;
+	srcRoi.convertTo(srcFloat, CV_32FC3);
+	dst(roiD).convertTo(dstFloat, CV_32FC3);
+
+	vector<Mat> srcChannels, dstChannels;
+	split(srcFloat, srcChannels);
+	split(dstFloat, dstChannels);
+
+	vector<Mat> result(3);
+
+	int rows = roiS.height;
+	int cols = roiS.width;
+
+	parallel_for_(Range(0, 3), [&](const Range& range)
+	{
+		for (int c = range.start; c < range.end; c++)
+		{
+			Mat_<float> s = srcChannels[c];
+			Mat_<float> d = dstChannels[c];
+
+			//guidance field, forward differences
+			Mat_<float> gx = Mat_<float>::zeros(rows, cols);
+			Mat_<float> gy = Mat_<float>::zeros(rows, cols);
+
+			for (int y = 0; y < rows - 1; y++)
+			{
+				for (int x = 0; x < cols - 1; x++)
+				{
+					float sgx = s(y, x + 1) - s(y, x);
+					float sgy = s(y + 1, x) - s(y, x);
+					float dgx = d(y, x + 1) - d(y, x);
+					float dgy = d(y + 1, x) - d(y, x);
+
+					if (flags == MIXED_CLONE && !(std::abs(sgx - sgy) > std::abs(dgx - dgy))) //seamlessClone's comparison
+					{
+						sgx = dgx;
+						sgy = dgy;
+					}
+
+					gx(y, x) = weightSrc(y, x) * sgx + weightDst(y, x) * dgx;
+					gy(y, x) = weightSrc(y, x) * sgy + weightDst(y, x) * dgy;
+				}
+			}
+
+			Mat_<float> rhs = Mat_<float>::zeros(rows, cols);
+			for (int y = 1; y < rows - 1; y++)
+			{
+				for (int x = 1; x < cols - 1; x++)
+				{
+					rhs(y, x) = gx(y, x) - gx(y, x - 1) + gy(y, x) - gy(y - 1, x);
+				}
+			}
+
+			//the frame of the box keeps the destination, the interior starts from it
+			Mat_<float> f = d.clone();
+			solvePoisson(f, rhs);
+
+			f.convertTo(result[c], CV_8UC1);
+		}
+	});
+
+	Mat merged;
+	merge(result, merged);
+	merged.copyTo(blend(roiD));
+}
+
+// One band of pyramidClone: the mask weight mixes source and destination coefficients. With
+// MIXED_CLONE, the source side takes whichever coefficient is larger, the band-pass counterpart
+// of keeping the stronger gradient.
+static Mat blendBand(const Mat& bandSrc, const Mat& bandDst, const Mat& weight, bool mixed)
+{
+	Mat result(bandSrc.size(), bandSrc.type());
+
+	for (int y = 0; y < result.rows; y++)
+	{
+		const float* s = bandSrc.ptr<float>(y);
+		const float* d = bandDst.ptr<float>(y);
+		const float* w = weight.ptr<float>(y);
+		float* r = result.ptr<float>(y);
+
+		for (int x = 0; x < result.cols; x++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				float sc = s[3 * x + c];
+				float dc = d[3 * x + c];
+
+				if (mixed && std::abs(dc) > std::abs(sc))
+				{
+					sc = dc;
+				}
+
+				r[3 * x + c] = w[x] * sc + (1 - w[x]) * dc;
+			}
+		}
+	}
+
+	return result;
+}
+
+void pyramidClone(Mat src, Mat dst, Mat mask, Point p, Mat& blend, int flags)
+{
+	CV_Assert(flags == NORMAL_CLONE || flags == MIXED_CLONE);
+
+	initBlend(dst, blend);
+
+	Mat maskRoi;
+	Rect roiS, roiD;
+	if (!cloneRegions(src, dst, mask, p, maskRoi, roiS, roiD))
+	{
+		return;
+	}
+
+	int levels = PYRAMID_LEVELS;
+	while (levels > 0 && min(roiD.width, roiD.height) >> levels < 2)
+	{
+		levels--;
+	}
+
+	//the coarse levels reach about 2^levels pixels past the mask, so the pyramids cover that margin
+	//too; outside the mask the source equals the destination, so nothing changes beyond it
+	int margin = 1 << levels;
+	Rect work = Rect(roiD.x - margin, roiD.y - margin, roiD.width + 2 * margin, roiD.height + 2 * margin) & Rect(0, 0, dst.cols, dst.rows);
+	Rect inner = roiD - work.tl();
+
+	Mat dstWork;
+	dst(work).convertTo(dstWork, CV_32FC3);
+
+	Mat srcWork = dstWork.clone();
+	Mat srcFloat;
+	src(roiS).convertTo(srcFloat, CV_32FC3);
+	srcFloat.copyTo(srcWork(inner), maskRoi);
+
+	Mat weight = Mat::zeros(work.size(), CV_32FC1);
+	maskRoi.convertTo(weight(inner), CV_32F, 1.0 / 255);
+
+	vector<Mat> gaussSrc(1, srcWork), gaussDst(1, dstWork), gaussWeight(1, weight);
+	for (int i = 0; i < levels; i++)
+	{
+		Mat s, d, w;
+		pyrDown(gaussSrc[i], s);
+		pyrDown(gaussDst[i], d);
+		pyrDown(gaussWeight[i], w);
+		gaussSrc.push_back(s);
+		gaussDst.push_back(d);
+		gaussWeight.push_back(w);
+	}
+
+	//the coarsest level is low-pass, its colours are mixed by the weight alone
+	Mat result = blendBand(gaussSrc[levels], gaussDst[levels], gaussWeight[levels], false);
+
+	for (int i = levels - 1; i >= 0; i--)
+	{
+		Mat upSrc, upDst, up;
+		pyrUp(gaussSrc[i + 1], upSrc, gaussSrc[i].size());
+		pyrUp(gaussDst[i + 1], upDst, gaussDst[i].size());
+		pyrUp(result, up, gaussSrc[i].size());
+
+		result = up + blendBand(gaussSrc[i] - upSrc, gaussDst[i] - upDst, gaussWeight[i], flags == MIXED_CLONE);
+	}
+
+	result.convertTo(blend(work), CV_8UC3);
+}
@@ -0,0 +1,22 @@
+#ifndef POISSON_BLENDING_H
+#define POISSON_BLENDING_H
+
+#include <opencv2//core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/photo.hpp>
+
+using namespace cv;
+
+// Gradient-domain cloning with the arguments and guidance field of seamlessClone (NORMAL_CLONE or
+// MIXED_CLONE). The Poisson equation is only set up on the bounding box of the mask and solved with
+// multigrid-preconditioned conjugate gradients. The solver starts from dst inside the box, so
+// passing the result of an earlier clone as dst warm-starts the next one; synthesizeSkin relies on
+// this for its second pass. blend may be dst itself, in which case only the box is written and the
+// frame is not copied; otherwise dst is copied into blend first (reusing its buffer if it fits).
+void poissonClone(Mat src, Mat dst, Mat mask, Point p, Mat& blend, int flags);
+
+// Same arguments as poissonClone, blended with Laplacian pyramids in linear time instead of a Poisson
+// solve. Seams are slightly softer; meant for previews. blend may also be dst itself.
+void pyramidClone(Mat src, Mat dst, Mat mask, Point p, Mat& blend, int flags);
+
+#endif
@@ -12,16 +12,15 @@
 #include "Face.h"
 #include "skinSynthesis.h"
 #include "ColorEstimate.h"
+#include "BlockMatcher.h"
+#include "PoissonBlending.h"
 
 
 using namespace std;
 using namespace cv;
 
-Mat synthesizeSkin(Mat imgRGB, Face face, Hair hair)
+Mat synthesizeSkin(Mat imgRGB, Face face, Hair hair, int blendingMode)
 {
-	Mat hairMask = hair.getHairMask();
-	Mat hairPixels = hair.getHairPixels();
-
 	Mat A = imgRGB(face.getRegionA());
 	Mat B = imgRGB(face.getRegionB());
 	Mat C = imgRGB(face.getRegionC());
@@ -39,9 +38,9 @@ Mat synthesizeSkin(Mat imgRGB, Face face, Hair hair)
 	
 	Mat facePixels(imgRGB.rows, imgRGB.cols, imgRGB.type(), Scalar(BACKGROUND_SKIN_B, BACKGROUND_SKIN_G, BACKGROUND_SKIN_R));
 
-	Mat faceMask = face.getFaceMask();
+	Rect faceBox = face.getFaceBox();
 
-	imgRGB.copyTo(facePixels, faceMask);
+	imgRGB(faceBox).copyTo(facePixels(faceBox), face.getFaceMaskROI());
 	
 	cvtColor(facePixels, facePixels_Lab, cv::COLOR_BGR2Lab);
 
@@ -73,9 +72,9 @@ Mat synthesizeSkin(Mat imgRGB, Face face, Hair hair)
 
 	Mat replaceMask = Mat::zeros(facePixels.size(), CV_8UC1);
 
-	Mat foreheadInd = findIndForhead(replaceMask, facePixels, faceMask, hair, &firstForeheadRow, &lastForeheadRow, &firstForeheadCol, &lastForeheadCol, colorEst, face); //find beginning and ending of hair pixels in each row
+	Mat foreheadInd = findIndForhead(replaceMask, facePixels, hair, &firstForeheadRow, &lastForeheadRow, &firstForeheadCol, &lastForeheadCol, colorEst, face); //find beginning and ending of hair pixels in each row
 
-	obtainReplaceMask(replaceMask, facePixels, faceMask, hair, colorEst, face, firstForeheadRow, lastForeheadRow, firstForeheadCol, lastForeheadCol); //replace hair pixels with interpolated patch
+	obtainReplaceMask(replaceMask, facePixels, hair, colorEst, face, firstForeheadRow, lastForeheadRow, firstForeheadCol, lastForeheadCol); //replace hair pixels with interpolated patch
 
 
 	Mat maskForTexture;
@@ -210,25 +209,27 @@ Mat synthesizeSkin(Mat imgRGB, Face face, Hair hair)
 	
 	Mat facePixelsOriginal = facePixels.clone();
 
-	Mat seamLessCloneOutput;
-
 	foreheadPixels.copyTo(facePixels, foreHeadMask);
 	
 	//Mat interpolationOnly = facePixels;
 	
-	Mat foreheadMaskOriginal = foreHeadMask.clone(); //seamlessClone modifies the mask so store it to use again later
-	seamlessClone(foreheadPixelsRect, facePixelsNoHair, foreheadMaskRect, center, seamLessCloneOutput, MIXED_CLONE);
+	void (*cloneFunction)(Mat, Mat, Mat, Point, Mat&, int) = blendingMode == SKIN_BLENDING_PYRAMID ? pyramidClone : poissonClone;
+
+	Mat foreheadMaskOriginal = foreHeadMask.clone();
+	//both passes clone in place: facePixelsNoHair is not needed after the first one
+	Mat seamLessCloneOutput = facePixelsNoHair;
+	cloneFunction(foreheadPixelsRect, facePixelsNoHair, foreheadMaskRect, center, seamLessCloneOutput, MIXED_CLONE);
 
 	Mat mixSeamLessCloneFacePixels = facePixels.clone();	
 
 	seamLessCloneOutput(foreheadRoi).copyTo(mixSeamLessCloneFacePixels(foreheadRoi));
 	
-	Mat seamLessCloneOutputTexture;	
-
 	Mat cloneMaskTexture = foreheadMaskOriginal(textureRect);
 	center = Point(textureRect.x + textureRect.width/2, textureRect.y + textureRect.height / 2);
 
-	seamlessClone(texture, mixSeamLessCloneFacePixels, cloneMaskTexture, center, seamLessCloneOutputTexture, NORMAL_CLONE);
+	//mixSeamLessCloneFacePixels already holds the first solution, which the second solve starts from
+	Mat seamLessCloneOutputTexture = mixSeamLessCloneFacePixels;
+	cloneFunction(texture, mixSeamLessCloneFacePixels, cloneMaskTexture, center, seamLessCloneOutputTexture, NORMAL_CLONE);
 
 	/*cv::imwrite("texture.png", texture);
 	cv::imwrite("replaceMask.png", replaceMask);
@@ -313,145 +314,62 @@ bool findHairOnNeighbors(int i, int j, int neighboorHoodSize, Mat hairMask)
 	return false;
 }
 
-void findBestMatchingNeighborBlock(int currV, int currH, int blockSize, int nBlocksVerticalRef, int nBlocksHorRef, Mat leftBlock_LastCol, Mat upperBlock_LastRow, Mat textureReference, double*chosenBlockV_ptr, double*chosenBlockH_ptr, double blockStep)
+Mat synthesizeTexture(Mat textureReference, int blockSize, int nRowsForehead, int nColsForehead, double blockStep, bool approximateSearch)
 {
-	int minCost = INT_MAX;
-	for (double v = 0; v <= nBlocksVerticalRef-1; v += blockStep)
-	{
-		for (double h = 0; h <= nBlocksHorRef-1; h += blockStep)
-		{
-
-			//printf("vref = %f, href = %f \n", v, h);
-
-			if (v == currV && h == currH)
-			{
-				continue; //do not pick same block
-			}
-
-			int currCost = 0;
-
-			Rect currRect(int(h*blockSize), int(v*blockSize), blockSize, blockSize);
-
-			Mat currBlock = textureReference(currRect);
-
-			Mat currBlock_firstRow = currBlock.row(0);
-			Mat currBlock_firstCol = currBlock.col(0);
-
-			if (upperBlock_LastRow.cols > 0) // there is an upper neighbor
-			{
-				currCost = currCost + norm(upperBlock_LastRow - currBlock_firstRow);
-			}
-
-			if (leftBlock_LastCol.cols > 0) // there is a left neighbor
-			{
-				currCost = currCost + norm(leftBlock_LastCol - currBlock_firstCol);
-			}
-
-			if (currCost < minCost)
-			{
-				minCost = currCost;
-				*chosenBlockV_ptr = v;
-				*chosenBlockH_ptr = h;
-			}
-
-		}
-	}
-}
+	int nBlocksVertical = ceil((double) nRowsForehead / blockSize);  //rounded up so there are more blocks than the effective forehead region
+	int nBlocksHorizontal = ceil((double) nColsForehead / blockSize);
 
-void findBlockClosestToAverage(Mat textureReference, int blockSize, int nBlocksVerticalRef, int nBlocksHorRef, double*chosenBlockV_ptr, double*chosenBlockH_ptr)
-{
-	double minDiff = INT_MAX;
+	Mat texture(nBlocksVertical*blockSize, nBlocksHorizontal*blockSize, CV_8UC3);
 
-	Scalar avgReference = mean(textureReference);
+	BlockMatcher matcher(textureReference, blockSize, blockStep);
 
-	for (double v = 0; v <= nBlocksVerticalRef - 1; v += 0.2)
+	Mat chosenBlocks(nBlocksVertical, nBlocksHorizontal, CV_64FC2);  //reference block (v, h) copied to each texture block, seeds the approximate search
+	
+	//block (v, h) only depends on its left and upper neighbours, so the blocks of one anti-diagonal
+	//are independent; the diagonals run in order, which gives the same texture as a raster scan
+	for (int d = 0; d < nBlocksVertical + nBlocksHorizontal - 1; d++)
 	{
-		for (double h = 0; h <= nBlocksHorRef - 1; h += 0.2)
-		{
-			Rect currRect(int(h*blockSize), int(v*blockSize), blockSize, blockSize);
-
-			Mat currBlock = textureReference(currRect);
-			
-			Scalar avgCurrBlock = mean(currBlock);
+		int firstV = max(0, d - (nBlocksHorizontal - 1));
+		int lastV = min(d, nBlocksVertical - 1);
 
-			double currDiff = norm(avgReference - avgCurrBlock);
-
-			if (currDiff < minDiff)
+		parallel_for_(Range(firstV, lastV + 1), [&](const Range& range)
+		{
+			for (int v = range.start; v < range.end; v++)
 			{
-				minDiff = currDiff;
-				*chosenBlockV_ptr = v;
-				*chosenBlockH_ptr = h;
-			}
-			
-		}
-	}
-}
-
-void findBestMatchingBlock(int v, int h, int blockSize, int nBlocksVerticalRef, int nBlocksHorRef,  Mat textureReference, Mat texture, double*chosenBlockV_ptr,double*chosenBlockH_ptr, double blockStep)
-{	
-	if (v == 0 && h == 0)
-	{
-		//*chosenBlockV_ptr = rand() % nBlocksVerticalRef;
-		//*chosenBlockH_ptr = rand() % nBlocksHorRef;
-
-		findBlockClosestToAverage(textureReference, blockSize, nBlocksVerticalRef, nBlocksHorRef, chosenBlockV_ptr, chosenBlockH_ptr);
-
-		return;
-	}
-
-	Mat leftBlock_LastCol;
-	Mat upperBlock_LastRow;
-
-	if (h > 0)
-	{
-		Rect leftBlockRect((h - 1)*blockSize, v*blockSize, blockSize, blockSize);
-
-		Mat leftBlock = texture(leftBlockRect);
-
-		leftBlock_LastCol = leftBlock.col(blockSize - 1);		
-	}
-
-	if (v > 0)
-	{
-		Rect upperBlockRect(h*blockSize, (v-1)*blockSize, blockSize, blockSize);
+				int h = d - v;
 
-		Mat upperBlock = texture(upperBlockRect);
-
-		upperBlock_LastRow = upperBlock.row(blockSize - 1);
-	}
-
-	findBestMatchingNeighborBlock(v,h,blockSize, nBlocksVerticalRef, nBlocksHorRef, leftBlock_LastCol, upperBlock_LastRow, textureReference, chosenBlockV_ptr, chosenBlockH_ptr, blockStep);
-}
-
-Mat synthesizeTexture(Mat textureReference, int blockSize, int nRowsForehead, int nColsForehead, double blockStep)
-{
-	int nBlocksVertical = ceil((double) nRowsForehead / blockSize);  //rounded up so there are more blocks than the effective forehead region
-	int nBlocksHorizontal = ceil((double) nColsForehead / blockSize);
+				//printf("v = %d, h = %d \n", v, h);
+				
+				Rect rectTexture(h*blockSize, v*blockSize, blockSize, blockSize);	
+				Mat currBlock = texture(rectTexture);   //to be updated
 
-	Mat texture(nBlocksVertical*blockSize, nBlocksHorizontal*blockSize, CV_8UC3);
+				double chosenBlockV;
+				double chosenBlockH;
 
-	int nBlocksVerticalRef = textureReference.rows / blockSize; //rounded down so that blocks are always inside the reference texture
-	int nBlocksHorRef = textureReference.cols / blockSize;
-	
-	for (int v = 0; v < nBlocksVertical; v++)
-	{
-		for (int h = 0; h < nBlocksHorizontal; h++)
-		{
-			//printf("v = %d, h = %d \n", v, h);
-					
-			Rect rectTexture(h*blockSize, v*blockSize, blockSize, blockSize);	
-			Mat currBlock = texture(rectTexture);   //to be updated
+				if (v == 0 && h == 0)
+				{
+					matcher.findBlockClosestToAverage(&chosenBlockV, &chosenBlockH);
+				}
+				else if (approximateSearch)
+				{
+					Vec2d left = h > 0 ? chosenBlocks.at<Vec2d>(v, h - 1) : Vec2d(-1, -1);
+					Vec2d upper = v > 0 ? chosenBlocks.at<Vec2d>(v - 1, h) : Vec2d(-1, -1);
 
-			double chosenBlockV;
-			double chosenBlockH;
+					matcher.findApproximateMatchingBlock(texture, v, h, left[0], left[1], upper[0], upper[1], v * nBlocksHorizontal + h + 1, &chosenBlockV, &chosenBlockH);
+				}
+				else
+				{
+					matcher.findBestMatchingBlock(texture, v, h, &chosenBlockV, &chosenBlockH);
+				}
 
-			findBestMatchingBlock(v, h, blockSize, nBlocksVerticalRef, nBlocksHorRef, textureReference, texture, &chosenBlockV, &chosenBlockH, blockStep);
+				chosenBlocks.at<Vec2d>(v, h) = Vec2d(chosenBlockV, chosenBlockH);
 
-			Rect rectRef((int)(chosenBlockH*blockSize), (int)(chosenBlockV*blockSize), blockSize, blockSize);
-			Mat refBlock = textureReference(rectRef);
+				Rect rectRef((int)(chosenBlockH*blockSize), (int)(chosenBlockV*blockSize), blockSize, blockSize);
+				Mat refBlock = textureReference(rectRef);
 
-			refBlock.copyTo(currBlock);  //copy chosen block from reference to block in synthesized texture
-		}
+				refBlock.copyTo(currBlock);  //copy chosen block from reference to block in synthesized texture
+			}
+		});
 	}
 
 	
@@ -620,7 +538,7 @@ void updateReplaceMask(int i, int j, Mat replaceMask, Mat facePixels, Hair hair,
 	//}
 }
 
-void obtainReplaceMask(Mat replaceMask, Mat facePixels, Mat faceMask, Hair hair, ColorEstimate cEst, Face face, int firstForeheadRow, int lastForeheadRow, int firstForeheadCol, int lastForeheadCol)
+void obtainReplaceMask(Mat replaceMask, Mat facePixels, Hair hair, ColorEstimate cEst, Face face, int firstForeheadRow, int lastForeheadRow, int firstForeheadCol, int lastForeheadCol)
 {	
 	// replaceMask needs to be different from forehead mask, otherwise seamless cloning will not be able to capture the color from the original forehead
 
@@ -634,51 +552,46 @@ void obtainReplaceMask(Mat replaceMask, Mat facePixels, Mat faceMask, Hair hair,
 
 	for (int i = firstForeheadRow;i < lastForeheadRow; i++)
 	{
-		for (int j = 0;j < faceMask.cols;j++)
+		for (int j = face.getFaceFirstCol(i);j <= face.getFaceLastCol(i);j++)
 		{						
-			if (faceMask.at<uchar>(i, j) > 0)
+			if (i >= lastRowRamp)
 			{
-				if (i >= lastRowRamp)
+				if (j > face.getLeftEdgeEye() - (-finalOffset) && j < face.getRightEdgeEye() + (-finalOffset))   //don't update eye region and leave a little blank between side hair and the forehead mask for seamless cloning
 				{
-					if (j > face.getLeftEdgeEye() - (-finalOffset) && j < face.getRightEdgeEye() + (-finalOffset))   //don't update eye region and leave a little blank between side hair and the forehead mask for seamless cloning
-					{
-						continue;
-					}
+					continue;
 				}
+			}
 
-				//if (i >= lastRowRamp)
-				//{
-				//	if (j > face.getLeftEdgeEye() && j < face.getRightEdgeEye())   //don't update eye region and leave a little blank between side hair and the forehead mask for seamless cloning
-				//	{
-				//		continue;
-				//	}
-				//}
+			//if (i >= lastRowRamp)
+			//{
+			//	if (j > face.getLeftEdgeEye() && j < face.getRightEdgeEye())   //don't update eye region and leave a little blank between side hair and the forehead mask for seamless cloning
+			//	{
+			//		continue;
+			//	}
+			//}
 
-				if (i >= firstRowRamp && i < lastRowRamp)
-				{
-					double currOffset = firstOffset - (i- firstRowRamp)*step;
+			if (i >= firstRowRamp && i < lastRowRamp)
+			{
+				double currOffset = firstOffset - (i- firstRowRamp)*step;
 
-					if (j > face.getLeftEdgeEye() + cvRound(currOffset) && j < face.getRightEdgeEye() - cvRound(currOffset)) //leave a blank in the part where seamless cloning will be used
-					{
-						continue;
-					}
+				if (j > face.getLeftEdgeEye() + cvRound(currOffset) && j < face.getRightEdgeEye() - cvRound(currOffset)) //leave a blank in the part where seamless cloning will be used
+				{
+					continue;
 				}
-
-				replaceMask.at<uchar>(i, j) = 255;
-				//updateReplaceMask(i, j, replaceMask, facePixels, hair, cEst, face);				
-				
 			}
+
+			replaceMask.at<uchar>(i, j) = 255;
+			//updateReplaceMask(i, j, replaceMask, facePixels, hair, cEst, face);				
 		}
 	}
 }
 
-Mat findIndForhead(Mat replaceMask, Mat facePixels, Mat faceMask, Hair hair, int* firstForeheadRow, int* lastForeheadRow, int* firstForeheadCol, int* lastForeheadCol, ColorEstimate cEst, Face face)
+Mat findIndForhead(Mat replaceMask, Mat facePixels, Hair hair, int* firstForeheadRow, int* lastForeheadRow, int* firstForeheadCol, int* lastForeheadCol, ColorEstimate cEst, Face face)
 {
-	Mat hairMask = hair.getHairMask();
-	Mat hairMaskNoMatting = hair.getHairMaskNoMatting();
+	const BitMask& hairMask = hair.getHairMaskBits();
 
-	Mat foreheadIndFirstCol(faceMask.rows, 1, CV_32SC1, Scalar(INT_MAX)); //initialize matrix with first and last column of forehead for each row
-	Mat foreheadIndLastCol(faceMask.rows, 1, CV_32SC1, Scalar(0));
+	Mat foreheadIndFirstCol(facePixels.rows, 1, CV_32SC1, Scalar(INT_MAX)); //initialize matrix with first and last column of forehead for each row
+	Mat foreheadIndLastCol(facePixels.rows, 1, CV_32SC1, Scalar(0));
 	Mat foreheadInd;
 
 	hconcat(foreheadIndFirstCol, foreheadIndLastCol, foreheadInd);
@@ -689,47 +602,21 @@ Mat findIndForhead(Mat replaceMask, Mat facePixels, Mat faceMask, Hair hair, int
 	*firstForeheadCol = INT_MAX;
 	*lastForeheadCol = 0;
 
-	//search for first and last col of each row on the forehead
-	for (int i = 0;i < faceMask.rows; i++)
+	//the last row where hair covers the face, and the hair columns on it
+	for (int i = facePixels.rows - 1; i >= 0; i--)
 	{
+		int firstHairCol = hairMask.firstSetCol(i, face.getFaceFirstCol(i), face.getFaceLastCol(i));
 
-		for (int j = 0;j < faceMask.cols;j++)
-		{	
-		
-			if (faceMask.at<uchar>(i, j) > 0 && hairMask.at<uchar>(i, j) > 0)
-			{	
-				if (j < foreheadInd.at<int>(i, FIRST_COL))
-				{
-					foreheadInd.at<int>(i, FIRST_COL) = j;
-					
-				}
-
-				if (j > foreheadInd.at<int>(i, LAST_COL))
-				{
-					foreheadInd.at<int>(i, LAST_COL) = j;
-					
-				}
-
-				if (i > *lastForeheadRow)
-				{
-					*lastForeheadRow = i;
-				}
-
-				if (i < *firstForeheadRow)
-				{
-					*firstForeheadRow = i;
-				}
-
-				if (j < *firstForeheadCol)
-				{
-					*firstForeheadCol = j;
-				}
-
-				if (j > *lastForeheadCol)
-				{
-					*lastForeheadCol = j;
-				}
-			}			
+		if (firstHairCol != -1)
+		{
+			foreheadInd.at<int>(i, FIRST_COL) = firstHairCol;
+			foreheadInd.at<int>(i, LAST_COL) = hairMask.lastSetCol(i, face.getFaceFirstCol(i), face.getFaceLastCol(i));
+
+			*firstForeheadRow = i;
+			*lastForeheadRow = i;
+			*firstForeheadCol = foreheadInd.at<int>(i, FIRST_COL);
+			*lastForeheadCol = foreheadInd.at<int>(i, LAST_COL);
+			break;
 		}
 	}
 
@@ -738,45 +625,20 @@ Mat findIndForhead(Mat replaceMask, Mat facePixels, Mat faceMask, Hair hair, int
 	//update all pixels in the forehead
 	for (int i = 0;i < previousLastForeheadRow; i++)
 	{
+		int firstJ = face.getFaceFirstCol(i);
+		int lastJ = face.getFaceLastCol(i);
 
-		for (int j = 0;j < faceMask.cols;j++)
+		if (firstJ == INT_MAX)  //row outside the face
 		{
-			if (faceMask.at<uchar>(i, j) > 0)  
-			{
-
-				if (j < foreheadInd.at<int>(i, FIRST_COL))
-				{
-					foreheadInd.at<int>(i, FIRST_COL) = j;
-
-				}
-
-				if (j > foreheadInd.at<int>(i, LAST_COL))
-				{
-					foreheadInd.at<int>(i, LAST_COL) = j;
-
-				}
-
-				if (i > *lastForeheadRow)
-				{
-					*lastForeheadRow = i;
-				}
-
-				if (i < *firstForeheadRow)
-				{
-					*firstForeheadRow = i;
-				}
+			continue;
+		}
 
-				if (j < *firstForeheadCol)
-				{
-					*firstForeheadCol = j;
-				}
+		foreheadInd.at<int>(i, FIRST_COL) = firstJ;
+		foreheadInd.at<int>(i, LAST_COL) = lastJ;
 
-				if (j > *lastForeheadCol)
-				{
-					*lastForeheadCol = j;
-				}
-			}
-		}
+		*firstForeheadRow = min(*firstForeheadRow, i);
+		*firstForeheadCol = min(*firstForeheadCol, firstJ);
+		*lastForeheadCol = max(*lastForeheadCol, lastJ);
 	}
 
 	return foreheadInd;
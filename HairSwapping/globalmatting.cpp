@@ -1,5 +1,8 @@
 #include "globalmatting.h"
 
+#include <opencv2/core/hal/intrin.hpp>
+#include <stdint.h>
+
 template <typename T>
 static inline T sqr(T a)
 {
@@ -28,45 +31,82 @@ static std::vector<cv::Point> findBoundaryPixels(const cv::Mat_<uchar> &trimap,
     return result;
 }
 
-// Eq. 2
-static float calculateAlpha(const cv::Vec3b &F, const cv::Vec3b &B, const cv::Vec3b &I)
+// Candidate (F, B) pairs evaluated side by side, one per SIMD lane. Every lane carries its own
+// pixel, so the same kernel serves the propagation step (one pixel, several candidates) and the
+// random walk (several pixels, one candidate each).
+static const int COST_LANES = 4;
+
+struct CostLanes
 {
-    float result = 0;
-    float div = 1e-6f;
-    for (int c = 0; c < 3; ++c)
-    {
-        float f = F[c];
-        float b = B[c];
-        float i = I[c];
+    float Ib[COST_LANES], Ig[COST_LANES], Ir[COST_LANES];
+    float px[COST_LANES], py[COST_LANES];
+    float df[COST_LANES], db[COST_LANES];
 
-        result += (i - b) * (f - b);
-        div += (f - b) * (f - b);
-    }
+    float Fb[COST_LANES], Fg[COST_LANES], Fr[COST_LANES];
+    float fx[COST_LANES], fy[COST_LANES];
 
-    return std::min(std::max(result / div, 0.f), 1.f);
-}
+    float Bb[COST_LANES], Bg[COST_LANES], Br[COST_LANES];
+    float bx[COST_LANES], by[COST_LANES];
+
+    float alpha[COST_LANES], cost[COST_LANES];
+};
 
-// Eq. 3
-static float colorCost(const cv::Vec3b &F, const cv::Vec3b &B, const cv::Vec3b &I, float alpha)
+static void evaluateCostLanes(CostLanes &l)
 {
-    float result = 0;
-    for (int c = 0; c < 3; ++c)
+#if CV_SIMD128
+    cv::v_float32x4 zero = cv::v_setzero_f32();
+    cv::v_float32x4 one = cv::v_setall_f32(1.f);
+
+    cv::v_float32x4 Ib = cv::v_load(l.Ib), Ig = cv::v_load(l.Ig), Ir = cv::v_load(l.Ir);
+    cv::v_float32x4 Fb = cv::v_load(l.Fb), Fg = cv::v_load(l.Fg), Fr = cv::v_load(l.Fr);
+    cv::v_float32x4 Bb = cv::v_load(l.Bb), Bg = cv::v_load(l.Bg), Br = cv::v_load(l.Br);
+
+    // Eq. 2
+    cv::v_float32x4 FBb = Fb - Bb, FBg = Fg - Bg, FBr = Fr - Br;
+    cv::v_float32x4 num = (Ib - Bb) * FBb + (Ig - Bg) * FBg + (Ir - Br) * FBr;
+    cv::v_float32x4 div = cv::v_setall_f32(1e-6f) + FBb * FBb + FBg * FBg + FBr * FBr;
+    cv::v_float32x4 alpha = cv::v_min(cv::v_max(num / div, zero), one);
+
+    // Eq. 3
+    cv::v_float32x4 beta = one - alpha;
+    cv::v_float32x4 eb = Ib - (alpha * Fb + beta * Bb);
+    cv::v_float32x4 eg = Ig - (alpha * Fg + beta * Bg);
+    cv::v_float32x4 er = Ir - (alpha * Fr + beta * Br);
+    cv::v_float32x4 colorCost = cv::v_sqrt(eb * eb + eg * eg + er * er);
+
+    // Eq. 4
+    cv::v_float32x4 px = cv::v_load(l.px), py = cv::v_load(l.py);
+    cv::v_float32x4 dfx = px - cv::v_load(l.fx), dfy = py - cv::v_load(l.fy);
+    cv::v_float32x4 dbx = px - cv::v_load(l.bx), dby = py - cv::v_load(l.by);
+    cv::v_float32x4 distCostF = cv::v_sqrt(dfx * dfx + dfy * dfy) / cv::v_load(l.df);
+    cv::v_float32x4 distCostB = cv::v_sqrt(dbx * dbx + dby * dby) / cv::v_load(l.db);
+
+    cv::v_store(l.alpha, alpha);
+    cv::v_store(l.cost, colorCost + distCostF + distCostB);
+#else
+    for (int i = 0; i < COST_LANES; ++i)
     {
-        float f = F[c];
-        float b = B[c];
-        float i = I[c];
-
-        result += sqr(i - (alpha * f + (1 - alpha) * b));
+        // Eq. 2
+        float FBb = l.Fb[i] - l.Bb[i], FBg = l.Fg[i] - l.Bg[i], FBr = l.Fr[i] - l.Br[i];
+        float num = (l.Ib[i] - l.Bb[i]) * FBb + (l.Ig[i] - l.Bg[i]) * FBg + (l.Ir[i] - l.Br[i]) * FBr;
+        float div = 1e-6f + FBb * FBb + FBg * FBg + FBr * FBr;
+        float alpha = std::min(std::max(num / div, 0.f), 1.f);
+
+        // Eq. 3
+        float beta = 1 - alpha;
+        float eb = l.Ib[i] - (alpha * l.Fb[i] + beta * l.Bb[i]);
+        float eg = l.Ig[i] - (alpha * l.Fg[i] + beta * l.Bg[i]);
+        float er = l.Ir[i] - (alpha * l.Fr[i] + beta * l.Br[i]);
+        float colorCost = sqrt(eb * eb + eg * eg + er * er);
+
+        // Eq. 4
+        float distCostF = sqrt(sqr(l.px[i] - l.fx[i]) + sqr(l.py[i] - l.fy[i])) / l.df[i];
+        float distCostB = sqrt(sqr(l.px[i] - l.bx[i]) + sqr(l.py[i] - l.by[i])) / l.db[i];
+
+        l.alpha[i] = alpha;
+        l.cost[i] = colorCost + distCostF + distCostB;
     }
-
-    return sqrt(result);
-}
-
-// Eq. 4
-static float distCost(const cv::Point &p0, const cv::Point &p1, float minDist)
-{
-    int dist = sqr(p0.x - p1.x) + sqr(p0.y - p1.y);
-    return sqrt((float)dist) / minDist;
+#endif
 }
 
 static float colorDist(const cv::Vec3b &I0, const cv::Vec3b &I1)
@@ -194,198 +234,403 @@ static void erodeFB(cv::Mat_<uchar> &trimap, int r)
 }
 
 
-struct Sample
+// Boundary pixels with their colours gathered once, so that cost evaluation reads flat arrays
+// instead of going back to the image through a Point.
+struct BoundarySamples
 {
-    int fi, bj;
-    float df, db;
-    float cost, alpha;
+    std::vector<float> b, g, r;
+    std::vector<float> x, y;
+
+    BoundarySamples(const cv::Mat_<cv::Vec3b> &image, const std::vector<cv::Point> &points)
+        : b(points.size()), g(points.size()), r(points.size()), x(points.size()), y(points.size())
+    {
+        for (std::size_t i = 0; i < points.size(); ++i)
+        {
+            const cv::Vec3b &c = image(points[i].y, points[i].x);
+
+            b[i] = c[0];
+            g[i] = c[1];
+            r[i] = c[2];
+            x[i] = (float)points[i].x;
+            y[i] = (float)points[i].y;
+        }
+    }
+
+    int size() const
+    {
+        return (int)x.size();
+    }
+};
+
+// Samples are kept for the unknown (trimap == 128) pixels only, as a structure of arrays in
+// row-major order. index maps a pixel to its slot in the arrays, or -1 for a known pixel.
+struct Samples
+{
+    cv::Mat_<int> index;
+    std::vector<int> rowStart; // unknown pixels of row y are [rowStart[y], rowStart[y + 1])
+    std::vector<int> x, y;
+
+    std::vector<int> fi, bj;
+    std::vector<float> df, db;
+    std::vector<float> cost, alpha;
 };
 
+static const int PATCHMATCH_MAX_ITERATIONS = 10;
+
+// Random stream for one row of one iteration. Streams depend only on (seed, iter, row),
+// never on which thread processes the row, so the result is the same for any thread count.
+static cv::RNG rowRNG(unsigned int seed, int iter, int row)
+{
+    uint64_t h = ((uint64_t)seed << 32) ^ ((uint64_t)(unsigned int)iter << 20) ^ (uint64_t)(unsigned int)row;
+
+    // splitmix64 finalizer, so neighbouring rows get uncorrelated states
+    h += 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+
+    return cv::RNG(h);
+}
+
+static inline void setLanePixel(CostLanes &l, int lane, const cv::Vec3b &I, int x, int y, float df, float db)
+{
+    l.Ib[lane] = I[0];
+    l.Ig[lane] = I[1];
+    l.Ir[lane] = I[2];
+    l.px[lane] = (float)x;
+    l.py[lane] = (float)y;
+    l.df[lane] = df;
+    l.db[lane] = db;
+}
+
+static inline void setLaneCandidate(CostLanes &l, int lane, const BoundarySamples &F, const BoundarySamples &B, int fi, int bj)
+{
+    l.Fb[lane] = F.b[fi];
+    l.Fg[lane] = F.g[fi];
+    l.Fr[lane] = F.r[fi];
+    l.fx[lane] = F.x[fi];
+    l.fy[lane] = F.y[fi];
+
+    l.Bb[lane] = B.b[bj];
+    l.Bg[lane] = B.g[bj];
+    l.Br[lane] = B.r[bj];
+    l.bx[lane] = B.x[bj];
+    l.by[lane] = B.y[bj];
+}
+
 static void calculateAlphaPatchMatch(const cv::Mat_<cv::Vec3b> &image,
         const cv::Mat_<uchar> &trimap,
         const std::vector<cv::Point> &foregroundBoundary,
         const std::vector<cv::Point> &backgroundBoundary,
-        std::vector<std::vector<Sample> > &samples)
+        Samples &samples,
+        unsigned int seed)
 {
     int w = image.cols;
     int h = image.rows;
 
-    samples.resize(h, std::vector<Sample>(w));
+    BoundarySamples F(image, foregroundBoundary);
+    BoundarySamples B(image, backgroundBoundary);
+
+    samples.index.create(h, w);
+    samples.rowStart.resize(h + 1);
 
+    int n = 0;
     for (int y = 0; y < h; ++y)
+    {
+        samples.rowStart[y] = n;
+
         for (int x = 0; x < w; ++x)
+            samples.index(y, x) = trimap(y, x) == 128 ? n++ : -1;
+    }
+    samples.rowStart[h] = n;
+
+    samples.x.resize(n);
+    samples.y.resize(n);
+    samples.fi.resize(n);
+    samples.bj.resize(n);
+    samples.df.resize(n);
+    samples.db.resize(n);
+    samples.cost.assign(n, FLT_MAX);
+    samples.alpha.assign(n, 0.f);
+
+    cv::parallel_for_(cv::Range(0, h), [&](const cv::Range &range)
+    {
+        for (int y = range.start; y < range.end; ++y)
         {
-            if (trimap(y, x) == 128)
+            cv::RNG rng = rowRNG(seed, 0, y);
+
+            for (int x = 0; x < w; ++x)
             {
+                int k = samples.index(y, x);
+
+                if (k < 0)
+                    continue;
+
                 cv::Point p(x, y);
 
-                samples[y][x].fi = rand() % foregroundBoundary.size();
-                samples[y][x].bj = rand() % backgroundBoundary.size();
-                samples[y][x].df = nearestDistance(foregroundBoundary, p);
-                samples[y][x].db = nearestDistance(backgroundBoundary, p);
-                samples[y][x].cost = FLT_MAX;
+                samples.x[k] = x;
+                samples.y[k] = y;
+                samples.fi[k] = rng.uniform(0, F.size());
+                samples.bj[k] = rng.uniform(0, B.size());
+                samples.df[k] = nearestDistance(foregroundBoundary, p);
+                samples.db[k] = nearestDistance(backgroundBoundary, p);
             }
         }
+    });
 
-    std::vector<cv::Point> coords(w * h);
-    for (int y = 0; y < h; ++y)
-        for (int x = 0; x < w; ++x)
-            coords[x + y * w] = cv::Point(x, y);
+    // improved[y] is set when any sample of row y got cheaper in the current iteration
+    std::vector<uchar> improved(h);
+    std::vector<int> previousFi, previousBj;
 
-    for (int iter = 0; iter < 10; ++iter)
+    for (int iter = 0; iter < PATCHMATCH_MAX_ITERATIONS; ++iter)
     {
-        // propagation
-        std::random_shuffle(coords.begin(), coords.end());
+        std::fill(improved.begin(), improved.end(), 0);
 
-        for (std::size_t i = 0; i < coords.size(); ++i)
+        // propagation, red-black: pixels of one parity only read pixels of the other parity,
+        // except for the diagonal neighbours which are read from the copy taken before the phase
+        for (int parity = 0; parity < 2; ++parity)
         {
-            const cv::Point &p = coords[i];
+            previousFi = samples.fi;
+            previousBj = samples.bj;
 
-            int x = p.x;
-            int y = p.y;
-
-            if (trimap(y, x) != 128)
-                continue;
-
-            const cv::Vec3b &I = image(y, x);
-
-            Sample &s = samples[y][x];
-
-            for (int y2 = y - 1; y2 <= y + 1; ++y2)
-                for (int x2 = x - 1; x2 <= x + 1; ++x2)
-                {
-                    if (x2 < 0 || x2 >= w || y2 < 0 || y2 >= h)
-                        continue;
-
-                    if (trimap(y2, x2) != 128)
-                        continue;
-
-                    Sample &s2 = samples[y2][x2];
-
-                    const cv::Point &fp = foregroundBoundary[s2.fi];
-                    const cv::Point &bp = backgroundBoundary[s2.bj];
-
-                    const cv::Vec3b F = image(fp.y, fp.x);
-                    const cv::Vec3b B = image(bp.y, bp.x);
-
-                    float alpha = calculateAlpha(F, B, I);
-
-                    float cost = colorCost(F, B, I, alpha) + distCost(p, fp, s.df) + distCost(p, bp, s.db);
+            cv::parallel_for_(cv::Range(0, h), [&](const cv::Range &range)
+            {
+                CostLanes lanes;
 
-                    if (cost < s.cost)
+                for (int y = range.start; y < range.end; ++y)
+                    for (int k = samples.rowStart[y]; k < samples.rowStart[y + 1]; ++k)
                     {
-                        s.fi = s2.fi;
-                        s.bj = s2.bj;
-                        s.cost = cost;
-                        s.alpha = alpha;
+                        int x = samples.x[k];
+
+                        if (((x + y) & 1) != parity)
+                            continue;
+
+                        int candidateFi[9], candidateBj[9];
+                        int nCandidates = 0;
+
+                        for (int y2 = y - 1; y2 <= y + 1; ++y2)
+                            for (int x2 = x - 1; x2 <= x + 1; ++x2)
+                            {
+                                if (x2 < 0 || x2 >= w || y2 < 0 || y2 >= h)
+                                    continue;
+
+                                int k2 = samples.index(y2, x2);
+
+                                if (k2 < 0)
+                                    continue;
+
+                                candidateFi[nCandidates] = previousFi[k2];
+                                candidateBj[nCandidates] = previousBj[k2];
+                                ++nCandidates;
+                            }
+
+                        for (int lane = 0; lane < COST_LANES; ++lane)
+                            setLanePixel(lanes, lane, image(y, x), x, y, samples.df[k], samples.db[k]);
+
+                        for (int c0 = 0; c0 < nCandidates; c0 += COST_LANES)
+                        {
+                            // lanes past the last candidate repeat it and are ignored below
+                            for (int lane = 0; lane < COST_LANES; ++lane)
+                            {
+                                int c = std::min(c0 + lane, nCandidates - 1);
+                                setLaneCandidate(lanes, lane, F, B, candidateFi[c], candidateBj[c]);
+                            }
+
+                            evaluateCostLanes(lanes);
+
+                            for (int lane = 0; lane < COST_LANES && c0 + lane < nCandidates; ++lane)
+                            {
+                                if (lanes.cost[lane] < samples.cost[k])
+                                {
+                                    samples.fi[k] = candidateFi[c0 + lane];
+                                    samples.bj[k] = candidateBj[c0 + lane];
+                                    samples.cost[k] = lanes.cost[lane];
+                                    samples.alpha[k] = lanes.alpha[lane];
+                                    improved[y] = 1;
+                                }
+                            }
+                        }
                     }
-                }
+            });
         }
 
-        // random walk
+        // random walk, COST_LANES consecutive unknown pixels of a row at a time
         int w2 = (int)std::max(foregroundBoundary.size(), backgroundBoundary.size());
 
-        for (int y = 0; y < h; ++y)
-            for (int x = 0; x < w; ++x)
-            {
-                if (trimap(y, x) != 128)
-                    continue;
-
-                cv::Point p(x, y);
+        cv::parallel_for_(cv::Range(0, h), [&](const cv::Range &range)
+        {
+            CostLanes lanes;
 
-                const cv::Vec3b &I = image(y, x);
+            for (int y = range.start; y < range.end; ++y)
+            {
+                cv::RNG rng = rowRNG(seed, iter + 1, y);
 
-                Sample &s = samples[y][x];
+                int rowEnd = samples.rowStart[y + 1];
 
-                for (int k = 0; ; k++)
+                for (int k0 = samples.rowStart[y]; k0 < rowEnd; k0 += COST_LANES)
                 {
-                    float r = w2 * pow(0.5f, k);
-
-                    if (r < 1)
-                        break;
+                    int nLanes = std::min(COST_LANES, rowEnd - k0);
 
-                    int di = r * (rand() / (RAND_MAX + 1.f));
-                    int dj = r * (rand() / (RAND_MAX + 1.f));
-
-                    int fi = s.fi + di;
-                    int bj = s.bj + dj;
-
-                    if (fi < 0 || fi >= foregroundBoundary.size() || bj < 0 || bj >= backgroundBoundary.size())
-                        continue;
-
-                    const cv::Point &fp = foregroundBoundary[fi];
-                    const cv::Point &bp = backgroundBoundary[bj];
-
-                    const cv::Vec3b F = image(fp.y, fp.x);
-                    const cv::Vec3b B = image(bp.y, bp.x);
-
-                    float alpha = calculateAlpha(F, B, I);
-
-                    float cost = colorCost(F, B, I, alpha) + distCost(p, fp, s.df) + distCost(p, bp, s.db);
+                    for (int lane = 0; lane < COST_LANES; ++lane)
+                    {
+                        int k = k0 + std::min(lane, nLanes - 1);
+                        setLanePixel(lanes, lane, image(samples.y[k], samples.x[k]), samples.x[k], samples.y[k], samples.df[k], samples.db[k]);
+                    }
 
-                    if (cost < s.cost)
+                    for (int step = 0; ; step++)
                     {
-                        s.fi = fi;
-                        s.bj = bj;
-                        s.cost = cost;
-                        s.alpha = alpha;
+                        float r = w2 * pow(0.5f, step);
+
+                        if (r < 1)
+                            break;
+
+                        int laneFi[COST_LANES], laneBj[COST_LANES];
+                        bool valid[COST_LANES];
+
+                        for (int lane = 0; lane < COST_LANES; ++lane)
+                        {
+                            int k = k0 + std::min(lane, nLanes - 1);
+
+                            laneFi[lane] = samples.fi[k];
+                            laneBj[lane] = samples.bj[k];
+                            valid[lane] = false;
+
+                            if (lane < nLanes)
+                            {
+                                int di = r * rng.uniform(0.f, 1.f);
+                                int dj = r * rng.uniform(0.f, 1.f);
+
+                                int fi = samples.fi[k] + di;
+                                int bj = samples.bj[k] + dj;
+
+                                if (fi >= 0 && fi < F.size() && bj >= 0 && bj < B.size())
+                                {
+                                    laneFi[lane] = fi;
+                                    laneBj[lane] = bj;
+                                    valid[lane] = true;
+                                }
+                            }
+
+                            setLaneCandidate(lanes, lane, F, B, laneFi[lane], laneBj[lane]);
+                        }
+
+                        evaluateCostLanes(lanes);
+
+                        for (int lane = 0; lane < nLanes; ++lane)
+                        {
+                            int k = k0 + lane;
+
+                            if (valid[lane] && lanes.cost[lane] < samples.cost[k])
+                            {
+                                samples.fi[k] = laneFi[lane];
+                                samples.bj[k] = laneBj[lane];
+                                samples.cost[k] = lanes.cost[lane];
+                                samples.alpha[k] = lanes.alpha[lane];
+                                improved[y] = 1;
+                            }
+                        }
                     }
                 }
             }
+        });
+
+        // converged: neither propagation nor random walk found a cheaper sample anywhere
+        if (std::find(improved.begin(), improved.end(), 1) == improved.end())
+            break;
     }
 }
 
+// Offsets (dx, dy) of the disc of radius r, listed in reverse raster order. The square scan this
+// replaces let the last qualifying known pixel in raster order decide the label, so the first
+// qualifying pixel found walking this list gives exactly the same result.
+static std::vector<cv::Point> discOffsets(int r)
+{
+    std::vector<cv::Point> offsets;
+
+    for (int dy = r; dy >= -r; --dy)
+        for (int dx = r; dx >= -r; --dx)
+        {
+            if (sqr(dx) + sqr(dy) <= sqr(r))
+                offsets.push_back(cv::Point(dx, dy));
+        }
+
+    return offsets;
+}
+
 static void expansionOfKnownRegionsHelper(const cv::Mat &_image,
                                           cv::Mat &_trimap,
                                           int r, float c)
 {
     const cv::Mat_<cv::Vec3b> &image = (const cv::Mat_<cv::Vec3b> &)_image;
-    cv::Mat_<uchar> &trimap = (cv::Mat_<uchar>&)_trimap;
+    const cv::Mat_<uchar> &trimap = (const cv::Mat_<uchar>&)_trimap;
 
     int w = image.cols;
     int h = image.rows;
 
-    for (int x = 0; x < w; ++x)
-        for (int y = 0; y < h; ++y)
+    const std::vector<cv::Point> offsets = discOffsets(r);
+
+    // colour distances are integers, so sqrt(d2) <= c is the same test as d2 <= floor(c * c)
+    const int c2 = (int)(c * c);
+
+    // labels go to a copy so the rows being read by other threads never change under them
+    cv::Mat_<uchar> expanded = trimap.clone();
+
+    cv::parallel_for_(cv::Range(0, h), [&](const cv::Range &range)
+    {
+        for (int y = range.start; y < range.end; ++y)
         {
-            if (trimap(y, x) != 128)
-                continue;
+            const uchar *trimapRow = trimap[y];
+            const cv::Vec3b *imageRow = image[y];
+            uchar *expandedRow = expanded[y];
 
-            const cv::Vec3b &I = image(y, x);
+            for (int x = 0; x < w; ++x)
+            {
+                if (trimapRow[x] != 128)
+                    continue;
 
-            for (int j = y-r; j <= y+r; ++j)
-                for (int i = x-r; i <= x+r; ++i)
+                const cv::Vec3b &I = imageRow[x];
+
+                for (std::size_t k = 0; k < offsets.size(); ++k)
                 {
+                    int i = x + offsets[k].x;
+                    int j = y + offsets[k].y;
+
                     if (i < 0 || i >= w || j < 0 || j >= h)
                         continue;
 
-                    if (trimap(j, i) != 0 && trimap(j, i) != 255)
+                    uchar t = trimap(j, i);
+
+                    if (t != 0 && t != 255)
                         continue;
 
                     const cv::Vec3b &I2 = image(j, i);
 
-                    float pd = sqrt((float)(sqr(x - i) + sqr(y - j)));
-                    float cd = colorDist(I, I2);
+                    int cd2 = sqr((int)I[0] - (int)I2[0]) + sqr((int)I[1] - (int)I2[1]) + sqr((int)I[2] - (int)I2[2]);
 
-                    if (pd <= r && cd <= c)
+                    if (cd2 <= c2)
                     {
-                        if (trimap(j, i) == 0)
-                            trimap(y, x) = 1;
-                        else if (trimap(j, i) == 255)
-                            trimap(y, x) = 254;
+                        expandedRow[x] = t == 0 ? 1 : 254;
+                        break;
                     }
                 }
+            }
         }
+    });
 
-    for (int x = 0; x < trimap.cols; ++x)
-        for (int y = 0; y < trimap.rows; ++y)
-        {
-            if (trimap(y, x) == 1)
-                trimap(y, x) = 0;
-            else if (trimap(y, x) == 254)
-                trimap(y, x) = 255;
+    for (int y = 0; y < h; ++y)
+    {
+        uchar *expandedRow = expanded[y];
 
+        for (int x = 0; x < w; ++x)
+        {
+            if (expandedRow[x] == 1)
+                expandedRow[x] = 0;
+            else if (expandedRow[x] == 254)
+                expandedRow[x] = 255;
         }
+    }
+
+    expanded.copyTo(_trimap);
 }
 
 // erode foreground and background regions to increase the size of unknown region
@@ -446,7 +691,7 @@ void expansionOfKnownRegions(cv::InputArray _img, cv::InputOutputArray _trimap,
 }
 
 
-static void globalMattingHelper(cv::Mat _image, cv::Mat _trimap, cv::Mat &_foreground, cv::Mat &_alpha, cv::Mat &_conf)
+static void globalMattingHelper(cv::Mat _image, cv::Mat _trimap, cv::Mat &_foreground, cv::Mat &_alpha, cv::Mat &_conf, unsigned int seed)
 {
     const cv::Mat_<cv::Vec3b> &image = (const cv::Mat_<cv::Vec3b>&)_image;
     const cv::Mat_<uchar> &trimap = (const cv::Mat_<uchar>&)_trimap;
@@ -454,11 +699,13 @@ static void globalMattingHelper(cv::Mat _image, cv::Mat _trimap, cv::Mat &_foreg
     std::vector<cv::Point> foregroundBoundary = findBoundaryPixels(trimap, 255, 128);
     std::vector<cv::Point> backgroundBoundary = findBoundaryPixels(trimap, 0, 128);
 
+    cv::RNG rng = rowRNG(seed, -1, 0);
+
     int n = (int)(foregroundBoundary.size() + backgroundBoundary.size());
     for (int i = 0; i < n; ++i)
     {
-        int x = rand() % trimap.cols;
-        int y = rand() % trimap.rows;
+        int x = rng.uniform(0, trimap.cols);
+        int y = rng.uniform(0, trimap.rows);
 
         if (trimap(y, x) == 0)
             backgroundBoundary.push_back(cv::Point(x, y));
@@ -469,8 +716,8 @@ static void globalMattingHelper(cv::Mat _image, cv::Mat _trimap, cv::Mat &_foreg
     std::sort(foregroundBoundary.begin(), foregroundBoundary.end(), IntensityComp(image));
     std::sort(backgroundBoundary.begin(), backgroundBoundary.end(), IntensityComp(image));
 
-    std::vector<std::vector<Sample> > samples;
-    calculateAlphaPatchMatch(image, trimap, foregroundBoundary, backgroundBoundary, samples);
+    Samples samples;
+    calculateAlphaPatchMatch(image, trimap, foregroundBoundary, backgroundBoundary, samples, seed);
 
     _foreground.create(image.size(), CV_8UC3);
     _alpha.create(image.size(), CV_8UC1);
@@ -492,9 +739,10 @@ static void globalMattingHelper(cv::Mat _image, cv::Mat _trimap, cv::Mat &_foreg
                     break;
                 case 128:
                 {
-                    alpha(y, x) = 255 * samples[y][x].alpha;
-                    conf(y, x) = 255 * exp(-samples[y][x].cost / 6);
-                    cv::Point p = foregroundBoundary[samples[y][x].fi];
+                    int k = samples.index(y, x);
+                    alpha(y, x) = 255 * samples.alpha[k];
+                    conf(y, x) = 255 * exp(-samples.cost[k] / 6);
+                    cv::Point p = foregroundBoundary[samples.fi[k]];
                     foreground(y, x) = image(p.y, p.x);
                     break;
                 }
@@ -507,7 +755,7 @@ static void globalMattingHelper(cv::Mat _image, cv::Mat _trimap, cv::Mat &_foreg
         }
 }
 
-void globalMatting(cv::InputArray _image, cv::InputArray _trimap, cv::OutputArray _foreground, cv::OutputArray _alpha, cv::OutputArray _conf)
+void globalMatting(cv::InputArray _image, cv::InputArray _trimap, cv::OutputArray _foreground, cv::OutputArray _alpha, cv::OutputArray _conf, unsigned int seed)
 {
     cv::Mat image = _image.getMat();
     cv::Mat trimap = _trimap.getMat();
@@ -529,7 +777,7 @@ void globalMatting(cv::InputArray _image, cv::InputArray _trimap, cv::OutputArra
     cv::Mat &alpha = _alpha.getMatRef();
     cv::Mat tempConf;
 
-    globalMattingHelper(image, trimap, foreground, alpha, tempConf);
+    globalMattingHelper(image, trimap, foreground, alpha, tempConf, seed);
 
     if(_conf.needed())
         tempConf.copyTo(_conf);
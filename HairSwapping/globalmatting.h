@@ -4,6 +4,8 @@
 #include <opencv2/opencv.hpp>
 
 void expansionOfKnownRegions(cv::InputArray img, cv::InputOutputArray trimap, int niter = 9);
-void globalMatting(cv::InputArray image, cv::InputArray trimap, cv::OutputArray foreground, cv::OutputArray alpha, cv::OutputArray conf = cv::noArray());
+// The sampling is randomised but fully determined by seed: the same seed gives the same alpha
+// regardless of how many threads OpenCV uses.
+void globalMatting(cv::InputArray image, cv::InputArray trimap, cv::OutputArray foreground, cv::OutputArray alpha, cv::OutputArray conf = cv::noArray(), unsigned int seed = 0);
 
 #endif
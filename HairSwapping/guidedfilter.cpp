@@ -1,5 +1,11 @@
 #include "guidedfilter.h"
 
+// side of the square tiles guidedFilterTrimap works on
+static const int TRIMAP_TILE_SIZE = 128;
+
+// rows per band of the streaming colour filter; bands run in parallel
+static const int STREAM_BAND_ROWS = 128;
+
 static cv::Mat boxfilter(const cv::Mat &I, int r)
 {
     cv::Mat result;
@@ -22,10 +28,17 @@ class GuidedFilterImpl
 public:
     virtual ~GuidedFilterImpl() {}
 
-    cv::Mat filter(const cv::Mat &p, int depth);
+    cv::Mat filter(const cv::Mat &p, int depth) const;
 
 protected:
+    // fast guided filter (He & Sun, 2015): the coefficients a and b are computed on the guide
+    // subsampled by s and upsampled again before the final mean_a * I + mean_b
+    cv::Mat subsample(const cv::Mat &mat) const;
+    cv::Mat upsample(const cv::Mat &mat) const;
+
     int Idepth;
+    int s;
+    cv::Size fullSize;
 
 private:
     virtual cv::Mat filterSingleChannel(const cv::Mat &p) const = 0;
@@ -34,7 +47,7 @@ private:
 class GuidedFilterMono : public GuidedFilterImpl
 {
 public:
-    GuidedFilterMono(const cv::Mat &I, int r, double eps);
+    GuidedFilterMono(const cv::Mat &I, int r, double eps, int s);
 
 private:
     virtual cv::Mat filterSingleChannel(const cv::Mat &p) const;
@@ -42,19 +55,22 @@ private:
 private:
     int r;
     double eps;
-    cv::Mat I, mean_I, var_I;
+    cv::Mat I, I_sub, mean_I, var_I;
 };
 
 class GuidedFilterColor : public GuidedFilterImpl
 {
 public:
-    GuidedFilterColor(const cv::Mat &I, int r, double eps);
+    GuidedFilterColor(const cv::Mat &I, int r, double eps, int s);
 
 private:
     virtual cv::Mat filterSingleChannel(const cv::Mat &p) const;
 
+    template <typename T>
+    void filterRows(const cv::Mat &p, int y0, int y1, cv::Mat *out) const;
+
 private:
-    std::vector<cv::Mat> Ichannels;
+    std::vector<cv::Mat> Ichannels, Ichannels_sub;
     int r;
     double eps;
     cv::Mat mean_I_r, mean_I_g, mean_I_b;
@@ -62,7 +78,7 @@ private:
 };
 
 
-cv::Mat GuidedFilterImpl::filter(const cv::Mat &p, int depth)
+cv::Mat GuidedFilterImpl::filter(const cv::Mat &p, int depth) const
 {
     cv::Mat p2 = convertTo(p, Idepth);
 
@@ -85,7 +101,27 @@ cv::Mat GuidedFilterImpl::filter(const cv::Mat &p, int depth)
     return convertTo(result, depth == -1 ? p.depth() : depth);
 }
 
-GuidedFilterMono::GuidedFilterMono(const cv::Mat &origI, int r, double eps) : r(r), eps(eps)
+cv::Mat GuidedFilterImpl::subsample(const cv::Mat &mat) const
+{
+    if (s == 1)
+        return mat;
+
+    cv::Mat result;
+    cv::resize(mat, result, cv::Size((mat.cols + s - 1) / s, (mat.rows + s - 1) / s), 0, 0, cv::INTER_NEAREST);
+    return result;
+}
+
+cv::Mat GuidedFilterImpl::upsample(const cv::Mat &mat) const
+{
+    if (s == 1)
+        return mat;
+
+    cv::Mat result;
+    cv::resize(mat, result, fullSize, 0, 0, cv::INTER_LINEAR);
+    return result;
+}
+
+GuidedFilterMono::GuidedFilterMono(const cv::Mat &origI, int r, double eps, int s) : r(r), eps(eps)
 {
     if (origI.depth() == CV_32F || origI.depth() == CV_64F)
         I = origI.clone();
@@ -93,28 +129,34 @@ GuidedFilterMono::GuidedFilterMono(const cv::Mat &origI, int r, double eps) : r(
         I = convertTo(origI, CV_32F);
 
     Idepth = I.depth();
+    this->s = s;
+    fullSize = I.size();
+
+    I_sub = subsample(I);
 
-    mean_I = boxfilter(I, r);
-    cv::Mat mean_II = boxfilter(I.mul(I), r);
+    mean_I = boxfilter(I_sub, r);
+    cv::Mat mean_II = boxfilter(I_sub.mul(I_sub), r);
     var_I = mean_II - mean_I.mul(mean_I);
 }
 
-cv::Mat GuidedFilterMono::filterSingleChannel(const cv::Mat &p) const
+cv::Mat GuidedFilterMono::filterSingleChannel(const cv::Mat &origP) const
 {
+    cv::Mat p = subsample(origP);
+
     cv::Mat mean_p = boxfilter(p, r);
-    cv::Mat mean_Ip = boxfilter(I.mul(p), r);
+    cv::Mat mean_Ip = boxfilter(I_sub.mul(p), r);
     cv::Mat cov_Ip = mean_Ip - mean_I.mul(mean_p); // this is the covariance of (I, p) in each local patch.
 
     cv::Mat a = cov_Ip / (var_I + eps); // Eqn. (5) in the paper;
     cv::Mat b = mean_p - a.mul(mean_I); // Eqn. (6) in the paper;
 
-    cv::Mat mean_a = boxfilter(a, r);
-    cv::Mat mean_b = boxfilter(b, r);
+    cv::Mat mean_a = upsample(boxfilter(a, r));
+    cv::Mat mean_b = upsample(boxfilter(b, r));
 
     return mean_a.mul(I) + mean_b;
 }
 
-GuidedFilterColor::GuidedFilterColor(const cv::Mat &origI, int r, double eps) : r(r), eps(eps)
+GuidedFilterColor::GuidedFilterColor(const cv::Mat &origI, int r, double eps, int s) : r(r), eps(eps)
 {
     cv::Mat I;
     if (origI.depth() == CV_32F || origI.depth() == CV_64F)
@@ -123,24 +165,30 @@ GuidedFilterColor::GuidedFilterColor(const cv::Mat &origI, int r, double eps) :
         I = convertTo(origI, CV_32F);
 
     Idepth = I.depth();
+    this->s = s;
+    fullSize = I.size();
 
     cv::split(I, Ichannels);
 
-    mean_I_r = boxfilter(Ichannels[0], r);
-    mean_I_g = boxfilter(Ichannels[1], r);
-    mean_I_b = boxfilter(Ichannels[2], r);
+    Ichannels_sub.resize(3);
+    for (int c = 0; c < 3; ++c)
+        Ichannels_sub[c] = subsample(Ichannels[c]);
+
+    mean_I_r = boxfilter(Ichannels_sub[0], r);
+    mean_I_g = boxfilter(Ichannels_sub[1], r);
+    mean_I_b = boxfilter(Ichannels_sub[2], r);
 
     // variance of I in each local patch: the matrix Sigma in Eqn (14).
     // Note the variance in each local patch is a 3x3 symmetric matrix:
     //           rr, rg, rb
     //   Sigma = rg, gg, gb
     //           rb, gb, bb
-    cv::Mat var_I_rr = boxfilter(Ichannels[0].mul(Ichannels[0]), r) - mean_I_r.mul(mean_I_r) + eps;
-    cv::Mat var_I_rg = boxfilter(Ichannels[0].mul(Ichannels[1]), r) - mean_I_r.mul(mean_I_g);
-    cv::Mat var_I_rb = boxfilter(Ichannels[0].mul(Ichannels[2]), r) - mean_I_r.mul(mean_I_b);
-    cv::Mat var_I_gg = boxfilter(Ichannels[1].mul(Ichannels[1]), r) - mean_I_g.mul(mean_I_g) + eps;
-    cv::Mat var_I_gb = boxfilter(Ichannels[1].mul(Ichannels[2]), r) - mean_I_g.mul(mean_I_b);
-    cv::Mat var_I_bb = boxfilter(Ichannels[2].mul(Ichannels[2]), r) - mean_I_b.mul(mean_I_b) + eps;
+    cv::Mat var_I_rr = boxfilter(Ichannels_sub[0].mul(Ichannels_sub[0]), r) - mean_I_r.mul(mean_I_r) + eps;
+    cv::Mat var_I_rg = boxfilter(Ichannels_sub[0].mul(Ichannels_sub[1]), r) - mean_I_r.mul(mean_I_g);
+    cv::Mat var_I_rb = boxfilter(Ichannels_sub[0].mul(Ichannels_sub[2]), r) - mean_I_r.mul(mean_I_b);
+    cv::Mat var_I_gg = boxfilter(Ichannels_sub[1].mul(Ichannels_sub[1]), r) - mean_I_g.mul(mean_I_g) + eps;
+    cv::Mat var_I_gb = boxfilter(Ichannels_sub[1].mul(Ichannels_sub[2]), r) - mean_I_g.mul(mean_I_b);
+    cv::Mat var_I_bb = boxfilter(Ichannels_sub[2].mul(Ichannels_sub[2]), r) - mean_I_b.mul(mean_I_b) + eps;
 
     // Inverse of Sigma + eps * I
     invrr = var_I_gg.mul(var_I_bb) - var_I_gb.mul(var_I_gb);
@@ -160,40 +208,233 @@ GuidedFilterColor::GuidedFilterColor(const cv::Mat &origI, int r, double eps) :
     invbb /= covDet;
 }
 
-cv::Mat GuidedFilterColor::filterSingleChannel(const cv::Mat &p) const
+// Reflect-101 index lookups for a sliding window of radius rad over n samples, the border
+// cv::blur uses: window x covers add[x - 1] ... add[x], it gains add[x] and loses sub[x].
+static void slidingWindowIndices(int n, int rad, std::vector<int> &add, std::vector<int> &sub)
 {
-    cv::Mat mean_p = boxfilter(p, r);
+    add.resize(n);
+    sub.resize(n);
+    for (int i = 0; i < n; ++i)
+    {
+        add[i] = cv::borderInterpolate(i + rad, n, cv::BORDER_REFLECT_101);
+        sub[i] = cv::borderInterpolate(i - rad - 1, n, cv::BORDER_REFLECT_101);
+    }
+}
 
-    cv::Mat mean_Ip_r = boxfilter(Ichannels[0].mul(p), r);
-    cv::Mat mean_Ip_g = boxfilter(Ichannels[1].mul(p), r);
-    cv::Mat mean_Ip_b = boxfilter(Ichannels[2].mul(p), r);
+// Horizontal box sum of four interleaved rows of column sums.
+static void horizontalBoxSum4(const double *col, double *box, int w, int rad, const std::vector<int> &add, const std::vector<int> &sub)
+{
+    double sum[4] = { 0, 0, 0, 0 };
+    for (int i = -rad; i <= rad; ++i)
+    {
+        const double *c = col + 4 * cv::borderInterpolate(i, w, cv::BORDER_REFLECT_101);
+        for (int k = 0; k < 4; ++k)
+            sum[k] += c[k];
+    }
 
-    // covariance of (I, p) in each local patch.
-    cv::Mat cov_Ip_r = mean_Ip_r - mean_I_r.mul(mean_p);
-    cv::Mat cov_Ip_g = mean_Ip_g - mean_I_g.mul(mean_p);
-    cv::Mat cov_Ip_b = mean_Ip_b - mean_I_b.mul(mean_p);
+    for (int x = 0; x < w; ++x)
+    {
+        if (x > 0)
+        {
+            const double *a = col + 4 * add[x], *d = col + 4 * sub[x];
+            for (int k = 0; k < 4; ++k)
+                sum[k] += a[k] - d[k];
+        }
+
+        for (int k = 0; k < 4; ++k)
+            box[4 * x + k] = sum[k];
+    }
+}
 
-    cv::Mat a_r = invrr.mul(cov_Ip_r) + invrg.mul(cov_Ip_g) + invrb.mul(cov_Ip_b);
-    cv::Mat a_g = invrg.mul(cov_Ip_r) + invgg.mul(cov_Ip_g) + invgb.mul(cov_Ip_b);
-    cv::Mat a_b = invrb.mul(cov_Ip_r) + invgb.mul(cov_Ip_g) + invbb.mul(cov_Ip_b);
+// Output rows [y0, y1) of the colour guided filter in a single streaming pass. The box filters
+// are running sums (column sums slid down the image, then a running sum along the row), and the
+// coefficients a_r, a_g, a_b, b only live in a ring of 2r + 2 rows, which is all the second box
+// filter needs. The arithmetic matches the Mat version: products in T, box sums in double.
+// With s == 1, out[0] receives q; otherwise out[0..3] receive mean_a_r, mean_a_g, mean_a_b and
+// mean_b on the subsampled grid.
+template <typename T>
+void GuidedFilterColor::filterRows(const cv::Mat &p, int y0, int y1, cv::Mat *out) const
+{
+    const int w = p.cols, h = p.rows;
+    const int rad = r / 2;
+    const double area = (double)r * r;
+
+    std::vector<int> addX, subX, addY, subY;
+    slidingWindowIndices(w, rad, addX, subX);
+    slidingWindowIndices(h, rad, addY, subY);
+
+    // every row the second box filter touches for [y0, y1) is a row of a, b in
+    // [first, y1 - 1 + rad], and the ring keeps the last ringSize of them
+    int first = std::max(y0 - rad, 0);
+    int ringSize = 2 * rad + 2;
+    if (h <= ringSize)
+    {
+        first = 0;
+        ringSize = h;
+    }
 
-    cv::Mat b = mean_p - a_r.mul(mean_I_r) - a_g.mul(mean_I_g) - a_b.mul(mean_I_b); // Eqn. (15) in the paper;
+    std::vector<double> col(4 * w), box(4 * w);
+    std::vector<T> ring(4 * w * ringSize);
 
-    return (boxfilter(a_r, r).mul(Ichannels[0])
-          + boxfilter(a_g, r).mul(Ichannels[1])
-          + boxfilter(a_b, r).mul(Ichannels[2])
-          + boxfilter(b, r));  // Eqn. (16) in the paper;
+    // column sums of p, I_r p, I_g p, I_b p
+    auto accumulateInput = [&](int y, double sign)
+    {
+        const T *pp = p.ptr<T>(y);
+        const T *ir = Ichannels_sub[0].ptr<T>(y), *ig = Ichannels_sub[1].ptr<T>(y), *ib = Ichannels_sub[2].ptr<T>(y);
+        double *c = &col[0];
+        for (int x = 0; x < w; ++x, c += 4)
+        {
+            T pv = pp[x];
+            T ipr = ir[x] * pv, ipg = ig[x] * pv, ipb = ib[x] * pv;
+            c[0] += sign * pv;
+            c[1] += sign * ipr;
+            c[2] += sign * ipg;
+            c[3] += sign * ipb;
+        }
+    };
+
+    // column sums of a_r, a_g, a_b, b
+    std::vector<double> colAB(4 * w, 0.0);
+    auto accumulateAB = [&](int y, double sign)
+    {
+        const T *row = &ring[(std::size_t)4 * w * (y % ringSize)];
+        for (int i = 0; i < 4 * w; ++i)
+            colAB[i] += sign * row[i];
+    };
+
+    // computes row y of a_r, a_g, a_b, b into the ring
+    int nextAB = first;
+    auto computeAB = [&]()
+    {
+        int y = nextAB++;
+
+        if (y == first)
+        {
+            std::fill(col.begin(), col.end(), 0.0);
+            for (int i = -rad; i <= rad; ++i)
+                accumulateInput(cv::borderInterpolate(y + i, h, cv::BORDER_REFLECT_101), 1.0);
+        }
+        else
+        {
+            accumulateInput(addY[y], 1.0);
+            accumulateInput(subY[y], -1.0);
+        }
+
+        horizontalBoxSum4(&col[0], &box[0], w, rad, addX, subX);
+
+        const T *mr = mean_I_r.ptr<T>(y), *mg = mean_I_g.ptr<T>(y), *mb = mean_I_b.ptr<T>(y);
+        const T *rr = invrr.ptr<T>(y), *rg = invrg.ptr<T>(y), *rb = invrb.ptr<T>(y);
+        const T *gg = invgg.ptr<T>(y), *gb = invgb.ptr<T>(y), *bb = invbb.ptr<T>(y);
+        T *dst = &ring[(std::size_t)4 * w * (y % ringSize)];
+
+        for (int x = 0; x < w; ++x)
+        {
+            T mean_p = (T)(box[4 * x] / area);
+            T mean_Ip_r = (T)(box[4 * x + 1] / area);
+            T mean_Ip_g = (T)(box[4 * x + 2] / area);
+            T mean_Ip_b = (T)(box[4 * x + 3] / area);
+
+            // covariance of (I, p) in each local patch.
+            T cov_Ip_r = mean_Ip_r - mr[x] * mean_p;
+            T cov_Ip_g = mean_Ip_g - mg[x] * mean_p;
+            T cov_Ip_b = mean_Ip_b - mb[x] * mean_p;
+
+            T a_r = rr[x] * cov_Ip_r + rg[x] * cov_Ip_g + rb[x] * cov_Ip_b;
+            T a_g = rg[x] * cov_Ip_r + gg[x] * cov_Ip_g + gb[x] * cov_Ip_b;
+            T a_b = rb[x] * cov_Ip_r + gb[x] * cov_Ip_g + bb[x] * cov_Ip_b;
+
+            dst[4 * x] = a_r;
+            dst[4 * x + 1] = a_g;
+            dst[4 * x + 2] = a_b;
+            dst[4 * x + 3] = mean_p - a_r * mr[x] - a_g * mg[x] - a_b * mb[x]; // Eqn. (15) in the paper;
+        }
+    };
+
+    for (int y = y0; y < y1; ++y)
+    {
+        while (nextAB <= std::min(y + rad, h - 1))
+            computeAB();
+
+        if (y == y0)
+        {
+            for (int i = -rad; i <= rad; ++i)
+                accumulateAB(cv::borderInterpolate(y + i, h, cv::BORDER_REFLECT_101), 1.0);
+        }
+        else
+        {
+            accumulateAB(addY[y], 1.0);
+            accumulateAB(subY[y], -1.0);
+        }
+
+        horizontalBoxSum4(&colAB[0], &box[0], w, rad, addX, subX);
+
+        if (s == 1)
+        {
+            const T *ir = Ichannels[0].ptr<T>(y), *ig = Ichannels[1].ptr<T>(y), *ib = Ichannels[2].ptr<T>(y);
+            T *q = out[0].ptr<T>(y);
+
+            for (int x = 0; x < w; ++x)
+                q[x] = (T)(box[4 * x] / area) * ir[x] + (T)(box[4 * x + 1] / area) * ig[x]
+                     + (T)(box[4 * x + 2] / area) * ib[x] + (T)(box[4 * x + 3] / area); // Eqn. (16) in the paper;
+        }
+        else
+        {
+            for (int k = 0; k < 4; ++k)
+            {
+                T *m = out[k].ptr<T>(y);
+                for (int x = 0; x < w; ++x)
+                    m[x] = (T)(box[4 * x + k] / area);
+            }
+        }
+    }
 }
 
+cv::Mat GuidedFilterColor::filterSingleChannel(const cv::Mat &origP) const
+{
+    cv::Mat p = subsample(origP);
+
+    cv::Mat out[4];
+    for (int k = 0; k < (s == 1 ? 1 : 4); ++k)
+        out[k].create(p.size(), p.type());
 
-GuidedFilter::GuidedFilter(const cv::Mat &I, int r, double eps)
+    int nBands = (p.rows + STREAM_BAND_ROWS - 1) / STREAM_BAND_ROWS;
+
+    cv::parallel_for_(cv::Range(0, nBands), [&](const cv::Range &range)
+    {
+        for (int band = range.start; band < range.end; ++band)
+        {
+            int y0 = band * STREAM_BAND_ROWS;
+            int y1 = std::min(y0 + STREAM_BAND_ROWS, p.rows);
+
+            if (Idepth == CV_32F)
+                filterRows<float>(p, y0, y1, out);
+            else
+                filterRows<double>(p, y0, y1, out);
+        }
+    });
+
+    if (s == 1)
+        return out[0];
+
+    return (upsample(out[0]).mul(Ichannels[0])
+          + upsample(out[1]).mul(Ichannels[1])
+          + upsample(out[2]).mul(Ichannels[2])
+          + upsample(out[3]));  // Eqn. (16) in the paper;
+}
+
+
+GuidedFilter::GuidedFilter(const cv::Mat &I, int r, double eps, int s)
 {
     CV_Assert(I.channels() == 1 || I.channels() == 3);
+    CV_Assert(s >= 1);
+
+    // the window radius shrinks with the guide, but never below one pixel
+    int rSub = std::max(r / s, 1);
 
     if (I.channels() == 1)
-        impl_ = new GuidedFilterMono(I, 2 * r + 1, eps);
+        impl_ = new GuidedFilterMono(I, 2 * rSub + 1, eps, s);
     else
-        impl_ = new GuidedFilterColor(I, 2 * r + 1, eps);
+        impl_ = new GuidedFilterColor(I, 2 * rSub + 1, eps, s);
 }
 
 GuidedFilter::~GuidedFilter()
@@ -206,7 +447,63 @@ cv::Mat GuidedFilter::filter(const cv::Mat &p, int depth) const
     return impl_->filter(p, depth);
 }
 
-cv::Mat guidedFilter(const cv::Mat &I, const cv::Mat &p, int r, double eps, int depth)
+cv::Mat guidedFilter(const cv::Mat &I, const cv::Mat &p, int r, double eps, int depth, int s)
+{
+    return GuidedFilter(I, r, eps, s).filter(p, depth);
+}
+
+
+cv::Mat guidedFilterTrimap(const cv::Mat &I, const cv::Mat &p, const cv::Mat &trimap, int r, double eps, int depth, int s)
 {
-    return GuidedFilter(I, r, eps).filter(p, depth);
+    CV_Assert(trimap.type() == CV_8UC1 && trimap.size() == p.size() && I.size() == p.size());
+    CV_Assert(s >= 1 && TRIMAP_TILE_SIZE % s == 0);
+
+    if (depth == -1)
+        depth = p.depth();
+
+    cv::Mat result(p.size(), CV_MAKETYPE(depth, p.channels()), cv::Scalar::all(0));
+
+    // an output pixel depends on the guide and input within 2r of it, so each tile is filtered
+    // on its own with that halo and matches the full-image filter inside the tile. With s > 1 the
+    // upsampling reaches one more subsampled pixel, and the halo is rounded up to a multiple of s
+    // so every padded tile starts on the subsampling grid of the full image
+    int halo = s == 1 ? 2 * r : (2 * r + s + s - 1) / s * s;
+
+    int nTilesX = (p.cols + TRIMAP_TILE_SIZE - 1) / TRIMAP_TILE_SIZE;
+    int nTilesY = (p.rows + TRIMAP_TILE_SIZE - 1) / TRIMAP_TILE_SIZE;
+
+    cv::parallel_for_(cv::Range(0, nTilesX * nTilesY), [&](const cv::Range &range)
+    {
+        for (int t = range.start; t < range.end; ++t)
+        {
+            int x0 = (t % nTilesX) * TRIMAP_TILE_SIZE;
+            int y0 = (t / nTilesX) * TRIMAP_TILE_SIZE;
+
+            cv::Rect tile(x0, y0, std::min(TRIMAP_TILE_SIZE, p.cols - x0), std::min(TRIMAP_TILE_SIZE, p.rows - y0));
+
+            cv::Mat trimapTile = trimap(tile);
+            cv::Mat resultTile = result(tile);
+
+            cv::Mat unknown = (trimapTile != 0) & (trimapTile != 255);
+
+            if (cv::countNonZero(unknown) > 0)
+            {
+                int left = std::max(tile.x - halo, 0);
+                int top = std::max(tile.y - halo, 0);
+                int right = std::min(tile.x + tile.width + halo, p.cols);
+                int bottom = std::min(tile.y + tile.height + halo, p.rows);
+
+                cv::Rect padded(left, top, right - left, bottom - top);
+                cv::Rect inner(tile.x - left, tile.y - top, tile.width, tile.height);
+
+                cv::Mat filtered = GuidedFilter(I(padded), r, eps, s).filter(p(padded), depth);
+
+                filtered(inner).copyTo(resultTile, unknown);
+            }
+
+            resultTile.setTo(cv::Scalar::all(255), trimapTile == 255);
+        }
+    });
+
+    return result;
 }
@@ -8,15 +8,26 @@ class GuidedFilterImpl;
 class GuidedFilter
 {
 public:
-    GuidedFilter(const cv::Mat &I, int r, double eps);
+    // s > 1 selects the fast guided filter, which computes the linear coefficients on the guide
+    // subsampled by s; the cost drops by roughly s^2
+    GuidedFilter(const cv::Mat &I, int r, double eps, int s = 1);
     ~GuidedFilter();
 
+    // The guide statistics (local means and inverse covariances) are computed once by the
+    // constructor. filter() only reads them, so one GuidedFilter can filter any number of
+    // inputs for the same guide, also from several threads.
     cv::Mat filter(const cv::Mat &p, int depth = -1) const;
 
 private:
     GuidedFilterImpl *impl_;
 };
 
-cv::Mat guidedFilter(const cv::Mat &I, const cv::Mat &p, int r, double eps, int depth = -1);
+cv::Mat guidedFilter(const cv::Mat &I, const cv::Mat &p, int r, double eps, int depth = -1, int s = 1);
+
+// Same as guidedFilter, but only evaluated where trimap is neither 0 nor 255. Pixels the trimap
+// marks as known are set to 0 / 255 directly instead of being filtered and then overwritten.
+// With s > 1 each tile is filtered with the fast (subsampled) guided filter; tiles start on
+// multiples of s so the subsampling grid is the same in every tile.
+cv::Mat guidedFilterTrimap(const cv::Mat &I, const cv::Mat &p, const cv::Mat &trimap, int r, double eps, int depth = -1, int s = 1);
 
 #endif
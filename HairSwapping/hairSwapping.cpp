@@ -273,11 +273,17 @@ void swapHairMain(int argc, char *argv[])
 
 	string model;
 	string target;
+	int blendingMode = SKIN_BLENDING_POISSON;
 
-	if (argc == 3)
+	if (argc == 3 || argc == 4)
 	{
 		model = argv[1];
 		target = argv[2];
+
+		if (argc == 4 && string(argv[3]) == "preview")
+		{
+			blendingMode = SKIN_BLENDING_PYRAMID;
+		}
 	}
 
 	else
@@ -334,7 +340,7 @@ void swapHairMain(int argc, char *argv[])
 	printf("Face detected. \n");
 
 	printf("Extracting hair from target... \n");
-	retCode = extractHair(imgRGBTarget, faceTarget, &segmentationLabelsTarget, &hairTarget);
+	retCode = extractHair(imgRGBTarget, faceTarget, &segmentationLabelsTarget, &hairTarget, HAIR_ROLE_TARGET);
 
 	if (retCode == -1)
 	{
@@ -343,7 +349,7 @@ void swapHairMain(int argc, char *argv[])
 	printf("Hair extracted. \n");
 
 	printf("Synthesizing face... \n");
-	Mat synthesizedface = synthesizeSkin(imgRGBTarget, faceTarget, hairTarget);
+	Mat synthesizedface = synthesizeSkin(imgRGBTarget, faceTarget, hairTarget, blendingMode);
 	printf("Face synthesized. \n");	
 
 	Mat hairSwap = swapHair(hairModel, faceTarget, faceModel.getHeadSize(), synthesizedface);
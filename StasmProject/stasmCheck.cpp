@@ -0,0 +1,595 @@
+// stasmCheck.cpp: check stasm_search_single landmarks against reference landmarks
+//
+// Run it once with -w on a build of the reference tree to save its landmarks,
+// then without -w on the build under test to compare against them:
+//
+//     stasmCheck -w refdir data/ data/*.png     (reference build)
+//     stasmCheck refdir data/ data/*.png        (build under test)
+//     stasmCheck -n refdir data/ data/*.png     (same, with cv::setUseOptimized(false))
+//
+// For each image it prints the largest and mean distance in pixels between
+// the new and the reference landmarks.  It exits with status 1 if any
+// landmark moved by more than the tolerance (-t, default 1 pixel), or if a
+// face was found in one build but not the other.
+//
+// With -j N it then searches all the images again on N threads at once,
+// each thread with its own stasm_ctx, and fails unless every thread gets
+// exactly the landmarks of the serial run.  Each thread also makes a failing
+// call before each search, and checks that the error is its own and is
+// cleared by the next call.
+//
+// With -c mindist it searches all the images again with
+// stasm_ctx_set_convergence(mindist), and prints the number of iterations
+// at each pyramid level (coarsest first, as in the stasm trace) and how far
+// the landmarks drifted from the fixed-iteration search.  This is a report,
+// not a check: some drift is expected and -t does not apply to it.
+//
+// With -p it feeds each image's landmarks back to stasm_ctx_search_prior as
+// the prior, at each start level from 0 to 3, and prints how far the result
+// is from the reference landmarks.  This too is a report.  It also checks
+// that a degenerate prior and a prior outside the image are rejected.
+//
+// This file has its own main, so it is built separately from stasmMain.cpp,
+// by the stasmCheck project in Stasm.sln, or with e.g.
+// g++ -O2 -fopenmp -pthread -I../stasm stasmCheck.cpp ../stasm/*.cpp
+// ../stasm/MOD_1/*.cpp `pkg-config --cflags --libs opencv`
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <thread>
+
+// OpenCV
+#include <opencv2//core.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include "opencv/highgui.h"
+#include "stasm_lib.h"
+
+
+using namespace std;
+using namespace cv;
+
+static string RefPath(const string& refDir, const char* imgPath)
+{
+	string base(imgPath);
+	size_t slash = base.find_last_of("/\\");
+	if (slash != string::npos)
+	{
+		base = base.substr(slash + 1);
+	}
+	return refDir + "/" + base + ".csv";
+}
+
+struct SearchResult
+{
+	int foundface;
+	float landmarks[2 * stasm_NLANDMARKS]; // x,y coords (note the 2)
+	int niters[stasm_NPYRLEVS];            // iterations at each pyramid level
+};
+
+// Largest and mean distance in pixels between two sets of landmarks.
+
+static void LandmarkDists(const float* landmarks, const float* refLandmarks,
+	double* maxDist, int* maxPoint, double* meanDist)
+{
+	double sum = 0;
+	*maxDist = 0;
+	*maxPoint = 0;
+	for (int i = 0; i < stasm_NLANDMARKS; i++)
+	{
+		double dx = landmarks[2 * i] - refLandmarks[2 * i];
+		double dy = landmarks[2 * i + 1] - refLandmarks[2 * i + 1];
+		double dist = sqrt(dx * dx + dy * dy);
+		if (dist > *maxDist)
+		{
+			*maxDist = dist;
+			*maxPoint = i;
+		}
+		sum += dist;
+	}
+	*meanDist = sum / stasm_NLANDMARKS;
+}
+
+static void PrintIters(const int* niters)
+{
+	printf("[iters");
+	for (int ilev = stasm_NPYRLEVS - 1; ilev >= 0; ilev--)
+	{
+		printf(" %d", niters[ilev]);
+	}
+	printf("]");
+}
+
+// Landmarks are saved one x,y pair per line, or the single line "noface".
+
+static void WriteRef(const string& path, int foundface, const float* landmarks)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file)
+	{
+		printf("Cannot write %s\n", path.c_str());
+		exit(1);
+	}
+	if (!foundface)
+	{
+		fprintf(file, "noface\n");
+	}
+	for (int i = 0; foundface && i < stasm_NLANDMARKS; i++)
+	{
+		fprintf(file, "%.3f,%.3f\n", landmarks[2 * i], landmarks[2 * i + 1]);
+	}
+	fclose(file);
+}
+
+static bool ReadRef(const string& path, int* foundface, float* landmarks)
+{
+	FILE* file = fopen(path.c_str(), "r");
+	if (!file)
+	{
+		return false;
+	}
+	char line[100];
+	*foundface = 1;
+	for (int i = 0; i < stasm_NLANDMARKS; i++)
+	{
+		if (!fgets(line, sizeof(line), file))
+		{
+			fclose(file);
+			return false;
+		}
+		if (i == 0 && strncmp(line, "noface", 6) == 0)
+		{
+			*foundface = 0;
+			break;
+		}
+		if (sscanf(line, "%f,%f", &landmarks[2 * i], &landmarks[2 * i + 1]) != 2)
+		{
+			fclose(file);
+			return false;
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+static bool SameResult(const SearchResult& a, const SearchResult& b)
+{
+	if (a.foundface != b.foundface)
+	{
+		return false;
+	}
+	return !a.foundface || memcmp(a.landmarks, b.landmarks, sizeof(a.landmarks)) == 0;
+}
+
+// Search all the images with this thread's own stasm_ctx.  Threads start at
+// different images, so different images are searched at the same time.
+// Before each search a bad call is made, an Err in odd threads and a
+// CV_Assert (through the OpenCV error callback) in even threads.  Its error
+// must be this thread's and must be gone after the next successful call.
+
+static void SearchInThread(int iThread, const char* dataDir,
+	const vector<Mat_<unsigned char> >* imgs, const vector<const char*>* paths,
+	vector<SearchResult>* results, string* err)
+{
+	stasm_ctx* ctx = stasm_ctx_create(dataDir, 0);
+	if (!ctx)
+	{
+		*err = stasm_lasterr();
+		return;
+	}
+
+	const int nImgs = int(imgs->size());
+	const char* badCallErr = iThread % 2 ? "negative" : "imgpath";
+
+	for (int k = 0; k < nImgs && err->empty(); k++)
+	{
+		const int i = (k + iThread) % nImgs;
+		const Mat_<unsigned char>& img = (*imgs)[i];
+
+		const int badCallOk = iThread % 2 ?
+			stasm_ctx_set_convergence(ctx, -1) :
+			stasm_ctx_open_image(ctx, (const char*)img.data, img.cols, img.rows, NULL, 0, 10);
+
+		if (badCallOk || !strstr(stasm_ctx_lasterr(ctx), badCallErr))
+		{
+			*err = string("bad call gave the wrong error: ") + stasm_ctx_lasterr(ctx);
+			break;
+		}
+
+		if (!stasm_ctx_open_image(ctx, (const char*)img.data, img.cols, img.rows, (*paths)[i], 0, 10))
+		{
+			*err = string((*paths)[i]) + ": " + stasm_ctx_lasterr(ctx);
+			break;
+		}
+
+		if (stasm_ctx_lasterr(ctx)[0])
+		{
+			*err = string("error not cleared: ") + stasm_ctx_lasterr(ctx);
+			break;
+		}
+
+		SearchResult& result = (*results)[i];
+
+		if (!stasm_ctx_search(ctx, &result.foundface, result.landmarks))
+		{
+			*err = string((*paths)[i]) + ": " + stasm_ctx_lasterr(ctx);
+		}
+	}
+
+	stasm_ctx_free(ctx);
+}
+
+// Returns the number of threaded searches that failed or differ from serial.
+
+static int CheckThreads(int nThreads, const char* dataDir,
+	const vector<Mat_<unsigned char> >& imgs, const vector<const char*>& paths,
+	const vector<SearchResult>& serial)
+{
+	vector<vector<SearchResult> > results(nThreads, vector<SearchResult>(imgs.size()));
+	vector<string> errs(nThreads);
+	vector<thread> threads;
+
+	for (int t = 0; t < nThreads; t++)
+	{
+		threads.push_back(thread(SearchInThread, t, dataDir, &imgs, &paths, &results[t], &errs[t]));
+	}
+
+	int nBad = 0;
+
+	for (int t = 0; t < nThreads; t++)
+	{
+		threads[t].join();
+
+		if (!errs[t].empty())
+		{
+			printf("Thread %d: %s\n", t, errs[t].c_str());
+			nBad++;
+			continue;
+		}
+
+		for (size_t i = 0; i < imgs.size(); i++)
+		{
+			if (!SameResult(results[t][i], serial[i]))
+			{
+				printf("Thread %d: %s differs from the serial run\n", t, paths[i]);
+				nBad++;
+			}
+		}
+	}
+
+	printf("%d threads searched %d images each, %d failed or differ from the serial run\n",
+		nThreads, int(imgs.size()), nBad);
+
+	return nBad;
+}
+
+// Search all the images again in one stasm_ctx with early convergence and
+// report the iterations and the drift from the fixed-iteration search.
+
+static void CheckConvergence(double convergeDist, const char* dataDir,
+	const vector<Mat_<unsigned char> >& imgs, const vector<const char*>& paths,
+	const vector<SearchResult>& serial)
+{
+	stasm_ctx* ctx = stasm_ctx_create(dataDir, 0);
+	if (!ctx || !stasm_ctx_set_convergence(ctx, float(convergeDist)))
+	{
+		printf("Error in stasm_ctx_set_convergence: %s\n", stasm_ctx_lasterr(ctx));
+		exit(1);
+	}
+
+	int nIters = 0, nFixedIters = 0;
+	double maxDrift = 0, sumDrift = 0;
+	int nFaces = 0;
+
+	for (size_t i = 0; i < imgs.size(); i++)
+	{
+		const Mat_<unsigned char>& img = imgs[i];
+		SearchResult result;
+
+		if (!stasm_ctx_open_image(ctx, (const char*)img.data, img.cols, img.rows, paths[i], 0, 10) ||
+			!stasm_ctx_search(ctx, &result.foundface, result.landmarks) ||
+			!stasm_ctx_iters(ctx, result.niters))
+		{
+			printf("Error in convergence search: %s\n", stasm_ctx_lasterr(ctx));
+			exit(1);
+		}
+
+		if (!result.foundface || !serial[i].foundface)
+		{
+			printf("%-30s %s\n", paths[i],
+				result.foundface == serial[i].foundface ? "no face" : "face found in only one search");
+			continue;
+		}
+
+		double drift, meanDrift;
+		int driftPoint;
+		LandmarkDists(result.landmarks, serial[i].landmarks, &drift, &driftPoint, &meanDrift);
+
+		printf("%-30s ", paths[i]);
+		PrintIters(result.niters);
+		printf(" fixed ");
+		PrintIters(serial[i].niters);
+		printf(" drift max %.2f (point %d) mean %.3f\n", drift, driftPoint, meanDrift);
+
+		for (int ilev = 0; ilev < stasm_NPYRLEVS; ilev++)
+		{
+			nIters += result.niters[ilev];
+			nFixedIters += serial[i].niters[ilev];
+		}
+		if (drift > maxDrift)
+		{
+			maxDrift = drift;
+		}
+		sumDrift += meanDrift;
+		nFaces++;
+	}
+
+	stasm_ctx_free(ctx);
+
+	printf("Convergence %g: %d iterations instead of %d, largest drift %.2f pixels, mean %.3f\n",
+		convergeDist, nIters, nFixedIters, maxDrift, nFaces ? sumDrift / nFaces : 0.);
+}
+
+// Returns the number of bad priors that stasm_ctx_search_prior accepted.
+
+static int CheckPriorSearch(const char* dataDir,
+	const vector<Mat_<unsigned char> >& imgs, const vector<const char*>& paths,
+	const vector<SearchResult>& serial, const vector<SearchResult>& refs)
+{
+	stasm_ctx* ctx = stasm_ctx_create(dataDir, 0);
+	if (!ctx)
+	{
+		printf("Error in stasm_ctx_create: %s\n", stasm_lasterr());
+		exit(1);
+	}
+
+	double maxShift[stasm_NPYRLEVS] = { 0 }, sumShift[stasm_NPYRLEVS] = { 0 };
+	int nFaces = 0, nBadPriorsAccepted = 0;
+
+	for (size_t i = 0; i < imgs.size(); i++)
+	{
+		if (!serial[i].foundface || !refs[i].foundface)
+		{
+			continue;
+		}
+
+		const Mat_<unsigned char>& img = imgs[i];
+		float landmarks[2 * stasm_NLANDMARKS];
+
+		printf("%-30s shift", paths[i]);
+		for (int startlev = 0; startlev < stasm_NPYRLEVS; startlev++)
+		{
+			if (!stasm_ctx_search_prior(ctx, landmarks, serial[i].landmarks,
+				(const char*)img.data, img.cols, img.rows, paths[i], startlev))
+			{
+				printf("\nError in stasm_ctx_search_prior: %s\n", stasm_ctx_lasterr(ctx));
+				exit(1);
+			}
+			double shift, meanShift;
+			int shiftPoint;
+			LandmarkDists(landmarks, refs[i].landmarks, &shift, &shiftPoint, &meanShift);
+			printf(" lev%d %.2f (%.3f)", startlev, shift, meanShift);
+			if (shift > maxShift[startlev])
+			{
+				maxShift[startlev] = shift;
+			}
+			sumShift[startlev] += meanShift;
+		}
+		printf("\n");
+		nFaces++;
+
+		// priors that must be rejected: all points at 0,0, and the face
+		// moved off the side of the image
+
+		float badPrior[2 * stasm_NLANDMARKS];
+		memset(badPrior, 0, sizeof(badPrior));
+		if (stasm_ctx_search_prior(ctx, landmarks, badPrior,
+			(const char*)img.data, img.cols, img.rows, paths[i], 0))
+		{
+			printf("%-30s a prior with all points at 0,0 was accepted\n", paths[i]);
+			nBadPriorsAccepted++;
+		}
+		memcpy(badPrior, serial[i].landmarks, sizeof(badPrior));
+		for (int j = 0; j < stasm_NLANDMARKS; j++)
+		{
+			badPrior[2 * j] += img.cols;
+		}
+		if (stasm_ctx_search_prior(ctx, landmarks, badPrior,
+			(const char*)img.data, img.cols, img.rows, paths[i], 0))
+		{
+			printf("%-30s a prior outside the image was accepted\n", paths[i]);
+			nBadPriorsAccepted++;
+		}
+	}
+
+	stasm_ctx_free(ctx);
+
+	for (int startlev = 0; startlev < stasm_NPYRLEVS; startlev++)
+	{
+		printf("Prior search from level %d: largest shift %.2f pixels, mean %.3f\n",
+			startlev, maxShift[startlev], nFaces ? sumShift[startlev] / nFaces : 0.);
+	}
+
+	return nBadPriorsAccepted;
+}
+
+int main(int argc, char *argv[])
+{
+	bool writeRef = false;
+	double tolerance = 1;
+	int nThreads = 0;
+	double convergeDist = 0;
+	bool priorSearch = false;
+
+	int iarg = 1;
+	for (; iarg < argc && argv[iarg][0] == '-'; iarg++)
+	{
+		if (strcmp(argv[iarg], "-w") == 0)
+		{
+			writeRef = true;
+		}
+		else if (strcmp(argv[iarg], "-n") == 0)
+		{
+			setUseOptimized(false); // stasm then skips its AVX2 kernels
+		}
+		else if (strcmp(argv[iarg], "-t") == 0 && iarg + 1 < argc)
+		{
+			tolerance = atof(argv[++iarg]);
+		}
+		else if (strcmp(argv[iarg], "-j") == 0 && iarg + 1 < argc)
+		{
+			nThreads = atoi(argv[++iarg]);
+		}
+		else if (strcmp(argv[iarg], "-c") == 0 && iarg + 1 < argc)
+		{
+			convergeDist = atof(argv[++iarg]);
+		}
+		else if (strcmp(argv[iarg], "-p") == 0)
+		{
+			priorSearch = true;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if (argc - iarg < 3)
+	{
+		printf("Usage: stasmCheck [-w] [-n] [-t tolerance] [-j nthreads] [-c mindist] [-p] refdir datadir image...\n");
+		exit(1);
+	}
+
+	const string refDir = argv[iarg];
+	const char * dataDirC = argv[iarg + 1];
+
+	double maxDist = 0;    // largest landmark distance over all images
+	double sumDist = 0;
+	int nPoints = 0;
+	int nMismatchedFaces = 0;
+
+	vector<Mat_<unsigned char> > imgs;
+	vector<const char*> paths;
+	vector<SearchResult> serial;
+	vector<SearchResult> refs;   // the reference landmarks, as read or written
+
+	for (iarg += 2; iarg < argc; iarg++)
+	{
+		const char * pathFile = argv[iarg];
+
+		Mat_<unsigned char> imgGray(imread(pathFile, CV_LOAD_IMAGE_GRAYSCALE));
+		if (!imgGray.data)
+		{
+			printf("Cannot load %s\n", pathFile);
+			exit(1);
+		}
+
+		int foundface;
+
+		float landmarks[2 * stasm_NLANDMARKS]; // x,y coords (note the 2)
+
+		if (!stasm_search_single(&foundface, landmarks,
+			(const char*)imgGray.data, imgGray.cols, imgGray.rows, pathFile, dataDirC))
+		{
+			printf("Error in stasm_search_single: %s\n", stasm_lasterr());
+			exit(1);
+		}
+
+		imgs.push_back(imgGray);
+		paths.push_back(pathFile);
+		serial.push_back(SearchResult());
+		serial.back().foundface = foundface;
+		memcpy(serial.back().landmarks, landmarks, sizeof(landmarks));
+		stasm_ctx_iters(NULL, serial.back().niters);
+
+		const string refPath = RefPath(refDir, pathFile);
+
+		if (writeRef)
+		{
+			WriteRef(refPath, foundface, landmarks);
+			refs.push_back(serial.back());
+			printf("%-30s %s\n", pathFile, foundface ? "saved" : "saved (no face)");
+			continue;
+		}
+
+		int refFoundface;
+		float refLandmarks[2 * stasm_NLANDMARKS];
+
+		if (!ReadRef(refPath, &refFoundface, refLandmarks))
+		{
+			printf("Cannot read %s\n", refPath.c_str());
+			exit(1);
+		}
+
+		refs.push_back(SearchResult());
+		refs.back().foundface = refFoundface;
+		memcpy(refs.back().landmarks, refLandmarks, sizeof(refLandmarks));
+
+		if (foundface != refFoundface)
+		{
+			printf("%-30s face found in only one build\n", pathFile);
+			nMismatchedFaces++;
+			continue;
+		}
+
+		if (!foundface)
+		{
+			printf("%-30s no face in either build\n", pathFile);
+			continue;
+		}
+
+		double imgMax, imgMean;
+		int imgMaxPoint;
+		LandmarkDists(landmarks, refLandmarks, &imgMax, &imgMaxPoint, &imgMean);
+
+		printf("%-30s max %.2f (point %d) mean %.3f\n",
+			pathFile, imgMax, imgMaxPoint, imgMean);
+
+		if (imgMax > maxDist)
+		{
+			maxDist = imgMax;
+		}
+		sumDist += imgMean * stasm_NLANDMARKS;
+		nPoints += stasm_NLANDMARKS;
+	}
+
+	int nThreadErrs = 0;
+
+	if (nThreads > 0)
+	{
+		nThreadErrs = CheckThreads(nThreads, dataDirC, imgs, paths, serial);
+	}
+
+	if (convergeDist > 0)
+	{
+		CheckConvergence(convergeDist, dataDirC, imgs, paths, serial);
+	}
+
+	int nBadPriorsAccepted = 0;
+
+	if (priorSearch)
+	{
+		nBadPriorsAccepted = CheckPriorSearch(dataDirC, imgs, paths, serial, refs);
+	}
+
+	if (writeRef)
+	{
+		return nThreadErrs || nBadPriorsAccepted ? 1 : 0;
+	}
+
+	printf("Largest landmark difference %.2f pixels, mean %.3f, tolerance %.2f\n",
+		maxDist, nPoints ? sumDist / nPoints : 0., tolerance);
+
+	if (maxDist > tolerance || nMismatchedFaces || nThreadErrs || nBadPriorsAccepted)
+	{
+		printf("FAILED\n");
+		return 1;
+	}
+
+	printf("OK\n");
+	return 0;
+}
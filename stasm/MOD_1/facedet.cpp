@@ -15,8 +15,6 @@ namespace stasm
 {
 typedef vector<DetPar> vec_DetPar;
 
-static cv::CascadeClassifier facedet_g;  // the face detector
-
 static const double BORDER_FRAC = .1; // fraction of image width or height
                                       // use 0.0 for no border
 
@@ -26,7 +24,7 @@ void FaceDet::OpenFaceDetector_( // called by stasm_init, init face det from XML
     const char* datadir,         // in: directory of face detector files
     void*)                       // in: unused (func signature compatibility)
 {
-    OpenDetector(facedet_g, "haarcascade_frontalface_alt2.xml",  datadir);
+    OpenDetector(cascade_, "haarcascade_frontalface_alt2.xml",  datadir);
 }
 
 // If a face is near the edge of the image, the OpenCV detectors tend to
@@ -47,12 +45,13 @@ static Image EnborderImg(    // return the image with a border
     return bordered_img;
 }
 
-void DetectFaces(          // all face rects into detpars
-    vec_DetPar&  detpars,  // out
-    const Image& img,      // in
-    int          minwidth) // in: as percent of img width
+void DetectFaces(                   // all face rects into detpars
+    vec_DetPar&            detpars,  // out
+    cv::CascadeClassifier& cascade,  // in: the face detector
+    const Image&           img,      // in
+    int                    minwidth) // in: as percent of img width
 {
-    CV_Assert(!facedet_g.empty()); // check that OpenFaceDetector_ was called
+    CV_Assert(!cascade.empty()); // check that OpenFaceDetector_ was called
 
     int leftborder = 0, topborder = 0; // border size in pixels
     Image bordered_img(BORDER_FRAC == 0?
@@ -76,7 +75,7 @@ void DetectFaces(          // all face rects into detpars
     static const int    DETECTOR_FLAGS = 0;
 
     vec_Rect facerects = // all face rects in image
-        Detect(equalized_img, facedet_g, NULL,
+        Detect(equalized_img, cascade, NULL,
                SCALE_FACTOR, MIN_NEIGHBORS, DETECTOR_FLAGS, minpix);
 
     // copy face rects into the detpars vector
@@ -186,7 +185,7 @@ void FaceDet::DetectFaces_( // call once per image to find all the faces
     void*        user)      // in: unused (match virt func signature)
 {
     CV_Assert(user == NULL);
-    DetectFaces(detpars_, img, minwidth);
+    DetectFaces(detpars_, cascade_, img, minwidth);
     char tracepath[SLEN];
     sprintf(tracepath, "%s_00_unsortedfacedet.bmp", Base(imgpath));
     TraceFaces(detpars_, img, tracepath);
@@ -36,6 +36,10 @@ public:
     FaceDet() {}                  // constructor
 
 private:
+    cv::CascadeClassifier cascade_; // the OpenCV face detector
+                                  // (per FaceDet because detectMultiScale isn't
+                                  // reentrant, so each stasm_ctx has its own)
+
     vector<DetPar>  detpars_;     // all the valid faces in the current image
 
     int             iface_;       // index of current face for NextFace_
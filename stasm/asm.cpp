@@ -93,27 +93,70 @@ static void TraceShape(  // write an image file showing current shape on the ima
 #endif // TRACE_IMAGES
 }
 
+void Mod::ClassicSearch_(  // search with the classic desc of a point
+    Shape&       shape,    // io: the point will be moved to best desc match
+    int          ilev,     // in: pyramid level (0 is full size)
+    int          i,        // in: index into desctabs_[ilev] classic points
+    const Image& img,      // in: image scaled to this pyramid level
+    const Shape& inshape)  // in: shape before any points were moved
+const
+{
+    const DescModTab& tab = desctabs_[ilev];
+    const int ipoint = tab.classic_points[i];
+
+    ClassicDescSearch(shape(ipoint, IX), shape(ipoint, IY),
+                      img, inshape, ipoint,
+                      tab.classic_profs + i * tab.proflen,
+                      cholcovis_[ilev].ptr<double>(i),
+                      tab.proflen);
+}
+
+void Mod::HatSearch_(      // search with the HAT desc of a point
+    Shape&       shape,    // io: the point will be moved to best desc match
+    int          ilev,     // in: pyramid level (0 is full size)
+    int          i,        // in: index into desctabs_[ilev] HAT points
+    HatLevData&  hatlev)   // io: HAT data for this pyr lev
+const
+{
+    const DescModTab& tab = desctabs_[ilev];
+    const int ipoint = tab.hat_points[i];
+
+    HatDescSearch(shape(ipoint, IX), shape(ipoint, IY),
+                  HatFit(tab.hat_intercepts[i], tab.hat_coefs + i * HAT_DESC_LEN),
+                  hatlev);
+}
+
 #if _OPENMP
 
 void Mod::SuggestShape_( // args same as non OpenMP version, see below
     Shape&       shape,  // io
     int          ilev,   // in
     const Image& img,    // in
-    const Shape& pinned) // in
+    const Shape& pinned, // in
+    HatLevData&  hatlev) // io
 const
 {
     static bool firsttime = true;
     int ncatch = 0;
+    char err[SBIG];      // first error, the err msg saved by Err is per thread
     const Shape inshape(shape.clone());
+    const DescModTab& tab = desctabs_[ilev];
+    const int nhat = tab.nhat;
 
-    // Call the search function DescSearch_ concurrently for multiple points.
+    // Call the search functions concurrently for multiple points.
     // Note that dynamic OpenMP scheduling is faster here than static,
     // because the time through the loop varies widely (mainly because
-    // classic descriptors are faster than HATs).
+    // classic descriptors are faster than HATs).  For the same reason
+    // we iterate over the HAT points first, then the classic points,
+    // so the short classic searches fill in at the end.
 
     #pragma omp parallel for schedule(dynamic)
 
-    for (int ipoint = 0; ipoint < shape.rows; ipoint++)
+    for (int i = 0; i < nhat + tab.nclassic; i++)
+    {
+        const int ipoint = i < nhat? tab.hat_points[i]:
+                                     tab.classic_points[i - nhat];
+
         if (pinned.rows == 0 || !PointUsed(pinned, ipoint)) // skip point if pinned
         {
             // You are not allowed to jump out of an OpenMP for loop.  Thus
@@ -128,22 +171,27 @@ const
                     firsttime = false;
                     logprintf("[nthreads %d]", omp_get_num_threads());
                 }
-                descmods_[ilev][ipoint]->
-                    DescSearch_(shape(ipoint, IX), shape(ipoint, IY),
-                                img, inshape, ilev, ipoint);
+                if (i < nhat)
+                    HatSearch_(shape, ilev, i, hatlev);
+                else
+                    ClassicSearch_(shape, ilev, i - nhat, img, inshape);
             }
             catch(...)
             {
-                ncatch++; // a call was made to Err or a CV_Assert failed
+                // a call was made to Err or a CV_Assert failed
+                #pragma omp critical
+                if (ncatch++ == 0)
+                    STRCPY(err, LastErr());
+                ClearLastErr(); // else next error in this thread won't be saved
             }
         }
+    }
 
     if (ncatch)
     {
         if (ncatch > 1)
             lprintf_always("\nMultiple errors, only the first will be printed\n");
-        // does not matter what we throw, will be caught by global catch
-        throw "SuggestShape_";
+        Err("%s", err); // rethrow in this thread, will be caught by global catch
     }
 }
 
@@ -153,47 +201,65 @@ void Mod::SuggestShape_( // estimate shape by matching descr at each point
     Shape&       shape,  // io: points will be moved for best descriptor matches
     int          ilev,   // in: pyramid level (0 is full size)
     const Image& img,    // in: image scaled to this pyramid level
-    const Shape& pinned) // in: if no rows then no pinned landmarks, else
+    const Shape& pinned, // in: if no rows then no pinned landmarks, else
                          //     points except those equal to 0,0 are pinned
+    HatLevData&  hatlev) // io: HAT data for this pyr lev
 const
 {
     const Shape inshape(shape.clone());
+    const DescModTab& tab = desctabs_[ilev];
 
-    for (int ipoint = 0; ipoint < shape.rows; ipoint++)
-        if (pinned.rows == 0 || !PointUsed(pinned, ipoint)) // skip point if pinned
-        {
-            // Call the ClassicDescMod or HatDescMod search function
-            // to update the current point in shape (ipoint).
-            // For the yaw00 model, yaw00.mh:YAW00_DESCMODS defines which
-            // descriptor model is used for each point.
-
-            descmods_[ilev][ipoint]->
-                DescSearch_(shape(ipoint, IX), shape(ipoint, IY),
-                            img, inshape, ilev, ipoint);
-        }
+    // Update each point in shape with the search function for its descriptor.
+    // For the yaw00 model, yaw00.mh:YAW00_DESCMODS defines which points
+    // use classic descriptors and which use HATs.
+
+    for (int i = 0; i < tab.nclassic; i++)
+        if (pinned.rows == 0 || !PointUsed(pinned, tab.classic_points[i]))
+            ClassicSearch_(shape, ilev, i, img, inshape);
+
+    for (int i = 0; i < tab.nhat; i++)
+        if (pinned.rows == 0 || !PointUsed(pinned, tab.hat_points[i]))
+            HatSearch_(shape, ilev, i, hatlev);
 }
 #endif // not _OPENMP
 
-void Mod::LevSearch_(         // do an ASM search at one level in the image pyr
+static double MeanPointMove( // mean distance between corresponding points
+    const Shape& shape,      // in
+    const Shape& prevshape)  // in
+{
+    CV_Assert(shape.rows == prevshape.rows && shape.rows > 0);
+    double sum = 0;
+    for (int i = 0; i < shape.rows; i++)
+        sum += sqrt(SQ(shape(i, IX) - prevshape(i, IX)) +
+                    SQ(shape(i, IY) - prevshape(i, IY)));
+    return sum / shape.rows;
+}
+
+int Mod::LevSearch_(          // do an ASM search at one level in the image pyr
     Shape&       shape,       // io: the face shape for this pyramid level
     int          ilev,        // in: pyramid level (0 is full size)
     const Image& img,         // in: image scaled to this pyramid level
-    const Shape& pinnedshape) // in: if no rows then no pinned landmarks, else
+    const Shape& pinnedshape, // in: if no rows then no pinned landmarks, else
                               //     points except those equal to 0,0 are pinned
-const
+    HatLevData&  hatlev,      // io: HAT data, inited for this pyr lev
+    double       convergedist)// in: see ModSearch_
+const                         // returns the number of iterations done
 {
     TraceShape(shape, img, ilev, 0, "enterlevsearch");
 
-    InitHatLevData(img, ilev); // init internal HAT mats for this lev
+    hatlev.Init_(img, ilev); // init internal HAT mats for this lev
 
     VEC b(NSIZE(shapemod_.eigvals_), 1, 0.); // eigvec weights, init to 0
 
-    for (int iter = 0; iter < SHAPEMODEL_ITERS; iter++)
+    int iter = 0;
+    while (iter < SHAPEMODEL_ITERS)
     {
+        const Shape prevshape(convergedist > 0? shape.clone(): Shape());
+
         // suggest shape by descriptor matching at each landmark
 
         SuggestShape_(shape,
-                      ilev, img, pinnedshape);
+                      ilev, img, pinnedshape, hatlev);
 
         TraceShape(shape, img, ilev, iter, "suggested");
 
@@ -207,21 +273,61 @@ const
                                                  shape, ilev);
 
         TraceShape(shape, img, ilev, iter, "conformed");
+
+        iter++;
+
+        // If the landmarks barely moved, further iterations would find
+        // (nearly) the same positions, so we are done at this level.
+        // This is common when the start shape is already close to the
+        // face (e.g. a warm start from the previous frame of a video).
+
+        if (convergedist > 0 && MeanPointMove(shape, prevshape) < convergedist)
+            break;
     }
+    return iter;
 }
 
-static void CreatePyr(    // create image pyramid
-    vector<Image>& pyr,   // out: the pyramid, pyr[0] is full size image
-    const Image&   img,   // in:  full size image
-    int            nlevs) // in
+Image& ImgPyr::Lev_(   // return header for the image at ilev, over bufs_[ilev]
+    int ilev,          // in: pyramid level (0 is full size)
+    int width,         // in
+    int height)        // in
+{
+    CV_Assert(width > 0 && height > 0);
+    vector<byte>& buf = bufs_[ilev];
+    if (int(buf.size()) < width * height)
+        buf.resize(width * height); // grows as needed, never shrinks
+    levs_[ilev] = Image(height, width, &buf[0]);
+    return levs_[ilev];
+}
+
+void ImgPyr::Init_(       // prescale img and build the pyramid
+    const Image& img,     // in: grayscale image (typically just ROI)
+    double       scale,   // in: scale img by this to get pyr lev 0
+    int          nlevs)   // in
 {
     CV_Assert(nlevs >= 1 && nlevs < 10); // 10 is arb
-    pyr.resize(nlevs);
-    pyr[0] = img;        // pyramid level 0 is full size image
+    if (int(levs_.size()) < nlevs) // keep the buffers of any unused levels
+    {
+        levs_.resize(nlevs);
+        bufs_.resize(nlevs);
+    }
+
+    // We give cv::resize a destination of exactly the size it will calculate
+    // from the scale factor, so it writes into our buffer instead of
+    // allocating a new one.  Each level is resized from level 0 and not from
+    // the level before it: the models were trained on pyramids made that way,
+    // and repeatedly halving gives smoother images that move the landmarks.
+
+    cv::resize(img, Lev_(0, cvRound(img.cols * scale), cvRound(img.rows * scale)),
+               cv::Size(), scale, scale, cv::INTER_LINEAR);
+
+    const Image& lev0 = levs_[0];
     for (int ilev = 1; ilev < nlevs; ilev++)
     {
-        const double scale = GetPyrScale(ilev);
-        cv::resize(img, pyr[ilev], cv::Size(), scale, scale, cv::INTER_LINEAR);
+        const double levscale = GetPyrScale(ilev);
+        cv::resize(lev0,
+                   Lev_(ilev, cvRound(lev0.cols * levscale), cvRound(lev0.rows * levscale)),
+                   cv::Size(), levscale, levscale, cv::INTER_LINEAR);
     }
 }
 
@@ -234,34 +340,52 @@ static double GetPrescale(   // factor to scale face to standard size prior to s
 Shape Mod::ModSearch_(            // returns coords of the facial landmarks
         const Shape& startshape,  // in: startshape roughly positioned on face
         const Image& img,         // in: grayscale image (typically just ROI)
-        const Shape* pinnedshape) // in: pinned landmarks, NULL if nothing pinned
+        ImgPyr&      pyr,         // io: caller's image pyramid, rebuilt for img
+        HatLevData&  hatlev,      // io: caller's HAT data, reinited at each pyr lev
+        double       convergedist,// in: 0 for SHAPEMODEL_ITERS iters at each pyr lev,
+                                  //     else stop a lev early when the mean landmark
+                                  //     movement is less than this (pixels at the lev)
+        int*         niters,      // out: iters done at each pyr lev, N_PYR_LEVS ints,
+                                  //     0 for levs skipped because of startlev
+        const Shape* pinnedshape, // in: pinned landmarks, NULL if nothing pinned
+        int          startlev)    // in: start search at this pyr lev, levels
+                                  //     coarser than this are skipped (used when
+                                  //     startshape is already close to the face)
 const
 {
-    Image scaledimg;         // image scaled to fixed eye-mouth distance
-    const double imgscale = GetPrescale(startshape);
+    CV_Assert(startlev >= 0 && startlev < N_PYR_LEVS);
 
-    // TODO This resize is quite slow (cv::INTER_NEAREST is even slower, why?).
-    cv::resize(img, scaledimg,
-               cv::Size(), imgscale, imgscale, cv::INTER_LINEAR);
+    // scale the image to a fixed eye-mouth distance, then build the pyramid
+    // (only down to startlev, we don't need the coarser levels)
 
-    TraceShape(startshape * imgscale, scaledimg, 0, -1, "start");
+    const double imgscale = GetPrescale(startshape);
+    pyr.Init_(img, imgscale, startlev + 1);
 
-    vector<Image> pyr;       // image pyramid (a vec of images, one for each pyr lev)
-    CreatePyr(pyr, scaledimg, N_PYR_LEVS);
+    TraceShape(startshape * imgscale, pyr[0], 0, -1, "start");
 
-    Shape shape(startshape * imgscale * GetPyrScale(N_PYR_LEVS));
+    Shape shape(startshape * imgscale * GetPyrScale(startlev + 1));
 
     Shape pinned;            // pinnedshape scaled to current pyr lev
     if (pinnedshape)
-        pinned = *pinnedshape * imgscale * GetPyrScale(N_PYR_LEVS);
+        pinned = *pinnedshape * imgscale * GetPyrScale(startlev + 1);
+
+    for (int ilev = 0; ilev < N_PYR_LEVS; ilev++)
+        niters[ilev] = 0;
 
-    for (int ilev = N_PYR_LEVS-1; ilev >= 0; ilev--)
+    for (int ilev = startlev; ilev >= 0; ilev--)
     {
         shape  *= PYR_RATIO; // scale shape to this pyr lev
         pinned *= PYR_RATIO;
 
-        LevSearch_(shape,
-                   ilev, pyr[ilev], pinned);
+        niters[ilev] = LevSearch_(shape,
+                                  ilev, pyr[ilev], pinned, hatlev, convergedist);
+    }
+    if (trace_g)
+    {
+        lprintf("[iters");
+        for (int ilev = N_PYR_LEVS-1; ilev >= 0; ilev--)
+            lprintf(" %d", niters[ilev]);
+        lprintf("] ");
     }
     return shape / imgscale;
 }
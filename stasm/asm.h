@@ -1,8 +1,9 @@
 // asm.h: Active Shape Model class
 //
 // Freeing memory: In the current implementation, explicit memory release
-// on Mod destruction is unneeded (because the MAT buffer pointers in Mod,
-// ShapeMod, and DescMod point to constant data).  If you add a new descriptor
+// on Mod destruction is unneeded (because the MAT buffer pointers in Mod and
+// ShapeMod, and the pointers in DescModTab, point to constant data, and the
+// MATs that Mod does allocate release themselves).  If you add a new descriptor
 // model, you may need to add destructors.  Although even if that new class
 // fails to release memory it's probably not serious, because the ASM
 // model(s) are only destructed once, at program termination.
@@ -21,6 +22,44 @@ static const double PYR_RATIO = 2;     // scale image by 2 at each pyramid level
 static const int N_PYR_LEVS = 4;       // number of levs in image pyramid
 
 static const int SHAPEMODEL_ITERS = 4; // shape model iterations per pyr level
+                                       // (the max, if the search may converge early)
+
+//-----------------------------------------------------------------------------
+
+// The image pyramid for an ASM search.  Level 0 is the image scaled to the
+// standard face size (EYEMOUTH_DIST), and each other level is made from
+// level 0.  Like HatLevData, this is owned by the caller (a stasm_ctx), so
+// the pixel buffers are reused across searches instead of reallocated.
+
+class ImgPyr
+{
+public:
+    void Init_(               // prescale img and build the pyramid
+        const Image& img,     // in: grayscale image (typically just ROI)
+        double       scale,   // in: scale img by this to get pyr lev 0
+        int          nlevs);  // in
+
+    const Image& operator[](  // return the image at the given pyr lev
+        int ilev)             // in: pyramid level (0 is full size)
+    const
+    {
+        return levs_[ilev];
+    }
+
+    ImgPyr() {}               // constructor
+
+private:
+    Image& Lev_(              // return header for the image at ilev, over bufs_[ilev]
+        int ilev,             // in: pyramid level (0 is full size)
+        int width,            // in
+        int height);          // in
+
+    vector<Image>          levs_; // one for each pyr lev, headers into bufs_
+    vector<vector<byte> >  bufs_; // pixel buffers, grow as needed, never shrink
+
+    DISALLOW_COPY_AND_ASSIGN(ImgPyr);
+
+}; // end class ImgPyr
 
 //-----------------------------------------------------------------------------
 
@@ -30,7 +69,14 @@ public:
     Shape ModSearch_(                  // returns coords of the facial landmarks
         const Shape& startshape,       // in: startshape roughly positioned on face
         const Image& img,              // in: grayscale image (typically just ROI)
-        const Shape* pinnedshape=NULL) // in: pinned landmarks, NULL if nothing pinned
+        ImgPyr&      pyr,              // io: caller's image pyramid, rebuilt for img
+        HatLevData&  hatlev,           // io: caller's HAT data, reinited at each pyr lev
+        double       convergedist,     // in: 0 for SHAPEMODEL_ITERS iters at each pyr lev,
+                                       //     else stop a lev early when the mean landmark
+                                       //     movement is less than this (pixels at the lev)
+        int*         niters,           // out: iters done at each pyr lev, N_PYR_LEVS ints
+        const Shape* pinnedshape=NULL, // in: pinned landmarks, NULL if nothing pinned
+        int          startlev=N_PYR_LEVS-1) // in: start search at this pyr lev
     const;
 
     const Shape ConformShapeToMod_Pinned_( // wrapper around the func in ShapeMod
@@ -48,28 +94,54 @@ public:
     const Shape  MeanShape_(void) const { return shapemod_.meanshape_; }
 
 private:
-    const vec_vec_BaseDescMod DescMods_(        // utility for Mod constructor
-        const BaseDescMod** const descmods_arg, // in: descriptor models
-        int                       ndescmods)    // in: sanity check
+    const vec_DescModTab DescModTabs_(         // utility for Mod constructor
+        const DescModTab* const desctabs_arg, // in: descriptor models
+        int                     ndesctabs)    // in: sanity check
     {
-        if (stasm_NLANDMARKS != ndescmods / N_PYR_LEVS) // sanity check
+        if (ndesctabs != N_PYR_LEVS) // sanity check
+            Err("ndesctabs %d != N_PYR_LEVS %d", ndesctabs, N_PYR_LEVS);
+
+        for (int ilev = 0; ilev < N_PYR_LEVS; ilev++)
         {
-            Err("stasm_NLANDMARKS != ndescmods / N_PYR_LEVS\n\n"
-                "    stasm_NLANDMARKS %d\n    ndescmods / N_PYR_LEVS %d\n"
-                "    ndescmods %d\n    N_PYR_LEVS %d",
-                stasm_NLANDMARKS, ndescmods / N_PYR_LEVS,
-                ndescmods, N_PYR_LEVS);
+            // check that each landmark is in exactly one of the two ranges
+
+            const DescModTab& tab = desctabs_arg[ilev];
+            CV_Assert(tab.nclassic + tab.nhat == stasm_NLANDMARKS);
+            vec_int npoint(stasm_NLANDMARKS, 0);
+            for (int i = 0; i < tab.nclassic + tab.nhat; i++)
+            {
+                const int ipoint = i < tab.nclassic?
+                    tab.classic_points[i]: tab.hat_points[i - tab.nclassic];
+                CV_Assert(ipoint >= 0 && ipoint < stasm_NLANDMARKS);
+                npoint[ipoint]++;
+            }
+            for (int ipoint = 0; ipoint < stasm_NLANDMARKS; ipoint++)
+                if (npoint[ipoint] != 1)
+                    Err("pyr lev %d point %d has %d descriptor models",
+                        ilev, ipoint, npoint[ipoint]);
         }
-        vec_vec_BaseDescMod descmods(N_PYR_LEVS);
+        return vec_DescModTab(desctabs_arg, desctabs_arg + ndesctabs);
+    }
 
+    const vector<MAT> CholCovis_(             // utility for Mod constructor
+        const DescModTab* const desctabs_arg) // in: descriptor models
+    {
+        // For each pyr lev, one row per classic point with the Cholesky
+        // factor of its covi.  We factor here, once, so ClassicDescSearch
+        // can take the Mahalanobis distance with a triangular multiply.
+
+        vector<MAT> cholcovis(N_PYR_LEVS);
         for (int ilev = 0; ilev < N_PYR_LEVS; ilev++)
         {
-            descmods[ilev].resize(stasm_NLANDMARKS);
-            for (int i = 0; i < stasm_NLANDMARKS; i++)
-                descmods[ilev][i] =
-                    descmods_arg[ilev * stasm_NLANDMARKS + i];
+            const DescModTab& tab = desctabs_arg[ilev];
+            const int proflen = tab.proflen;
+            cholcovis[ilev] = MAT(tab.nclassic, proflen * proflen);
+            for (int i = 0; i < tab.nclassic; i++)
+                CholeskyFactor(ArrayAsMat(proflen, proflen,
+                                          tab.classic_covis + i * proflen * proflen)).
+                    reshape(1, 1).copyTo(cholcovis[ilev].row(i));
         }
-        return descmods;
+        return cholcovis;
     }
 
 public:
@@ -82,14 +154,15 @@ public:
         int                 neigs,
         double              bmax,
         unsigned            hackbits,
-        const BaseDescMod** descmods,
-        int                 ndescmods)
+        const DescModTab*   desctabs,
+        int                 ndesctabs)
 
         : eyaw_(eyaw),
           estart_(estart),
           datadir_(datadir),
           shapemod_(meanshape, eigvals, eigvecs, neigs, bmax, hackbits),
-          descmods_(DescMods_(descmods, ndescmods))
+          desctabs_(DescModTabs_(desctabs, ndesctabs)),
+          cholcovis_(CholCovis_(desctabs))
     {
         CV_Assert(eyaw == EYAW_45 || eyaw == EYAW_22 || eyaw == EYAW00 ||
                   eyaw == EYAW22  || eyaw == EYAW45);
@@ -111,25 +184,47 @@ private: // all data remains constant after Mod construction
 
     const ShapeMod shapemod_; // the shape model
 
-    const vec_vec_BaseDescMod descmods_;
-                              // descriptor mods, one for each point at each pyr lev
-                              // index as [ilev][ipoint]
+    const vec_DescModTab desctabs_;
+                              // descriptor mods for all points at each pyr lev
+                              // index as [ilev]
+
+    const vector<MAT> cholcovis_;
+                              // Cholesky factors of desctabs_[ilev].classic_covis
+                              // index as [ilev], one row for each classic point
+
+    void ClassicSearch_(      // search with the classic desc of a point
+        Shape&       shape,   // io: the point will be moved to best desc match
+        int          ilev,    // in: pyramid level (0 is full size)
+        int          i,       // in: index into desctabs_[ilev] classic points
+        const Image& img,     // in: image scaled to this pyramid level
+        const Shape& inshape) // in: shape before any points were moved
+    const;
+
+    void HatSearch_(          // search with the HAT desc of a point
+        Shape&       shape,   // io: the point will be moved to best desc match
+        int          ilev,    // in: pyramid level (0 is full size)
+        int          i,       // in: index into desctabs_[ilev] HAT points
+        HatLevData&  hatlev)  // io: HAT data for this pyr lev
+    const;
 
     void SuggestShape_(
         Shape&       shape,   // io: points will be moved to give best desc matches
         int          ilev,    // in: pyramid level (0 is full size)
         const Image& img,     // in: image scaled to this pyramid level
-        const Shape& pinned)  // in: if no rows then no pinned landmarks, else
+        const Shape& pinned,  // in: if no rows then no pinned landmarks, else
                               //     points except those equal to 0,0 are pinned
+        HatLevData&  hatlev)  // io: HAT data for this pyr lev
     const;
 
-    void LevSearch_(              // do an ASM search at one level in the image pyr
+    int LevSearch_(               // do an ASM search at one level in the image pyr
         Shape&       shape,       // io: the face shape for this pyramid level
         int          ilev,        // in: pyramid level (0 is full size)
         const Image& img,         // in: image scaled to this pyramid level
-        const Shape& pinnedshape) // in: if no rows then no pinned landmarks, else
+        const Shape& pinnedshape, // in: if no rows then no pinned landmarks, else
                                   //     points except those equal to 0,0 are pinned
-    const;
+        HatLevData&  hatlev,      // io: HAT data, inited for this pyr lev
+        double       convergedist)// in: see ModSearch_
+    const;                        // returns the number of iterations done
 
     DISALLOW_COPY_AND_ASSIGN(Mod);
 
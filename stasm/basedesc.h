@@ -1,28 +1,32 @@
-// basedesc.h: descriptor model base class
+// basedesc.h: descriptor model tables
 //
 // A "descriptor model" tells you how to use the given
 // descriptor to suggest the best position of a landscape.
 //
-// Stasm currently uses two types of descriptors, and thus two descriptor
-// model classes: ClassicDescMod and HatDescMod.  Each of these classes
-// provide a descriptor matching function, DescSearch_, which searches around
-// the current position of a landmark, looking for the best new position.
+// Stasm currently uses two types of descriptors: classic 1D profiles
+// (classicdesc.cpp) and HATs (hatdesc.cpp).  Each point at each pyramid
+// level uses one or the other.
 //
-// About BaseDescMod: We need a vector of descriptor models to specify how
-// to search by matching against a descriptor at each landmark.  Some
-// landmarks use ClassicDescMods; other use HatDescMods.  We thus need a
-// vector of heterogeneous objects.  But C++ doesn't support vectors of
-// heterogeneous objects.  So instead we use a vector of pointers to
-// BaseDescMod, with the actual descriptor model classes (ClassicDescMod
-// and HatDescMod) deriving from BaseDescMod.
+// About DescModTab: The descriptor models for one pyramid level are packed
+// into a DescModTab, with the points that use classic descriptors in one
+// range and the points that use HATs in another.  Within each range the
+// model data is in contiguous arrays with one row per point (for example,
+// all the mean profiles are together, followed by all the inverse
+// covariance matrices).  So Mod::SuggestShape_ loops over two homogeneous
+// ranges and calls ClassicDescSearch or HatDescSearch directly.  (Stasm 4.0
+// instead used a vector of pointers to BaseDescMod objects, one per point,
+// and dispatched each search through a virtual function.)
 //
 // Memory release: Explicit destructors unneeded, see note in header of asm.h.
 //
-// DescSearch_ and concurrency: If OpenMP is enabled, DescSearch_ will be
-// called concurrently for multiple points.  (Each call will have a
-// different value of x and y.)  Thus for the OpenMP code to work
-// correctly, DescSearch_ and its callees must not modify any variables that
-// are not on the stack unless the variable is protected by a critical region.
+// Searches and concurrency: If OpenMP is enabled, ClassicDescSearch and
+// HatDescSearch will be called concurrently for multiple points.  (Each
+// call will have a different value of x and y.)  Thus for the OpenMP code
+// to work correctly, these functions and their callees must not modify
+// any variables that are not on the stack unless the variable is protected
+// by a critical region.  The only such variable is the HAT descriptor cache
+// in the HatLevData, which belongs to the caller's stasm_ctx (not to the
+// model).
 //
 // Copyright (C) 2005-2013, Stephen Milborrow
 
@@ -31,25 +35,22 @@
 
 namespace stasm
 {
-class BaseDescMod // abstract base class for all descriptor models
-{
-public:
-    virtual void DescSearch_( // search in area around the current point
-        double&      x,       // io: (in: old posn of landmark, out: new posn)
-        double&      y,       // io
-        const Image& img,     // in: image scaled to this pyramid level
-        const Shape& shape,   // in: current position of the landmarks
-        int          ilev,    // in: pyramid level (0 is full size)
-        int          ipoint)  // in: index of the current landmark
-    const = 0;
+struct DescModTab       // descriptor models for all points at one pyr lev
+{                       // (the pointers are to constant data in the .mh files)
+    int           proflen;        // length of the classic profiles
 
-    virtual ~BaseDescMod() {} // destructor
-};
+    int           nclassic;       // number of points that use classic descs
+    const int*    classic_points; // nclassic point indices
+    const double* classic_profs;  // nclassic mean profiles, proflen elems each
+    const double* classic_covis;  // nclassic inverse covars, proflen^2 elems each
 
-// vec_vec_BaseDescMod contains the descriptor models, one pointer
-// for each landmark at each pyramid level, index as [ilev][ipoint]
+    int           nhat;           // number of points that use HAT descs
+    const int*    hat_points;     // nhat point indices
+    const double* hat_intercepts; // nhat linear model intercepts
+    const double* hat_coefs;      // nhat linear models, HAT_DESC_LEN coefs each
+};
 
-typedef vector<vector<const BaseDescMod*> > vec_vec_BaseDescMod;
+typedef vector<DescModTab> vec_DescModTab; // index as [ilev]
 
 } // namespace stasm
 #endif // STASM_BASEDESC_H
@@ -17,38 +17,45 @@
 
 namespace stasm
 {
-static void NormalizeMat(
-    MAT&   mat)            // io: normalized so L2 length is 1
+static void Normalize2(   // normalize x,y so L2 length is 1
+    double& x,           // io
+    double& y)           // io
 {
-    double norm = cv::norm(mat); // L2 norm
+    const double norm = sqrt(SQ(x) + SQ(y)); // L2 norm
     if (!IsZero(norm))
-        mat /= norm;
+    {
+        x /= norm;
+        y /= norm;
+    }
 }
 
-static const VEC Bisector( // return normalized bisector of three ordered points
-    const VEC& prev,       // in: x,y coords of previous point (1x2 matrix)
-    const VEC& point,      // in
-    const VEC& next)       // in
+static void Bisector(      // get normalized bisector of three ordered points
+    double&      wx,       // out: x coord of direction of the bisector
+    double&      wy,       // out: y coord of direction of the bisector
+    const Shape& shape,    // in
+    int          prev,     // in: index of previous point
+    int          ipoint,   // in
+    int          next)     // in
 {
-    VEC u(1, 2);              // u is point - prev, rotated by 90 degrees
-    u(IX) = point(IY) - prev(IY);
-    u(IY) = prev(IX) - point(IX);
-    NormalizeMat(u);
+    double ux = shape(ipoint, IY) - shape(prev, IY); // u is point - prev,
+    double uy = shape(prev, IX) - shape(ipoint, IX); // rotated by 90 degrees
+    Normalize2(ux, uy);
 
-    VEC v(1, 2);              // v is next - point, rotated by 90 degrees
-    v(IX) = next(IY) - point(IY);
-    v(IY) = point(IX) - next(IX);
-    NormalizeMat(v);
+    double vx = shape(next, IY) - shape(ipoint, IY); // v is next - point,
+    double vy = shape(ipoint, IX) - shape(next, IX); // rotated by 90 degrees
+    Normalize2(vx, vy);
 
-    VEC w(u + v); NormalizeMat(w);
+    wx = ux + vx;
+    wy = uy + vy;
+    Normalize2(wx, wy);
 
     // are prev and next in the same line? if so, avoid numerical issues
-    if (IsZero(w(IX)) && IsZero(w(IY)))
+    if (IsZero(wx) && IsZero(wy))
     {
-        w = point - prev;
-        NormalizeMat(w);
+        wx = shape(ipoint, IX) - shape(prev, IX);
+        wy = shape(ipoint, IY) - shape(prev, IY);
+        Normalize2(wx, wy);
     }
-    return w; // w is the direction of the bisector
 }
 
 // get x and y distances to take a single pixel step along the whisker
@@ -76,11 +83,9 @@ static void WhiskerStep(
     }
     else
     {
-        const VEC whisker_direction(Bisector(shape.row(prev),
-                                             shape.row(ipoint),
-                                             shape.row(next)));
-        xstep = -whisker_direction(IX);
-        ystep = -whisker_direction(IY);
+        Bisector(xstep, ystep, shape, prev, ipoint, next);
+        xstep = -xstep;
+        ystep = -ystep;
 
         // normalize so either xstep or ystep will be +-1,
         // and the other will be smaller than +-1
@@ -119,9 +124,34 @@ static inline int Pix( // get pixel at ix and iy, forcing ix and iy in range
 // fullprof is the 1D profile along the whisker, including extra elements
 // to allow searching away from the current position of the landmark.
 //
-// shape[ipoint] is the current position of the landmark,
+// x,y is the current position of the landmark,
 // and the center point of the whisker.
-// We also use shape for figuring out the direction of the whisker.
+
+static void GetFullProf(      // get full profile into the caller's buffer
+    double*      fullprof,    // out: fullproflen elements
+    const Image& img,         // in
+    double       x,           // in: center point of the whisker
+    double       y,           // in
+    double       xstep,       // in: x axis dist of one pixel along whisker
+    double       ystep,       // in
+    int          fullproflen) // in
+{
+    // number of pixs to sample in each direction along the whisker
+    const int n = (fullproflen - 1) / 2;
+
+    int prevpix = Pix(img,
+                      Step(x, xstep, -n-1), Step(y, ystep, -n-1));
+
+    for (int i = -n; i <= n; i++)
+    {
+        const int pix = Pix(img,
+                            Step(x, xstep, i), Step(y, ystep, i));
+        fullprof[i + n] = double(pix - prevpix); // signed gradient
+        prevpix = pix;
+    }
+}
+
+// We use shape for figuring out the direction of the whisker.
 
 static VEC FullProf(          // return full profile
     const Image& img,         // in
@@ -138,22 +168,9 @@ static VEC FullProf(          // return full profile
     double ystep;
     WhiskerStep(xstep, ystep, shape, ipoint);
 
-    const double x = shape(ipoint, IX); // center point of the whisker
-    const double y = shape(ipoint, IY);
-
-    // number of pixs to sample in each direction along the whisker
-    const int n = (NSIZE(fullprof) - 1) / 2;
+    GetFullProf(Buf(fullprof), img,
+                shape(ipoint, IX), shape(ipoint, IY), xstep, ystep, fullproflen);
 
-    int prevpix = Pix(img,
-                      Step(x, xstep, -n-1), Step(y, ystep, -n-1));
-
-    for (int i = -n; i <= n; i++)
-    {
-        const int pix = Pix(img,
-                            Step(x, xstep, i), Step(y, ystep, i));
-        fullprof(i + n) = double(pix - prevpix); // signed gradient
-        prevpix = pix;
-    }
     return fullprof;
 }
 
@@ -203,65 +220,51 @@ VEC ClassicProf(           // currently used only when training a new model
     return SubProf(0, proflen, FullProf(img, inshape, ipoint, proflen));
 }
 
-// This returns a double equal to x.t() * mat * x.
-//
-// x is a vector (row or column, it doesn't matter).
-//
-// mat is assumed to be a symmetric matrix
-// (but only the upper right triangle of mat is actually used).
-//
-// mat and x are not modified.
-//
-// This function is equivalent to x.t() * mat * x(), but is optimized
-// for speed and is faster.  It's faster because we use the fact that
-// mat is symmetric to roughly halve the number of operations.
+// Cholesky decomposition.  We use this at model initialization so
+// that in the search the Mahalanobis distance x.t() * covi * x is
+// the squared length of U * x (a triangular multiply).
 
-static double xAx(
-    const VEC& x,   // in
-    const MAT& mat) //in: must be symmetric
+MAT CholeskyFactor(        // return upper triangular U such that U.t() * U == mat
+    const MAT& mat)        // in: must be symmetric positive definite
 {
-    const int n = NSIZE(x);
-    CV_Assert(mat.rows == n && mat.cols == n && x.isContinuous());
-    const double* px = Buf(x);
-    double diagsum = 0, sum = 0;
-    int i = n;
-    while (i--)
+    const int n = mat.rows;
+    CV_Assert(mat.cols == n);
+    MAT u(n, n, 0.);
+    for (int i = 0; i < n; i++)
     {
-        const double xi = px[i];
-        const double* const rowbuf = mat.ptr<double>(i);
-        diagsum += rowbuf[i] * SQ(xi);    // sum diag elements
-        for (int j = i+1; j < n; j++)     // sum upper right triangle elements
-            sum += rowbuf[j] * xi * px[j];
+        double diag = mat(i, i);
+        for (int k = 0; k < i; k++)
+            diag -= SQ(u(k, i));
+        CV_Assert(diag > 0);                 // positive definite?
+        u(i, i) = sqrt(diag);
+        for (int j = i+1; j < n; j++)
+        {
+            double sum = mat(i, j);
+            for (int k = 0; k < i; k++)
+                sum -= u(k, i) * u(k, j);
+            u(i, j) = sum / u(i, i);
+        }
     }
-    return diagsum + 2 * sum; // "2 *" to include lower left triangle elements
+    return u;
 }
 
-// If OpenMP is enabled, multiple instances of this function will be called
-// concurrently (each call will have a different value of x and y). Thus this
-// function and its callees do not modify any data that is not on the stack.
-
-void ClassicDescSearch(    // search along whisker for best profile match
-    double&      x,        // io: (in: old posn of landmark, out: new posn)
-    double&      y,        // io:
-    const Image& img,      // in: the image scaled to this pyramid level
-    const Shape& inshape,  // in: current posn of landmarks (for whisker directions)
-    int          ipoint,   // in: index of the current landmark
-    const MAT&   meanprof, // in: mean of the training profiles for this point
-    const MAT&   covi)     // in: inverse of the covar of the training profiles
-{
-    const int proflen = NSIZE(meanprof);
-    CV_Assert(proflen % 2 == 1); // proflen must be odd in this implementation
-
-    // fullprof is the 1D profile along the whisker including the extra
-    // elements to allow search +-CLASSIC_MAX_OFFSET pixels away from
-    // the current position of the landmark.
-    // We precalculate the fullprof for efficiency in the for loop below.
+// Move along the whisker looking for the best match.  The profile at
+// each offset is normalized and compared to meanprof in place in fullprof
+// (no copies and nothing on the heap).
+//
+// N is the profile length.  If N is 0 it is taken from proflen at run
+// time, which is slower because the compiler can't unroll the loops.
 
-    const int fullproflen = proflen + 2 * CLASSIC_MAX_OFFSET;
-    CV_Assert(fullproflen % 2 == 1); // fullprof length must be odd
-    const VEC fullprof(FullProf(img, inshape, ipoint, fullproflen));
+static const int MAX_PROFLEN = 99;
 
-    // move along the whisker looking for the best match
+template <int N>
+static int BestOffset(         // return the offset of best profile match
+    const double* fullprof,    // in: profile with CLASSIC_MAX_OFFSET extra elems each side
+    const double* meanprof,    // in: mean of the training profiles for this point
+    const double* cholcovi,    // in: Cholesky factor of the covi, see CholeskyFactor
+    int           proflen)     // in: used only if N is 0
+{
+    const int n = N? N: proflen;
 
     int bestoffset = 0;
     double mindist = FLT_MAX;
@@ -269,29 +272,81 @@ void ClassicDescSearch(    // search along whisker for best profile match
              offset <= CLASSIC_MAX_OFFSET;
              offset += CLASSIC_SEARCH_RESOL)
     {
-        // Get the profile distance.  That is,  get the image profile at the given
+        // Get the profile distance.  That is, get the image profile at the given
         // offset along the whisker, and return the Mahalanobis distance between
         // it and the model mean profile.  Low distance means good fit.
 
-        const VEC prof(SubProf(offset, proflen, fullprof));
+        const double* const prof = fullprof + CLASSIC_MAX_OFFSET + offset;
 
-        // The following code is equivalent to
-        //      dist = (prof - meanprof).t() * covi * (prof - meanprof)
-        // but is optimized for speed.
+        double sum = 0;            // normalize prof as SubProf does
+        for (int i = 0; i < n; i++)
+            sum += ABS(prof[i]);
+        const double scale = IsZero(sum)? 1: n / sum;
 
-        prof -= meanprof;      // for efficiency, use "-=" not "=" with "-"
-        const double dist = xAx(prof, covi);
+        double diff[N? N: MAX_PROFLEN]; // prof - meanprof
+        for (int i = 0; i < n; i++)
+            diff[i] = prof[i] * scale - meanprof[i];
 
+        // The following code is equivalent to
+        //      dist = diff.t() * covi * diff
+        // but is optimized for speed (covi = U.t() * U, U is upper triangular).
+
+        double dist = 0;
+        for (int i = 0; i < n; i++)
+        {
+            const double* const row = cholcovi + i * n;
+            double ui = 0;         // element i of U * diff
+            for (int j = i; j < n; j++)
+                ui += row[j] * diff[j];
+            dist += SQ(ui);
+        }
         if (dist < mindist)
         {
             mindist = dist;
             bestoffset = offset;
         }
     }
-    // change x,y to the best position along the whisker
+    return bestoffset;
+}
+
+// If OpenMP is enabled, multiple instances of this function will be called
+// concurrently (each call will have a different value of x and y). Thus this
+// function and its callees do not modify any data that is not on the stack.
 
-    double xstep, ystep;
+void ClassicDescSearch(     // search along whisker for best profile match
+    double&       x,        // io: (in: old posn of landmark, out: new posn)
+    double&       y,        // io:
+    const Image&  img,      // in: the image scaled to this pyramid level
+    const Shape&  inshape,  // in: current posn of landmarks (for whisker directions)
+    int           ipoint,   // in: index of the current landmark
+    const double* meanprof, // in: mean of the training profiles for this point
+    const double* cholcovi, // in: Cholesky factor of the inverse of the covar
+                            //     of the training profiles, proflen x proflen
+    int           proflen)  // in
+{
+    CV_Assert(proflen % 2 == 1); // proflen must be odd in this implementation
+    CV_Assert(proflen > 1 && proflen <= MAX_PROFLEN);
+
+    double xstep, ystep; // dist corresponding to one pixel along whisker
     WhiskerStep(xstep, ystep, inshape, ipoint);
+
+    // fullprof is the 1D profile along the whisker including the extra
+    // elements to allow search +-CLASSIC_MAX_OFFSET pixels away from
+    // the current position of the landmark.
+    // We precalculate the fullprof for efficiency in BestOffset.
+
+    const int fullproflen = proflen + 2 * CLASSIC_MAX_OFFSET;
+    CV_Assert(fullproflen % 2 == 1); // fullprof length must be odd
+    double fullprof[MAX_PROFLEN + 2 * CLASSIC_MAX_OFFSET];
+    GetFullProf(fullprof, img,
+                inshape(ipoint, IX), inshape(ipoint, IY), xstep, ystep, fullproflen);
+
+    const int bestoffset = proflen == CLASSIC_PROFLEN?
+        BestOffset<CLASSIC_PROFLEN>(fullprof, meanprof, cholcovi, proflen):
+        BestOffset<0>(fullprof, meanprof, cholcovi, proflen);
+
+    // change x,y to the best position along the whisker
+
     x = inshape(ipoint, IX) + (bestoffset * xstep);
     y = inshape(ipoint, IY) + (bestoffset * ystep);
 }
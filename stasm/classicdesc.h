@@ -10,14 +10,20 @@ namespace stasm
 static const int CLASSIC_MAX_OFFSET = 2;   // search +-2 pixels along the whisker
 static const int CLASSIC_SEARCH_RESOL = 2; // search resolution, every 2nd pix
 
-void ClassicDescSearch(    // search along whisker for best profile match
-    double&      x,        // io: (in: current posn of the point, out: new posn)
-    double&      y,        // io:
-    const Image& img,      // in: the image scaled to this pyramid level
-    const Shape& inshape,  // in: current posn of landmarks (for whisker directions)
-    int          ipoint,   // in: index of the current landmark
-    const MAT&   meanprof, // in: mean of the training profiles for this point
-    const MAT&   covi);    // in: inverse of the covar of the training profiles
+static const int CLASSIC_PROFLEN = 9;      // TASM_1D_PROFLEN, the profile length in
+                                           // the current models (the search is
+                                           // specialized for this length)
+
+void ClassicDescSearch(     // search along whisker for best profile match
+    double&       x,        // io: (in: current posn of the point, out: new posn)
+    double&       y,        // io:
+    const Image&  img,      // in: the image scaled to this pyramid level
+    const Shape&  inshape,  // in: current posn of landmarks (for whisker directions)
+    int           ipoint,   // in: index of the current landmark
+    const double* meanprof, // in: mean of the training profiles for this point
+    const double* cholcovi, // in: Cholesky factor of the inverse of the covar
+                            //     of the training profiles, proflen x proflen
+    int           proflen); // in
 
 VEC ClassicProf(           // used only during training a new model
     const Image& img,      // in: the image scaled to this pyramid level
@@ -25,35 +31,8 @@ VEC ClassicProf(           // used only during training a new model
     int          ipoint,   // in: index of the current landmark
     int          proflen); // in
 
-class ClassicDescMod: public BaseDescMod
-{
-public:
-    virtual void DescSearch_(double& x, double& y,                 // io
-                             const Image& img, const Shape& shape, // in
-                             int, int ipoint) const                // in
-    {
-        ClassicDescSearch(x, y,
-                          img, shape, ipoint, meanprof_, covi_);
-    }
-
-    ClassicDescMod(                          // constructor
-        int                 profwidth,
-        const double* const meanprof_data,
-        const double* const covi_data)
-
-        : meanprof_(ArrayAsMat(1, profwidth, meanprof_data)),
-          covi_(ArrayAsMat(profwidth, profwidth, covi_data))
-    {
-    }
-
-private:
-    const MAT meanprof_; // mean of the training profiles for this point
-    const MAT covi_;     // inverse of the covariance of the training profiles
-
-    DISALLOW_COPY_AND_ASSIGN(ClassicDescMod);
-
-}; // end class ClassicDescMod
-
+MAT CholeskyFactor(        // return upper triangular U such that U.t() * U == mat
+    const MAT& mat);       // in: must be symmetric positive definite
 
 } // namespace stasm
 #endif // STASM_CLASSICDESC_H
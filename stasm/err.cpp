@@ -23,6 +23,12 @@
 // by "stasm_") use try blocks internally, and code that calls
 // them doesn't have to worry about the above exception.
 //
+// Concurrency: The error message is per thread, so searches with different
+// stasm_ctx's can run in different threads.  (Each stasm_ctx also keeps a
+// copy of its last error for stasm_ctx_lasterr.)  OpenCV's error callback is
+// process wide, so it is installed by the first CatchOpenCvErrs and restored
+// by the matching last UncatchOpenCvErrs, whatever thread those are in.
+//
 // Copyright (C) 2005-2013, Stephen Milborrow
 
 #include "stasm.h"
@@ -37,11 +43,13 @@
 
 namespace stasm
 {
-static char err_g[SBIG]; // err msg saved for retrieval by LastErr and stasm_lasterr
+static thread_local char err_g[SBIG]; // err msg saved for LastErr and stasm_lasterr
+
+static cv::Mutex errmutex_g;          // protects prev_g and ncatch_g
 
-static vector<cv::ErrorCallback> stack_g(10); // stack of err handlers, 10 is generous
+static cv::ErrorCallback prev_g;      // err handler active before first CatchOpenCvErrs
 
-static int istack_g;                          // index into stack_g
+static int ncatch_g;                  // nbr of CatchOpenCvErrs without an Uncatch
 
 //-----------------------------------------------------------------------------
 
@@ -95,17 +103,19 @@ static int CV_CDECL CvErrorCallbackForStasm(
 void CatchOpenCvErrs(void) // makes CV_Assert work with LastErr and stasm_lasterr
 {
     err_g[0] = 0;
-    cv::ErrorCallback prev = cv::redirectError(CvErrorCallbackForStasm);
-    if (istack_g < NSIZE(stack_g))
-        stack_g[istack_g++] = prev;
-    else // should never get here (CatchErr regions nested too deeply)
-        printf("\nCallback stack overpush\n");
+    cv::AutoLock lock(errmutex_g);
+    if (ncatch_g++ == 0)
+        prev_g = cv::redirectError(CvErrorCallbackForStasm);
 }
 
 void UncatchOpenCvErrs(void) // restore handler that was active before CatchOpenCvErrs
 {
-    if (istack_g > 0)
-        cv::redirectError(stack_g[--istack_g]);
+    cv::AutoLock lock(errmutex_g);
+    if (ncatch_g > 0)
+    {
+        if (--ncatch_g == 0)
+            cv::redirectError(prev_g);
+    }
     else // should never get here (call to UncatchErr without matching CatchErr)
         printf("\nCallback stack overpop\n");
 }
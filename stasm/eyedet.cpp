@@ -17,6 +17,10 @@ static cv::CascadeClassifier leye_det_g;  // left eye detector
 static cv::CascadeClassifier reye_det_g;  // right eye detector
 static cv::CascadeClassifier mouth_det_g; // mouth detector
 
+// The above detectors are shared by all stasm_ctx's but detectMultiScale
+// isn't reentrant, so we serialize the (small) eye and mouth searches.
+static cv::Mutex detmutex_g;
+
 //-----------------------------------------------------------------------------
 
 // Return the region of the face we search for the left or right eye.
@@ -284,6 +288,8 @@ static void DetectAllEyes(
 
     const Rect left_searchrect(EyeSearchRect(eyaw, facerect, false));
 
+    cv::AutoLock lock(detmutex_g);
+
     if (left_searchrect.width)
         leyes = Detect(img, leye_det_g, &left_searchrect,
                        EYE_SCALE_FACTOR, EYE_MIN_NEIGHBORS, EYE_DETECTOR_FLAGS,
@@ -309,6 +315,7 @@ static void DetectAllMouths(
     static const int    MOUTH_MIN_NEIGHBORS  = 5;   // less false pos with 5 than 3
     static const int    MOUTH_DETECTOR_FLAGS = 0;
 
+    cv::AutoLock lock(detmutex_g);
     mouths =
         Detect(img, mouth_det_g, &mouth_searchrect,
                MOUTH_SCALE_FACTOR, MOUTH_MIN_NEIGHBORS, MOUTH_DETECTOR_FLAGS,
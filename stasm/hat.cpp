@@ -15,6 +15,24 @@
 #include <opencv2/video/tracking.hpp>
 #include "opencv/highgui.h"
 
+#include <thread>
+
+// The AVX2 kernels below are compiled on any x86 target (with gcc and clang
+// via the target attribute, so no special compiler flags are needed) but
+// are only called if the CPU supports AVX2 and FMA (checked at run time).
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+    #define STASM_AVX2 1
+    #include <immintrin.h>
+    #if defined(__GNUC__)
+        #define AVX2_FUNC __attribute__((target("avx2,fma")))
+    #else
+        #define AVX2_FUNC
+    #endif
+#else
+    #define STASM_AVX2 0
+#endif
+
 namespace stasm
 {
 static const int GRIDHEIGHT = 4;       // 4 x 5 grid of histograms in descriptor
@@ -27,55 +45,128 @@ static const double WINDOW_SIGMA = .5; // gaussian window as frac of patch width
 
 static const double FINAL_SCALE = 10;  // arb but 10 is good for %g printing of descriptors
 
-// Get gradient magnitude and orientation of pixels in given img.
-// We use a [1,-1] convolution mask rather than [1,0,-1] because it gives as good
-// Stasm results and doesn't "waste" pixels on the left and top image boundary.
-// Before scaling by bins_per_degree, orientations are from 0 to 359.99...
-// degrees, with 0 being due east, and anticlockwise increasing.
+static const int NHISTBINS =           // see HistIndex
+    (1 + GRIDHEIGHT + 1) * (1 + GRIDWIDTH + 1) * (BINS_PER_HIST + 1);
+
+static const int NPIX_ON_STACK = 19 * 19; // patches up to 19 x 19 need no heap
+
+static const int TILE_SIZE = 32;       // grads are calculated in 32 x 32 pixel tiles
+
+static const unsigned char TILE_EMPTY   = 0; // values of Hat::tileflags_
+static const unsigned char TILE_FILLING = 1; // a thread is calculating the grads
+static const unsigned char TILE_FULL    = 2; // grads in the tile are valid
 
-static void InitGradMagAndOrientMats(
-    MAT&         magmat,    // out: grad mag mat
-    MAT&         orientmat, // out: grad ori mat
-    const Image& img)       // in:  ROI scaled to current pyramid level
+static_assert(HAT_DESC_LEN == GRIDHEIGHT * GRIDWIDTH * BINS_PER_HIST,
+              "HAT_DESC_LEN in hat.h does not match the HAT grid");
+
+static_assert(HAT_DESC_LEN % 8 == 0, "AVX2 kernels assume 8 floats per step");
+
+static bool UseAvx2(void) // true if we should call the AVX2 kernels
 {
-    const int nrows = img.rows, nrows1 = img.rows-1;
-    const int ncols = img.cols, ncols1 = img.cols-1;
-    const double bins_per_degree = BINS_PER_HIST / 360.;
+#if STASM_AVX2
+    static const bool avx2 = cv::checkHardwareSupport(CV_CPU_AVX2) &&
+                             cv::checkHardwareSupport(CV_CPU_FMA3);
+    return avx2 && cv::useOptimized(); // cv::setUseOptimized(false) forces scalar
+#else
+    return false;
+#endif
+}
+
+// Fast atan2 for the orientation bins.  A polynomial approximation of
+// atan on [0,1] is extended to all four quadrants.  The max error is about
+// 2e-6 radians, negligible against the 45 degree orientation bins.  The
+// quadrants are unfolded in bin units so the axis and diagonal directions
+// fall exactly on a bin boundary, as they did with atan2 in doubles.
+// (Else sqrt in NormalizeDesc would magnify the tiny spill into the
+// neighboring bin.)
+
+static inline float OrientBin( // returns 0 <= orient < BINS_PER_HIST
+    const float y,             // in: ydelta
+    const float x)             // in: xdelta
+{
+    static const float BINS_PER_RAD = float(BINS_PER_HIST / (2 * 3.14159265358979323846));
+    static const float QUADRANT     = BINS_PER_HIST / 4.f;
+
+    const float ax = fabsf(x), ay = fabsf(y);
+    if (ax == 0 && ay == 0)
+        return 0;
+    const float z  = ax >= ay? ay / ax: ax / ay; // 0 <= z <= 1
+    const float z2 = z * z;
+    float orient = ax == ay? QUADRANT / 2: BINS_PER_RAD * // diagonals exact too
+        z * (.99997726f + z2 * (-.33262347f + z2 * (.19354346f +
+             z2 * (-.11643287f + z2 * (.05265332f - z2 * .01172120f)))));
+    if (ay > ax)
+        orient = QUADRANT - orient;
+    if (x < 0)
+        orient = 2 * QUADRANT - orient;
+    if (y < 0)
+        orient = 4 * QUADRANT - orient;
+    return orient < BINS_PER_HIST? orient: 0; // float may round up to 360 degrees
+}
 
-    magmat.create(nrows, ncols);
-    orientmat.create(nrows, ncols);
+// Get gradient magnitude and orientation of the pixels in a tile of img.
+// We use a [1,-1] convolution mask rather than [1,0,-1] because it gives as good
+// Stasm results and doesn't "waste" pixels on the left and top image boundary.
+// Orientations are from 0 to 359.99... degrees (before scaling to bins),
+// with 0 being due east, and anticlockwise increasing.
+
+static void InitGradMagAndOrientTile(
+    cv::Mat_<float>& magmat,    // io: grad mag mat, tile pixels are updated
+    cv::Mat_<float>& orientmat, // io: grad ori mat, tile pixels are updated
+    const Image&     img,       // in: ROI scaled to current pyramid level
+    const int        x0,        // in: tile is x0...x1-1, y0...y1-1
+    const int        y0,        // in
+    const int        x1,        // in
+    const int        y1)        // in
+{
+    const int nrows1 = img.rows-1;
+    const int ncols  = img.cols, ncols1 = img.cols-1;
 
-    for (int y = 0; y < nrows1; y++)
+    for (int y = y0; y < y1; y++)
     {
+        float* const magbuf    = (float*)(magmat.data)    + y * ncols;
+        float* const orientbuf = (float*)(orientmat.data) + y * ncols;
+
+        if (y == nrows1)           // bottom edge
+        {
+            for (int x = x0; x < x1; x++)
+                magbuf[x] = orientbuf[x] = 0;
+            continue;
+        }
         const byte* const buf    = (byte*)(img.data) + y     * ncols;
         const byte* const buf_x1 = (byte*)(img.data) + y     * ncols + 1;
         const byte* const buf_y1 = (byte*)(img.data) + (y+1) * ncols;
 
-        double* const magbuf    = Buf(magmat)    + y * ncols;
-        double* const orientbuf = Buf(orientmat) + y * ncols;
-
-        for (int x = 0; x < ncols1; x++)
+        const int xend = MIN(x1, ncols1);
+        for (int x = x0; x < xend; x++)
         {
-            const byte   pixel  = buf[x];
-            const double xdelta = buf_x1[x] - pixel;
-            const double ydelta = buf_y1[x] - pixel;
+            const byte  pixel  = buf[x];
+            const float xdelta = float(buf_x1[x] - pixel);
+            const float ydelta = float(buf_y1[x] - pixel);
 
-            magbuf[x] = sqrt(SQ(xdelta) + SQ(ydelta));
+            magbuf[x] = sqrtf(xdelta * xdelta + ydelta * ydelta);
 
-            double orient =
-                RadsToDegrees(atan2(ydelta, xdelta)); // -180 <= orient < 180
-            if (orient < 0)
-                orient += 360;                        // 0 <= orient < 360
-            orientbuf[x] = orient * bins_per_degree;  // 0 <= orient < BINS_PER_HIST
+            orientbuf[x] = OrientBin(ydelta, xdelta); // 0 <= orient < BINS_PER_HIST
         }
+        if (xend < x1)             // right edge
+            magbuf[ncols1] = orientbuf[ncols1] = 0;
     }
-    // fill bottom and right edges
-    magmat.row(nrows1) = 0;
-    magmat.col(ncols1) = 0;
-    orientmat.row(nrows1) = 0;
-    orientmat.col(ncols1) = 0;
 }
 
+// The dimension of histbins is 1+GRIDHEIGHT+1 by 1+GRIDWIDTH+1 by BINS_PER_HIST+1.
+// The extra bins are for fast trilinear accumulation (boundary checks unneeded).
+// The final bin in each histogram is for degrees greater than 360, needed as
+// degrees less than but near 360 get smeared out by trilinear interpolation.
+
+static inline int HistIndex(int row, int col, int iorient) // index into histbins
+{
+    return ((row+1) * (1+GRIDWIDTH+1) + (col+1)) * (BINS_PER_HIST+1) + iorient;
+}
+
+// Offsets from a pixel's first bin to the other bins it gets smeared into
+static const int NEXTCOL = BINS_PER_HIST + 1;
+static const int NEXTROW = (GRIDWIDTH + 2) * (BINS_PER_HIST + 1);
+
 // Init the indices which map a patch row,col to the corresponding
 // histogram grid row,col.  The mapping depends only on the image
 // patchwidth and the histogram GRIDHEIGHT and WIDTH.
@@ -86,20 +177,18 @@ static void InitGradMagAndOrientMats(
 // for this pixel are irow=-1 row_frac=0.5.
 
 static inline void InitIndices(
-    vec_int&    row_indices,    // out
-    vec_double& row_fracs,      // out
-    vec_int&    col_indices,    // out
-    vec_double& col_fracs,      // out
-    vec_double& pixelweights,   // out
+    vec_int&    hist_indices,   // out
+    vec_float&  row_fracs,      // out
+    vec_float&  col_fracs,      // out
+    vec_float&  pixelweights,   // out
     const int   patchwidth)     // in: in pixels
 {
     CV_Assert(patchwidth % 2 == 1); // patchwidth must be odd in this implementation
 
     const int npix = SQ(patchwidth); // number of pixels in image patch
 
-    row_indices.resize(npix);
+    hist_indices.resize(npix);
     row_fracs.resize(npix);
-    col_indices.resize(npix);
     col_fracs.resize(npix);
     pixelweights.resize(npix);
 
@@ -127,24 +216,68 @@ static inline void InitIndices(
 
         for (double patchcol = -halfpatchwidth; patchcol <= halfpatchwidth; patchcol++)
         {
-            row_indices[ipix] = irow;
-            row_fracs[ipix]   = row_frac;
-
             const double signed_col = patchcol * grid_cols_per_img_col;
             const double col        = signed_col + col_offset;
             const int icol          = int(floor(col));
 
-            col_indices[ipix] = icol;
-            col_fracs[ipix]   = col - icol;
+            hist_indices[ipix] = HistIndex(irow, icol, 0);
+            row_fracs[ipix]    = float(row_frac);
+            col_fracs[ipix]    = float(col - icol);
 
             pixelweights[ipix] = // TODO this weights col and row offsets equally
-                exp(weight * (SQ(signed_row) + SQ(signed_col)));
+                float(exp(weight * (SQ(signed_row) + SQ(signed_col))));
 
             ipix++;
         }
     }
 }
 
+// The same weights as InitIndices, factored into a row part and a col
+// part for GridDescs_.  This is possible because the gaussian window is
+// the product of a row and a col gaussian, and trilinear interpolation
+// across grid rows and cols is the product of a row and a col tent.
+//
+// kernels[i][patchrow] is the weight of the pixels in patchrow in grid row i
+// (likewise for cols).  It is zero outside patchrow=ranges[2*i]...ranges[2*i+1]-1.
+
+static void InitKernels(
+    vec_float& kernels,     // out: gridsize x patchwidth
+    vec_int&   ranges,      // out: gridsize begin,end pairs
+    const int  patchwidth,  // in: in pixels
+    const int  gridsize)    // in: GRIDHEIGHT or GRIDWIDTH
+{
+    const int halfpatchwidth = (patchwidth-1) / 2;
+
+    const double grid_per_img = gridsize / (patchwidth-1.);
+    const double offset = gridsize / 2. - .5; // see InitIndices header comment
+
+    const double weight = -1 / (WINDOW_SIGMA * GRIDHEIGHT * GRIDWIDTH );
+
+    kernels.assign(gridsize * patchwidth, 0.f);
+    ranges.resize(2 * gridsize);
+    for (int i = 0; i < gridsize; i++)
+    {
+        ranges[2 * i]     = patchwidth;
+        ranges[2 * i + 1] = 0;
+    }
+    for (int patchpos = 0; patchpos < patchwidth; patchpos++)
+    {
+        const double signed_pos = (patchpos - halfpatchwidth) * grid_per_img;
+        const double pos        = signed_pos + offset;
+        const int ipos          = int(floor(pos));
+        const double frac       = pos - ipos;
+        const double gauss      = exp(weight * SQ(signed_pos));
+
+        for (int i = MAX(ipos, 0); i <= MIN(ipos + 1, gridsize - 1); i++)
+        {
+            kernels[i * patchwidth + patchpos] =
+                float(i == ipos? gauss * (1 - frac): gauss * frac);
+            ranges[2 * i]     = MIN(ranges[2 * i], patchpos);
+            ranges[2 * i + 1] = patchpos + 1;
+        }
+    }
+}
+
 // Init the data that doesn't change unless the image, patch width, or
 // GRIDHEIGHT or WIDTH changes (i.e. for Stasm this must be called
 // once per pyramid lev).
@@ -155,10 +288,70 @@ void Hat::Init_(
 {
     patchwidth_ = patchwidth;
 
-    InitGradMagAndOrientMats(magmat_, orientmat_, img);
+    // The grads are calculated later by InitTiles_, just for the tiles
+    // that descriptors are actually requested for.  Landmark patches
+    // usually cover only a small part of the image.
 
-    InitIndices(row_indices_, row_fracs_, col_indices_, col_fracs_, pixelweights_,
+    img_ = img;
+    magmat_.create(img.rows, img.cols);
+    orientmat_.create(img.rows, img.cols);
+
+    ntilecols_ = (img.cols + TILE_SIZE - 1) / TILE_SIZE;
+    ntilerows_ = (img.rows + TILE_SIZE - 1) / TILE_SIZE;
+    const int ntiles = ntilecols_ * ntilerows_;
+
+    if (NSIZE(tileflags_) < ntiles)
+        vector<std::atomic<unsigned char> >(ntiles).swap(tileflags_); // all empty
+    else
+        for (int i = 0; i < ntiles; i++)
+            tileflags_[i].store(TILE_EMPTY, std::memory_order_relaxed);
+
+    InitIndices(hist_indices_, row_fracs_, col_fracs_, pixelweights_,
                 patchwidth_);
+
+    InitKernels(row_kernels_, row_kernel_ranges_, patchwidth_, GRIDHEIGHT);
+    InitKernels(col_kernels_, col_kernel_ranges_, patchwidth_, GRIDWIDTH);
+}
+
+// Make sure the grads are available for all image pixels in the given
+// rectangle.  Concurrent calls are safe: the first thread to get to a
+// tile fills it while other threads needing that tile wait for it
+// (tiles are small, so they won't wait long).
+
+void Hat::InitTiles_(      // calc grads of the tiles under the given rect
+    int x0, int y0,        // in: top left pixel (may be off image)
+    int x1, int y1)        // in: bottom right pixel (may be off image)
+const
+{
+    x0 = MAX(x0, 0); x1 = MIN(x1, img_.cols-1);
+    y0 = MAX(y0, 0); y1 = MIN(y1, img_.rows-1);
+    if (x0 > x1 || y0 > y1) // patch entirely off image
+        return;
+
+    for (int tilerow = y0 / TILE_SIZE; tilerow <= y1 / TILE_SIZE; tilerow++)
+        for (int tilecol = x0 / TILE_SIZE; tilecol <= x1 / TILE_SIZE; tilecol++)
+        {
+            std::atomic<unsigned char>& flag =
+                tileflags_[tilerow * ntilecols_ + tilecol];
+
+            unsigned char state = flag.load(std::memory_order_acquire);
+            if (state == TILE_FULL)
+                continue;
+            if (state == TILE_EMPTY &&
+                flag.compare_exchange_strong(state, TILE_FILLING,
+                                             std::memory_order_acquire))
+            {
+                const int tilex = tilecol * TILE_SIZE, tiley = tilerow * TILE_SIZE;
+                InitGradMagAndOrientTile(magmat_, orientmat_, img_,
+                    tilex, tiley,
+                    MIN(tilex + TILE_SIZE, img_.cols),
+                    MIN(tiley + TILE_SIZE, img_.rows));
+                flag.store(TILE_FULL, std::memory_order_release);
+                continue;
+            }
+            while (flag.load(std::memory_order_acquire) != TILE_FULL)
+                std::this_thread::yield(); // another thread is filling the tile
+        }
 }
 
 // Calculate the image patch gradient mags and orients.
@@ -166,21 +359,21 @@ void Hat::Init_(
 // to 0 and thus contributes nothing later in TrilinearAccumulate.
 
 static void GetMagsAndOrients_GeneralCase(
-    vec_double&       mags,         // out
-    vec_double&       orients,      // out
-    const int         ix,           // in: x coord of center of patch
-    const int         iy,           // in: y coord of center of patch
-    const int         patchwidth,   // in
-    const MAT&        magmat,       // in
-    const MAT&        orientmat,    // in
-    const vec_double& pixelweights) // in
+    float*                 mags,         // out
+    float*                 orients,      // out
+    const int              ix,           // in: x coord of center of patch
+    const int              iy,           // in: y coord of center of patch
+    const int              patchwidth,   // in
+    const cv::Mat_<float>& magmat,       // in
+    const cv::Mat_<float>& orientmat,    // in
+    const float*           pixelweights) // in
 {
     const int halfpatchwidth = (patchwidth-1) / 2;
     int ipix = 0;
     for (int x = iy - halfpatchwidth; x <= iy + halfpatchwidth; x++)
     {
-        const double* const magbuf    = Buf(magmat)    + x * magmat.cols;
-        const double* const orientbuf = Buf(orientmat) + x * orientmat.cols;
+        const float* const magbuf    = (float*)(magmat.data)    + x * magmat.cols;
+        const float* const orientbuf = (float*)(orientmat.data) + x * orientmat.cols;
 
         for (int y = ix - halfpatchwidth; y <= ix + halfpatchwidth; y++)
         {
@@ -197,56 +390,91 @@ static void GetMagsAndOrients_GeneralCase(
             ipix++;
         }
     }
-    CV_DbgAssert(ipix == NSIZE(mags));
 }
 
 // Calculate the image patch gradient mags and orients for
 // an image patch that is entirely in the image boundaries.
 
 static inline void GetMagsAndOrients_AllInImg(
-    vec_double&       mags,                    // out
-    vec_double&       orients,                 // out
-    const int         ix,                      // in: x coord of center of patch
-    const int         iy,                      // in: y coord of center of patch
-    const int         patchwidth,              // in
-    const MAT&        magmat,                  // in
-    const MAT&        orientmat,               // in
-    const vec_double& pixelweights)            // in
+    float*                 mags,         // out
+    float*                 orients,      // out
+    const int              ix,           // in: x coord of center of patch
+    const int              iy,           // in: y coord of center of patch
+    const int              patchwidth,   // in
+    const cv::Mat_<float>& magmat,       // in
+    const cv::Mat_<float>& orientmat,    // in
+    const float*           pixelweights) // in
 {
     const int halfpatchwidth = (patchwidth-1) / 2;
     int ipix = 0;
     for (int x = iy - halfpatchwidth; x <= iy + halfpatchwidth; x++)
     {
-        const double* const magbuf    = Buf(magmat)    + x * magmat.cols;
-        const double* const orientbuf = Buf(orientmat) + x * orientmat.cols;
+        const float* const magbuf =
+            (float*)(magmat.data) + x * magmat.cols + ix - halfpatchwidth;
+        const float* const orientbuf =
+            (float*)(orientmat.data) + x * orientmat.cols + ix - halfpatchwidth;
+
+        for (int y = 0; y < patchwidth; y++)
+            mags[ipix + y] = pixelweights[ipix + y] * magbuf[y];
+        memcpy(orients + ipix, orientbuf, patchwidth * sizeof(orients[0]));
+        ipix += patchwidth;
+    }
+}
 
-        for (int y = ix - halfpatchwidth; y <= ix + halfpatchwidth; y++)
+#if STASM_AVX2
+
+AVX2_FUNC static void GetMagsAndOrients_AllInImg_Avx2( // as above
+    float*                 mags,         // out
+    float*                 orients,      // out
+    const int              ix,           // in: x coord of center of patch
+    const int              iy,           // in: y coord of center of patch
+    const int              patchwidth,   // in
+    const cv::Mat_<float>& magmat,       // in
+    const cv::Mat_<float>& orientmat,    // in
+    const float*           pixelweights) // in
+{
+    const int halfpatchwidth = (patchwidth-1) / 2;
+    int ipix = 0;
+    for (int x = iy - halfpatchwidth; x <= iy + halfpatchwidth; x++)
+    {
+        const float* const magbuf =
+            (float*)(magmat.data) + x * magmat.cols + ix - halfpatchwidth;
+        const float* const orientbuf =
+            (float*)(orientmat.data) + x * orientmat.cols + ix - halfpatchwidth;
+
+        int y = 0;
+        for (; y + 8 <= patchwidth; y += 8)
         {
-            mags[ipix]    = pixelweights[ipix] * magbuf[y];
-            orients[ipix] = orientbuf[y];
-            ipix++;
+            _mm256_storeu_ps(mags + ipix + y,
+                             _mm256_mul_ps(_mm256_loadu_ps(pixelweights + ipix + y),
+                                           _mm256_loadu_ps(magbuf + y)));
+            _mm256_storeu_ps(orients + ipix + y, _mm256_loadu_ps(orientbuf + y));
         }
+        for (; y < patchwidth; y++)
+        {
+            mags[ipix + y]    = pixelweights[ipix + y] * magbuf[y];
+            orients[ipix + y] = orientbuf[y];
+        }
+        ipix += patchwidth;
     }
-    CV_DbgAssert(ipix == NSIZE(mags));
 }
 
-void GetMagsAndOrients( // get mags and orients for patch at ix,iy
-    vec_double&       mags,         // out
-    vec_double&       orients,      // out
-    const int         ix,           // in: x coord of center of patch (may be off image)
-    const int         iy,           // in: y coord of center of patch (may be off image)
-    const int         patchwidth,   // in: in pixels
-    const MAT&        magmat,       // in
-    const MAT&        orientmat,    // in
-    const vec_double& pixelweights) // in
+#endif // STASM_AVX2
+
+static void GetMagsAndOrients( // get mags and orients for patch at ix,iy
+    float*                 mags,         // out: SQ(patchwidth) elements
+    float*                 orients,      // out: SQ(patchwidth) elements
+    const int              ix,           // in: x coord of center of patch (may be off image)
+    const int              iy,           // in: y coord of center of patch (may be off image)
+    const int              patchwidth,   // in: in pixels
+    const cv::Mat_<float>& magmat,       // in
+    const cv::Mat_<float>& orientmat,    // in
+    const float*           pixelweights, // in
+    const bool             avx2)         // in: use the AVX2 kernel
 {
     CV_Assert(patchwidth % 2 == 1);  // patchwidth must be odd in this implementation
-    const int npix = SQ(patchwidth); // number of pixels in image patch
     const int halfpatchwidth = (patchwidth-1) / 2;
 
-    mags.resize(npix);
-    orients.resize(npix);
-
     if (ix - halfpatchwidth < 0 || ix + halfpatchwidth >= magmat.cols ||
         iy - halfpatchwidth < 0 || iy + halfpatchwidth >= magmat.rows)
     {
@@ -257,10 +485,19 @@ void GetMagsAndOrients( // get mags and orients for patch at ix,iy
     }
     else
     {
-        // Patch is entirely in the image area.  The following function returns
-        // results identical to GetMagsAndOrients_GeneralCase, but is faster
-        // because it doesn't have to worry about the edges of the image.
+        // Patch is entirely in the image area.  The following functions return
+        // results identical to GetMagsAndOrients_GeneralCase, but are faster
+        // because they don't have to worry about the edges of the image.
 
+#if STASM_AVX2
+        if (avx2)
+        {
+            GetMagsAndOrients_AllInImg_Avx2(mags, orients,
+                ix, iy, patchwidth, magmat, orientmat, pixelweights);
+            return;
+        }
+#endif
+        (void)avx2;
         GetMagsAndOrients_AllInImg(mags, orients,
             ix, iy, patchwidth, magmat, orientmat, pixelweights);
     }
@@ -271,16 +508,13 @@ void GetMagsAndOrients( // get mags and orients for patch at ix,iy
 // This routine needs to be fast.
 
 static inline void TrilinearAccumulate(
-    double& b000, double& b001, // io: histogram bins
-    double& b010, double& b011, // io
-    double& b100, double& b101, // io
-    double& b110, double& b111, // io
-    const double mag,           // in: the mag that gets apportioned
-    const double rowfrac,       // in
-    const double colfrac,       // in
-    const double orientfrac)    // in
+    float* const p,          // io: first of the pixel's histogram bins
+    const float  mag,        // in: the mag that gets apportioned
+    const float  rowfrac,    // in
+    const float  colfrac,    // in
+    const float  orientfrac) // in
 {
-    const double
+    const float
         a1   = mag * rowfrac,  a0   = mag - a1,
 
         a11  = a1 * colfrac,   a10  = a1  - a11,
@@ -291,62 +525,30 @@ static inline void TrilinearAccumulate(
         a011 = a01 * orientfrac,
         a001 = a00 * orientfrac;
 
-    b000 += a00 - a001; b001 += a001;
-    b010 += a01 - a011; b011 += a011;
-    b100 += a10 - a101; b101 += a101;
-    b110 += a11 - a111; b111 += a111;
-}
-
-// The dimension of histbins is 1+GRIDHEIGHT+1 by 1+GRIDWIDTH+1 by BINS_PER_HIST+1.
-// The extra bins are for fast trilinear accumulation (boundary checks unneeded).
-// The final bin in each histogram is for degrees greater than 360, needed as
-// degrees less than but near 360 get smeared out by trilinear interpolation.
-
-static inline int HistIndex(int row, int col, int iorient) // index into histbins
-{
-    return ((row+1) * (1+GRIDWIDTH+1) + (col+1)) * (BINS_PER_HIST+1) + iorient;
+    p[0]                 += a00 - a001; p[1]                     += a001;
+    p[NEXTCOL]           += a01 - a011; p[NEXTCOL + 1]           += a011;
+    p[NEXTROW]           += a10 - a101; p[NEXTROW + 1]           += a101;
+    p[NEXTROW + NEXTCOL] += a11 - a111; p[NEXTROW + NEXTCOL + 1] += a111;
 }
 
-void GetHistograms(                // get all histogram bins
-    vec_double&       histbins,    // out
-    const int         patchwidth,  // in: in pixels
-    const vec_double& mags,        // in
-    const vec_double& orients,     // in
-    const vec_int&    row_indices, // in
-    const vec_double& row_fracs,   // in
-    const vec_int&    col_indices, // in
-    const vec_double& col_fracs)   // in
+static void GetHistograms(             // get all histogram bins
+    float*       histbins,             // out: NHISTBINS elements
+    const int    ipix0,                // in: first pixel to accumulate
+    const int    npix,                 // in: number of pixels in image patch
+    const float* mags,                 // in
+    const float* orients,              // in
+    const int*   hist_indices,         // in
+    const float* row_fracs,            // in
+    const float* col_fracs)            // in
 {
-    const int npix = SQ(patchwidth); // number of pixels in image patch
-
-    const int nhistbins =
-        (1 + GRIDHEIGHT + 1) * (1 + GRIDWIDTH + 1) * (BINS_PER_HIST + 1);
-
-    // resize and clear (the fill is needed if the size of histbins
-    // doesn't change, because in that case resize does nothing)
-    histbins.resize(nhistbins);
-    fill(histbins.begin(), histbins.end(), 0.);
-
-    for (int ipix = 0; ipix < npix; ipix++)
+    for (int ipix = ipix0; ipix < npix; ipix++)
     {
-        const double orient = orients[ipix];
-        const int iorient   = int(floor(orient));
+        const float orient = orients[ipix];
+        const int iorient  = int(orient); // orient >= 0 so same as floor
         CV_DbgAssert(iorient >= 0 && iorient < BINS_PER_HIST);
 
-        const int ibin =
-            HistIndex(row_indices[ipix], col_indices[ipix], iorient);
-
-        double* const p = &histbins[ibin];
-
         TrilinearAccumulate( // apportion grad mag across eight orientation bins
-            p[0],                                     // ThisOrient
-            p[1],                                     // NextOrient
-            p[BINS_PER_HIST + 1],                     // NextCol ThisOrient
-            p[BINS_PER_HIST + 2],                     // NextCol NextOrient
-            p[(GRIDWIDTH+2) * (BINS_PER_HIST+1)],     // NextRow ThisOrient
-            p[(GRIDWIDTH+2) * (BINS_PER_HIST+1) + 1], // NextRow NextOrient
-            p[(GRIDWIDTH+3) * (BINS_PER_HIST+1)],     // NextRow NextCol ThisOrient
-            p[(GRIDWIDTH+3) * (BINS_PER_HIST+1) + 1], // NextRow NextCol NextOrient
+            histbins + hist_indices[ipix] + iorient,
             mags[ipix],        // the mag that gets apportioned
             row_fracs[ipix],   // rowfrac
             col_fracs[ipix],   // colfrac
@@ -354,8 +556,74 @@ void GetHistograms(                // get all histogram bins
     }
 }
 
+#if STASM_AVX2
+
+// As GetHistograms, but the interpolation weights of eight pixels are
+// calculated at once.  The weights are then scattered into the bins one
+// pixel at a time, because two pixels in a batch can share bins.
+
+AVX2_FUNC static void GetHistograms_Avx2(
+    float*       histbins,             // out: NHISTBINS elements
+    const int    npix,                 // in: number of pixels in image patch
+    const float* mags,                 // in
+    const float* orients,              // in
+    const int*   hist_indices,         // in
+    const float* row_fracs,            // in
+    const float* col_fracs)            // in
+{
+    float w[8][8];                     // w[ibin][i] is weight of ibin'th bin of pixel i
+    int ibins[8];
+
+    int ipix = 0;
+    for (; ipix + 8 <= npix; ipix += 8)
+    {
+        const __m256 mag      = _mm256_loadu_ps(mags + ipix);
+        const __m256 orient   = _mm256_loadu_ps(orients + ipix);
+        const __m256 iorient  = _mm256_floor_ps(orient);
+        const __m256 ofrac    = _mm256_sub_ps(orient, iorient);
+        const __m256 colfrac  = _mm256_loadu_ps(col_fracs + ipix);
+
+        const __m256 a1   = _mm256_mul_ps(mag, _mm256_loadu_ps(row_fracs + ipix));
+        const __m256 a0   = _mm256_sub_ps(mag, a1);
+        const __m256 a11  = _mm256_mul_ps(a1, colfrac);
+        const __m256 a10  = _mm256_sub_ps(a1, a11);
+        const __m256 a01  = _mm256_mul_ps(a0, colfrac);
+        const __m256 a00  = _mm256_sub_ps(a0, a01);
+        const __m256 a111 = _mm256_mul_ps(a11, ofrac);
+        const __m256 a101 = _mm256_mul_ps(a10, ofrac);
+        const __m256 a011 = _mm256_mul_ps(a01, ofrac);
+        const __m256 a001 = _mm256_mul_ps(a00, ofrac);
+
+        _mm256_storeu_ps(w[0], _mm256_sub_ps(a00, a001));
+        _mm256_storeu_ps(w[1], a001);
+        _mm256_storeu_ps(w[2], _mm256_sub_ps(a01, a011));
+        _mm256_storeu_ps(w[3], a011);
+        _mm256_storeu_ps(w[4], _mm256_sub_ps(a10, a101));
+        _mm256_storeu_ps(w[5], a101);
+        _mm256_storeu_ps(w[6], _mm256_sub_ps(a11, a111));
+        _mm256_storeu_ps(w[7], a111);
+
+        _mm256_storeu_si256((__m256i*)ibins,
+            _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(hist_indices + ipix)),
+                             _mm256_cvttps_epi32(iorient)));
+
+        for (int i = 0; i < 8; i++)
+        {
+            float* const p = histbins + ibins[i];
+            p[0]                 += w[0][i]; p[1]                     += w[1][i];
+            p[NEXTCOL]           += w[2][i]; p[NEXTCOL + 1]           += w[3][i];
+            p[NEXTROW]           += w[4][i]; p[NEXTROW + 1]           += w[5][i];
+            p[NEXTROW + NEXTCOL] += w[6][i]; p[NEXTROW + NEXTCOL + 1] += w[7][i];
+        }
+    }
+    GetHistograms(histbins, ipix, npix, // leftover pixels
+                  mags, orients, hist_indices, row_fracs, col_fracs);
+}
+
+#endif // STASM_AVX2
+
 static void WrapHistograms(
-    vec_double& histbins)
+    float* histbins) // io
 {
     for (int row = 0; row < GRIDHEIGHT; row++)
         for (int col = 0; col < GRIDWIDTH; col++)
@@ -365,78 +633,452 @@ static void WrapHistograms(
         }
 }
 
-static void CopyHistsToDesc(    // copy histograms to descriptor, skipping pad bins
-    VEC&              desc,     // out
-    const vec_double& histbins) // in
+static void CopyHistsToDesc(   // copy histograms to descriptor, skipping pad bins
+    float*       desc,         // out: HAT_DESC_LEN elements
+    const float* histbins)     // in
 {
     for (int row = 0; row < GRIDHEIGHT; row++)
         for (int col = 0; col < GRIDWIDTH; col++)
-            memcpy(Buf(desc) +
+            memcpy(desc +
                        (row * GRIDWIDTH + col) * BINS_PER_HIST,
-                   &histbins[HistIndex(row, col, 0)],
+                   histbins + HistIndex(row, col, 0),
                    BINS_PER_HIST * sizeof(histbins[0]));
 }
 
 static void NormalizeDesc( // take sqrt of elems and divide by L2 norm
-    VEC& desc)             // io
+    float* data)           // io: HAT_DESC_LEN elements
 {
-    double* const data = Buf(desc);
-    for (int i = 0; i < NSIZE(desc); i++)
+    double sumsq = 0;
+    for (int i = 0; i < HAT_DESC_LEN; i++)
+    {
         data[i] = sqrt(data[i]); // sqrt reduces effect of outliers
-    const double norm = cv::norm(desc); // L2 norm
+        sumsq += SQ(data[i]);
+    }
+    const double norm = sqrt(sumsq); // L2 norm
     if (!IsZero(norm))
     {
-        const double scale = FINAL_SCALE / norm;
-        for (int i = 0; i < NSIZE(desc); i++)
+        const float scale = float(FINAL_SCALE / norm);
+        for (int i = 0; i < HAT_DESC_LEN; i++)
             data[i] *= scale;
     }
 }
 
+#if STASM_AVX2
+
+AVX2_FUNC static double Sum_Avx2(__m256d x) // sum of the four doubles in x
+{
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(x), _mm256_extractf128_pd(x, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+AVX2_FUNC static void NormalizeDesc_Avx2( // as NormalizeDesc
+    float* data)                          // io: HAT_DESC_LEN elements
+{
+    __m256d sumsq = _mm256_setzero_pd(); // double, as in the scalar version
+    for (int i = 0; i < HAT_DESC_LEN; i += 8)
+    {
+        const __m256 x = _mm256_sqrt_ps(_mm256_loadu_ps(data + i));
+        _mm256_storeu_ps(data + i, x);
+        const __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(x));
+        const __m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1));
+        sumsq = _mm256_fmadd_pd(lo, lo, sumsq);
+        sumsq = _mm256_fmadd_pd(hi, hi, sumsq);
+    }
+    const double norm = sqrt(Sum_Avx2(sumsq));
+    if (!IsZero(norm))
+    {
+        const __m256 scale = _mm256_set1_ps(float(FINAL_SCALE / norm));
+        for (int i = 0; i < HAT_DESC_LEN; i += 8)
+            _mm256_storeu_ps(data + i, _mm256_mul_ps(_mm256_loadu_ps(data + i), scale));
+    }
+}
+
+#endif // STASM_AVX2
+
 // Hat::Init_ must be called before calling this function.
 //
-// A HAT descriptor is a vector of doubles of length
+// A HAT descriptor is a vector of floats of length
 // GRIDHEIGHT * GRIDWIDTH * BINS_PER_HIST (currently 4 * 5 * 8 = 160).
 //
-// The descriptor is a vector of doubles (instead of say bytes) primarily
-// so the HatFit function we apply later is fast (because byte-to-double
-// type conversions are unneeded when applying the formula).
-//
-// Note also that a trial implementation that used floats instead of
-// doubles (and with a float form of HatFit) was slower.
+// The descriptor is built in floats so eight elements fit in an AVX2
+// register.  The HatFit function we apply later accumulates the fit in
+// doubles (see HatLinMod), so landmark positions are as before to within
+// float rounding of the descriptor.
 
 VEC Hat::Desc_( // return HAT descriptor, Init_ must be called first
     const double x,    // in: x coord of center of patch (may be off image)
     const double y)    // in: y coord of center of patch (may be off image)
     const
+{
+    float fdesc[HAT_DESC_LEN];
+
+    Desc_(fdesc, x, y);
+
+    VEC desc(HAT_DESC_LEN, 1); // the HAT descriptor
+    for (int i = 0; i < HAT_DESC_LEN; i++)
+        desc(i) = fdesc[i];
+
+    return desc;
+}
+
+void Hat::Desc_(       // as above but into the caller's buffer
+    float*       desc, // out: HAT_DESC_LEN elements
+    const double x,    // in: x coord of center of patch (may be off image)
+    const double y)    // in: y coord of center of patch (may be off image)
+    const
 {
     CV_Assert(magmat_.rows);         // verify that Hat::Init_ was called
 
-#if _OPENMP // can't be static because multiple instances
-    vec_double        mags, orients;
-    vec_double        histbins;
-#else       // static faster since size rarely changes
-    static vec_double mags, orients; // the image patch grad mags and orientations
-    static vec_double histbins;      // the histograms
-#endif
+    const bool avx2 = UseAvx2();
+    const int npix = SQ(patchwidth_);
+    const int ix = cvRound(x), iy = cvRound(y);
+    const int halfpatchwidth = (patchwidth_-1) / 2;
+
+    InitTiles_(ix - halfpatchwidth, iy - halfpatchwidth,
+               ix + halfpatchwidth, iy + halfpatchwidth);
+
+    // On the stack, so concurrent calls (OpenMP or multiple stasm_ctx's) are safe
+    cv::AutoBuffer<float, 2 * NPIX_ON_STACK> buf(2 * npix);
+    float* const mags    = buf;        // the image patch grad mags
+    float* const orients = buf + npix; // and orientations
+    float histbins[NHISTBINS] = { 0 }; // the histograms
 
     GetMagsAndOrients(mags, orients,
-                      cvRound(x), cvRound(y), patchwidth_,
-                      magmat_, orientmat_, pixelweights_);
+                      ix, iy, patchwidth_,
+                      magmat_, orientmat_, &pixelweights_[0], avx2);
 
-    GetHistograms(histbins,
-                  patchwidth_, mags, orients,
-                  row_indices_, row_fracs_, col_indices_, col_fracs_);
+#if STASM_AVX2
+    if (avx2)
+        GetHistograms_Avx2(histbins, npix, mags, orients,
+                           &hist_indices_[0], &row_fracs_[0], &col_fracs_[0]);
+    else
+#endif
+        GetHistograms(histbins, 0, npix, mags, orients,
+                      &hist_indices_[0], &row_fracs_[0], &col_fracs_[0]);
 
     WrapHistograms(histbins);        // wrap 360 degrees back to 0
 
-    VEC desc(GRIDHEIGHT * GRIDWIDTH * BINS_PER_HIST, 1); // the HAT descriptor
-
     CopyHistsToDesc(desc,
                     histbins);
 
-    NormalizeDesc(desc);
+#if STASM_AVX2
+    if (avx2)
+        NormalizeDesc_Avx2(desc);
+    else
+#endif
+        NormalizeDesc(desc);
+}
+
+//-----------------------------------------------------------------------------
 
-    return desc;
+// GridDescs_ calculates the descriptors of all the patches in a search grid
+// at once.  The patches overlap heavily, and since the weights are
+// separable (see InitKernels) a histogram bin is a separable filter over
+// the grad mags split into orientation channels.  So the histograms of the
+// whole grid are got by filtering the rows of the image window that covers
+// all the patches, and then filtering the cols of the result.  The results
+// are identical to Hat::Desc_ apart from float rounding.
+//
+// Unlike Desc_, the 360 degree bin is wrapped back to 0 as each pixel is
+// split, so a pixel's channels are BINS_PER_HIST floats (an AVX2 register)
+// and the col filter leaves the histograms in descriptor order.
+
+static const int HROW_LEN = GRIDWIDTH * BINS_PER_HIST; // a row of histograms
+
+static_assert(BINS_PER_HIST == 8, "the AVX2 grid kernels assume 8 bins per hist");
+
+// Filter the rows of the window for each grid col.  Each patch row is
+// reduced to a row of GRIDWIDTH histograms (HROW_LEN floats).
+
+static void FilterWindowRows(
+    float*       hrows,      // out: winwidth * ngrid rows of HROW_LEN
+    const float* chans,      // in: BINS_PER_HIST orient channels per window pixel
+    const int    winwidth,   // in: window is winwidth x winwidth pixels
+    const int    ngrid,      // in: number of grid cols
+    const int    step,       // in: grid spacing in pixels
+    const int    patchwidth, // in
+    const float* kernels,    // in: col kernels
+    const int*   ranges)     // in: col kernel ranges
+{
+    memset(hrows, 0, winwidth * ngrid * HROW_LEN * sizeof(hrows[0]));
+
+    // The grid col loop is inside the patch col loop so consecutive
+    // sums are independent (they don't wait for each other)
+
+    for (int winrow = 0; winrow < winwidth; winrow++)
+    {
+        const float* const winpix = chans + winrow * winwidth * BINS_PER_HIST;
+        float* const hrow0 = hrows + winrow * ngrid * HROW_LEN;
+
+        for (int col = 0; col < GRIDWIDTH; col++)
+        {
+            const float* const kernel = kernels + col * patchwidth;
+            for (int patchcol = ranges[2 * col]; patchcol < ranges[2 * col + 1]; patchcol++)
+            {
+                const float w = kernel[patchcol];
+                for (int gridcol = 0; gridcol < ngrid; gridcol++)
+                {
+                    const float* const pix =
+                        winpix + (gridcol * step + patchcol) * BINS_PER_HIST;
+                    float* const hist = hrow0 + gridcol * HROW_LEN + col * BINS_PER_HIST;
+                    for (int i = 0; i < BINS_PER_HIST; i++)
+                        hist[i] += w * pix[i];
+                }
+            }
+        }
+    }
+}
+
+// Filter the cols of the output of FilterWindowRows to get the histograms
+// (in descriptor order) of the patch at the given grid point.
+
+static void FilterWindowCols(
+    float*       desc,       // out: HAT_DESC_LEN elements (not yet normalized)
+    const float* hrows,      // in: output of FilterWindowRows
+    const int    gridrow,    // in
+    const int    gridcol,    // in
+    const int    ngrid,      // in
+    const int    step,       // in
+    const int    patchwidth, // in
+    const float* kernels,    // in: row kernels
+    const int*   ranges)     // in: row kernel ranges
+{
+    for (int row = 0; row < GRIDHEIGHT; row++)
+    {
+        const float* const kernel = kernels + row * patchwidth;
+        float* const hist = desc + row * HROW_LEN;
+        memset(hist, 0, HROW_LEN * sizeof(hist[0]));
+        for (int patchrow = ranges[2 * row]; patchrow < ranges[2 * row + 1]; patchrow++)
+        {
+            const float* const hrow =
+                hrows + ((gridrow * step + patchrow) * ngrid + gridcol) * HROW_LEN;
+            for (int i = 0; i < HROW_LEN; i++)
+                hist[i] += kernel[patchrow] * hrow[i];
+        }
+    }
+}
+
+#if STASM_AVX2
+
+AVX2_FUNC static void FilterWindowRows_Avx2( // as FilterWindowRows
+    float*       hrows,      // out: winwidth * ngrid rows of HROW_LEN
+    const float* chans,      // in: BINS_PER_HIST orient channels per window pixel
+    const int    winwidth,   // in: window is winwidth x winwidth pixels
+    const int    ngrid,      // in: number of grid cols
+    const int    step,       // in: grid spacing in pixels
+    const int    patchwidth, // in
+    const float* kernels,    // in: col kernels
+    const int*   ranges)     // in: col kernel ranges
+{
+    // Four grid cols are done together, so the four sums are independent
+    // and the fmas don't wait for each other.
+
+    const int gridstep = step * BINS_PER_HIST; // floats between grid cols
+
+    for (int winrow = 0; winrow < winwidth; winrow++)
+    {
+        const float* const winpix = chans + winrow * winwidth * BINS_PER_HIST;
+        float* const hrow0 = hrows + winrow * ngrid * HROW_LEN;
+
+        for (int col = 0; col < GRIDWIDTH; col++)
+        {
+            const float* const kernel = kernels + col * patchwidth;
+            const int begin = ranges[2 * col], end = ranges[2 * col + 1];
+            int gridcol = 0;
+            for (; gridcol + 4 <= ngrid; gridcol += 4)
+            {
+                const float* const pix = winpix + gridcol * gridstep;
+                __m256 h0 = _mm256_setzero_ps(), h1 = _mm256_setzero_ps(),
+                       h2 = _mm256_setzero_ps(), h3 = _mm256_setzero_ps();
+                for (int patchcol = begin; patchcol < end; patchcol++)
+                {
+                    const __m256 w = _mm256_set1_ps(kernel[patchcol]);
+                    const float* const p = pix + patchcol * BINS_PER_HIST;
+                    h0 = _mm256_fmadd_ps(w, _mm256_loadu_ps(p),                h0);
+                    h1 = _mm256_fmadd_ps(w, _mm256_loadu_ps(p + gridstep),     h1);
+                    h2 = _mm256_fmadd_ps(w, _mm256_loadu_ps(p + 2 * gridstep), h2);
+                    h3 = _mm256_fmadd_ps(w, _mm256_loadu_ps(p + 3 * gridstep), h3);
+                }
+                float* const hist = hrow0 + gridcol * HROW_LEN + col * BINS_PER_HIST;
+                _mm256_storeu_ps(hist,                h0);
+                _mm256_storeu_ps(hist + HROW_LEN,     h1);
+                _mm256_storeu_ps(hist + 2 * HROW_LEN, h2);
+                _mm256_storeu_ps(hist + 3 * HROW_LEN, h3);
+            }
+            for (; gridcol < ngrid; gridcol++) // leftover grid cols
+            {
+                const float* const pix = winpix + gridcol * gridstep;
+                __m256 h0 = _mm256_setzero_ps(), h1 = _mm256_setzero_ps();
+                int patchcol = begin;
+                for (; patchcol + 1 < end; patchcol += 2)
+                {
+                    const float* const p = pix + patchcol * BINS_PER_HIST;
+                    h0 = _mm256_fmadd_ps(_mm256_set1_ps(kernel[patchcol]),
+                                         _mm256_loadu_ps(p), h0);
+                    h1 = _mm256_fmadd_ps(_mm256_set1_ps(kernel[patchcol + 1]),
+                                         _mm256_loadu_ps(p + BINS_PER_HIST), h1);
+                }
+                if (patchcol < end)
+                    h0 = _mm256_fmadd_ps(_mm256_set1_ps(kernel[patchcol]),
+                                         _mm256_loadu_ps(pix + patchcol * BINS_PER_HIST), h0);
+                _mm256_storeu_ps(hrow0 + gridcol * HROW_LEN + col * BINS_PER_HIST,
+                                 _mm256_add_ps(h0, h1));
+            }
+        }
+    }
+}
+
+AVX2_FUNC static void FilterWindowCols_Avx2( // as FilterWindowCols
+    float*       desc,       // out: HAT_DESC_LEN elements (not yet normalized)
+    const float* hrows,      // in: output of FilterWindowRows
+    const int    gridrow,    // in
+    const int    gridcol,    // in
+    const int    ngrid,      // in
+    const int    step,       // in
+    const int    patchwidth, // in
+    const float* kernels,    // in: row kernels
+    const int*   ranges)     // in: row kernel ranges
+{
+    for (int row = 0; row < GRIDHEIGHT; row++)
+    {
+        const float* const kernel = kernels + row * patchwidth;
+        __m256 h0 = _mm256_setzero_ps(), h1 = _mm256_setzero_ps(),
+               h2 = _mm256_setzero_ps(), h3 = _mm256_setzero_ps(),
+               h4 = _mm256_setzero_ps();
+        for (int patchrow = ranges[2 * row]; patchrow < ranges[2 * row + 1]; patchrow++)
+        {
+            const float* const hrow =
+                hrows + ((gridrow * step + patchrow) * ngrid + gridcol) * HROW_LEN;
+            const __m256 w = _mm256_set1_ps(kernel[patchrow]);
+            h0 = _mm256_fmadd_ps(w, _mm256_loadu_ps(hrow),      h0);
+            h1 = _mm256_fmadd_ps(w, _mm256_loadu_ps(hrow + 8),  h1);
+            h2 = _mm256_fmadd_ps(w, _mm256_loadu_ps(hrow + 16), h2);
+            h3 = _mm256_fmadd_ps(w, _mm256_loadu_ps(hrow + 24), h3);
+            h4 = _mm256_fmadd_ps(w, _mm256_loadu_ps(hrow + 32), h4);
+        }
+        float* const hist = desc + row * HROW_LEN;
+        _mm256_storeu_ps(hist,      h0);
+        _mm256_storeu_ps(hist + 8,  h1);
+        _mm256_storeu_ps(hist + 16, h2);
+        _mm256_storeu_ps(hist + 24, h3);
+        _mm256_storeu_ps(hist + 32, h4);
+    }
+}
+
+#endif // STASM_AVX2
+
+void Hat::GridDescs_(           // descriptors for a grid of patches around ix,iy
+    float*       descs,         // out: SQ(ngrid) descriptors, grid row major
+    const int    ix,            // in: x coord of center of grid (may be off image)
+    const int    iy,            // in: y coord of center of grid (may be off image)
+    const int    maxoffset,     // in: grid is +-maxoffset pixels from ix,iy
+    const int    step)          // in: grid spacing in pixels (divides maxoffset)
+    const
+{
+    CV_Assert(magmat_.rows);    // verify that Hat::Init_ was called
+    CV_Assert(step > 0 && maxoffset % step == 0);
+
+    const bool avx2 = UseAvx2();
+    const int ngrid = 2 * maxoffset / step + 1;
+    const int halfpatchwidth = (patchwidth_-1) / 2;
+    const int winwidth = patchwidth_ + 2 * maxoffset; // window covers all patches
+    const int winx0 = ix - maxoffset - halfpatchwidth;
+    const int winy0 = iy - maxoffset - halfpatchwidth;
+    const int nwinpix = SQ(winwidth);
+
+    InitTiles_(winx0, winy0, winx0 + winwidth - 1, winy0 + winwidth - 1);
+
+    // Split the grad mag of each window pixel across its two orientation
+    // channels.  Pixels off the image have a zero mag.
+
+    cv::AutoBuffer<float> chans(nwinpix * BINS_PER_HIST);
+    memset(chans, 0, nwinpix * BINS_PER_HIST * sizeof(float));
+    float* pix = chans;
+    for (int y = winy0; y < winy0 + winwidth; y++)
+        for (int x = winx0; x < winx0 + winwidth; x++, pix += BINS_PER_HIST)
+            if (x >= 0 && x < magmat_.cols && y >= 0 && y < magmat_.rows)
+            {
+                const float mag    = magmat_(y, x);
+                const float orient = orientmat_(y, x);
+                const int iorient  = int(orient); // orient >= 0 so same as floor
+                const float mag1   = mag * (orient - iorient);
+                pix[iorient] = mag - mag1;
+                pix[(iorient + 1) % BINS_PER_HIST] = mag1; // 360 wraps to 0
+            }
+
+    cv::AutoBuffer<float> hrows(winwidth * ngrid * HROW_LEN);
+
+#if STASM_AVX2
+    if (avx2)
+        FilterWindowRows_Avx2(hrows, chans, winwidth, ngrid, step, patchwidth_,
+                              &col_kernels_[0], &col_kernel_ranges_[0]);
+    else
+#endif
+        FilterWindowRows(hrows, chans, winwidth, ngrid, step, patchwidth_,
+                         &col_kernels_[0], &col_kernel_ranges_[0]);
+
+    for (int gridrow = 0; gridrow < ngrid; gridrow++)
+        for (int gridcol = 0; gridcol < ngrid; gridcol++)
+        {
+            float* const desc = descs + (gridrow * ngrid + gridcol) * HAT_DESC_LEN;
+#if STASM_AVX2
+            if (avx2)
+            {
+                FilterWindowCols_Avx2(desc, hrows, gridrow, gridcol,
+                                      ngrid, step, patchwidth_,
+                                      &row_kernels_[0], &row_kernel_ranges_[0]);
+                NormalizeDesc_Avx2(desc);
+                continue;
+            }
+#endif
+            FilterWindowCols(desc, hrows, gridrow, gridcol,
+                             ngrid, step, patchwidth_,
+                             &row_kernels_[0], &row_kernel_ranges_[0]);
+            NormalizeDesc(desc);
+        }
+}
+
+#if STASM_AVX2
+
+AVX2_FUNC static double HatLinMod_Avx2( // as HatLinMod
+    const float*  desc,                 // in: HAT_DESC_LEN elements
+    const double  intercept,            // in
+    const double* coef)                 // in: HAT_DESC_LEN elements
+{
+    __m256d sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+    for (int i = 0; i < HAT_DESC_LEN; i += 8)
+    {
+        const __m256 x = _mm256_loadu_ps(desc + i);
+        sum0 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(x)),
+                               _mm256_loadu_pd(coef + i), sum0);
+        sum1 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)),
+                               _mm256_loadu_pd(coef + i + 4), sum1);
+    }
+    return intercept + Sum_Avx2(_mm256_add_pd(sum0, sum1));
+}
+
+#endif // STASM_AVX2
+
+// The linear model used by HatFit (hatdesc.h), with coefficients from the
+// generated *_descmods.mh files.  The coefficients stay in doubles (as in
+// the model files) and so does the sum, so only the descriptor is in float.
+
+double HatLinMod(            // return intercept + coef . desc
+    const float*  desc,      // in: HAT_DESC_LEN elements
+    const double  intercept, // in
+    const double* coef)      // in: HAT_DESC_LEN elements
+{
+#if STASM_AVX2
+    if (UseAvx2())
+        return HatLinMod_Avx2(desc, intercept, coef);
+#endif
+    double yhat = intercept;
+    for (int i = 0; i < HAT_DESC_LEN; i += 4)
+        yhat += coef[i]   * desc[i]   +
+                coef[i+1] * desc[i+1] +
+                coef[i+2] * desc[i+2] +
+                coef[i+3] * desc[i+3];
+    return yhat;
 }
 
 } // namespace stasm
@@ -5,8 +5,12 @@
 #ifndef STASM_HAT_H
 #define STASM_HAT_H
 
+#include <atomic>
+
 namespace stasm
 {
+static const int HAT_DESC_LEN = 4 * 5 * 8; // GRIDHEIGHT * GRIDWIDTH * BINS_PER_HIST
+                                           // (checked in hat.cpp)
 class Hat
 {
 public:
@@ -19,9 +23,31 @@ public:
         const double y)           // in: y coord of center of patch (may be off image)
     const;
 
-    Hat() {}                      // constructor
+    void Desc_(                   // as above but into the caller's buffer
+        float*       desc,        // out: HAT_DESC_LEN elements
+        const double x,           // in: x coord of center of patch (may be off image)
+        const double y)           // in: y coord of center of patch (may be off image)
+    const;
+
+    void GridDescs_(              // descriptors for a grid of patches around ix,iy
+        float*       descs,       // out: SQ(ngrid) descriptors, grid row major
+        const int    ix,          // in: x coord of center of grid (may be off image)
+        const int    iy,          // in: y coord of center of grid (may be off image)
+        const int    maxoffset,   // in: grid is +-maxoffset pixels from ix,iy
+        const int    step)        // in: grid spacing in pixels (divides maxoffset)
+    const;
+
+    Hat()                         // constructor
+        : patchwidth_(0), ntilecols_(0), ntilerows_(0)
+    {
+    }
 
 private:
+    void InitTiles_(              // calc grads of the tiles under the given rect
+        int x0, int y0,           // in: top left pixel (may be off image)
+        int x1, int y1)           // in: bottom right pixel (may be off image)
+    const;
+
     // All these private variables are initialized by Hat::Init_.  They must
     // be initialized if the image changes or if the patch width changes.
     // (In a Stasm context, that means they must be initialized once per
@@ -30,19 +56,41 @@ private:
 
     int        patchwidth_;       // image patch is patchwidth x patchwidth pixels
 
-    MAT        magmat_;           // grad mag of the current image (face ROI)
-    MAT        orientmat_;        // grad orient of the current image (face ROI)
+    Image      img_;              // the image the grads are calculated from
+
+    // The grad mag and orient of a pixel are calculated on demand, a tile
+    // of pixels at a time, when the first patch that needs it is accessed.
+    // So these are mutable, and Desc_ is still safe to call concurrently.
+
+    mutable cv::Mat_<float> magmat_;    // grad mag of the current image (face ROI)
+    mutable cv::Mat_<float> orientmat_; // grad orient of the current image (face ROI)
+
+    int        ntilecols_, ntilerows_; // size of the tile grid
 
-    vec_int    row_indices_;      // histogram indices: these map a patch row,col
-    vec_double row_fracs_;        // to the corresponding histogram grid row,col
-    vec_int    col_indices_;
-    vec_double col_fracs_;
+    mutable vector<std::atomic<unsigned char> > tileflags_;
+                                  // TILE_EMPTY, TILE_FILLING, or TILE_FULL
+                                  // (grows as needed, never shrinks)
 
-    vec_double pixelweights_;     // weight pixel by closeness to center of patch
+    vec_int    hist_indices_;     // histogram indices: these map a patch pixel to
+                                  // its first bin in the histogram grid
+    vec_float  row_fracs_;        // how far the pixel is into the next grid row
+    vec_float  col_fracs_;        // and col (the mag spills over by this frac)
+
+    vec_float  pixelweights_;     // weight pixel by closeness to center of patch
+
+    vec_float  row_kernels_;      // the above factored into a row and a col part
+    vec_int    row_kernel_ranges_;// for GridDescs_: the weight of a pixel in hist
+    vec_float  col_kernels_;      // grid row,col is row_kernels_[row][patchrow] *
+    vec_int    col_kernel_ranges_;// col_kernels_[col][patchcol] (see InitKernels)
 
     DISALLOW_COPY_AND_ASSIGN(Hat);
 
 }; // end class Hat
 
+double HatLinMod(                 // return intercept + coef . desc
+    const float*  desc,           // in: HAT_DESC_LEN elements
+    const double  intercept,      // in
+    const double* coef);          // in: HAT_DESC_LEN elements
+
 } // namespace stasm
 #endif // STASM_HAT_H
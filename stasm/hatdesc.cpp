@@ -14,91 +14,148 @@
 #include <opencv2/video/tracking.hpp>
 #include "opencv/highgui.h"
 
-#define CACHE 1   // define to 0 if your compiler doesn't support hash_map
-                  // Stasm runs faster if 1
-#if CACHE
-  // define hash_map,  current implementations are compiler dependent (2013)
-  #ifdef _MSC_VER // microsoft
-    #include <hash_map>
-    using namespace stdext;
-  #else          // assume gcc
-    #include <ext/hash_map>
-    using namespace __gnu_cxx;
-  #endif
-#endif
-
 namespace stasm
 {
-// hat_g is global because we initialize the HAT internal data
-// (grads and orients etc.) once for the entire pyramid level.
-// Initialized in InitHatLevData.
+static const bool TRACE_CACHE = 0; // for checking cache hit rate
 
-static Hat hat_g;
+static const int CACHE_BORDER = 4 * HAT_MAX_OFFSET;
+                                   // cache grid extends this many pixels past the
+                                   // image (landmarks can be slightly off the image)
 
-//-----------------------------------------------------------------------------
+static const unsigned char CELL_EMPTY   = 0; // values of HatLevData::flags_
+static const unsigned char CELL_FILLING = 1; // a thread is computing the descriptor
+static const unsigned char CELL_FULL    = 2; // descriptor in slab_ is valid
 
-#if CACHE
+HatLevData::HatLevData() // constructor
+    : cachex0_(0), cachey0_(0), cachecols_(0), cacherows_(0),
+      ncalls_(0), nhits_(0)
+{
+}
 
-// For speed, we cache the HAT descriptors, so we have the descriptor at
-// hand if we revisit an xy position in the image, which is very common in ASMs.
-// (Note: an implementation with cache_g as a vector<vector VEC> was slower.)
+//-----------------------------------------------------------------------------
+
+static const int NGRID = 2 * HAT_MAX_OFFSET / HAT_SEARCH_RESOL + 1;
+                                   // search grid is NGRID x NGRID points
+static const int NGRIDPOINTS = NGRID * NGRID;
 
-static hash_map<unsigned, VEC> cache_g; // cached descriptors
-static const bool TRACE_CACHE = 0;      // for checking cache hit rate
-static int ncalls_g, nhits_g;           // only used if TRACE_CACHE
+static const int MIN_GRID_MISSES = (NGRIDPOINTS + 1) / 2;
+                                   // if at least this many grid descriptors are
+                                   // not in the cache, get them all at once with
+                                   // Hat::GridDescs_ (which costs about as much as
+                                   // five to ten single descriptors)
 
-static unsigned Key(int x, int y) // pack x,y into 32 bits for cache key
+int HatLevData::CellIndex_( // index of the cache cell for x,y, -1 if none
+    int x,                  // in: image x coord (may be off image)
+    int y)                  // in: image y coord (may be off image)
+const
 {
-    return ((y & 0xffff) << 16) | (x & 0xffff);
+    if (x < cachex0_ || y < cachey0_)
+        return -1;                   // far off image, not in the cache grid
+    const int icol = (x - cachex0_) / HAT_SEARCH_RESOL;
+    const int irow = (y - cachey0_) / HAT_SEARCH_RESOL;
+    if (icol >= cachecols_ || irow >= cacherows_)
+        return -1;
+    return irow * cachecols_ + icol;
 }
 
-static double GetHatFit( // args same as non CACHE version, see below
-    int          x,      // in
-    int          y,      // in
-    const HatFit hatfit) // in
+// For speed, we cache the HAT descriptors, so we have the descriptor at
+// hand if we revisit an xy position in the image, which is very common in ASMs.
+//
+// A cell that another thread is busy filling is treated as a miss (we
+// compute the descriptor into a local buffer rather than wait), so no
+// thread ever blocks here.
+
+void HatLevData::Search_(     // find best fit in the search grid around ix,iy
+    int&         xoffset_best, // out: x offset of best fit from ix
+    int&         yoffset_best, // out: y offset of best fit from iy
+    int          ix,           // in: image x coord (may be off image)
+    int          iy,           // in: image y coord (may be off image)
+    const HatFit& hatfit)      // in: func to estimate descriptor match
 {
-    const double* descbuf = NULL;       // the HAT descriptor
-    // for max cache hit rate, x and y should divisible by HAT_SEARCH_RESOL
-    CV_DbgAssert(x % HAT_SEARCH_RESOL == 0);
-    CV_DbgAssert(y % HAT_SEARCH_RESOL == 0);
-    if (TRACE_CACHE)
-        ncalls_g++;
-    const unsigned key(Key(x, y));
-    #pragma omp critical                // prevent OpenMP concurrent access to cache_g
+    // for max cache hit rate, ix and iy should divisible by HAT_SEARCH_RESOL
+    CV_DbgAssert(ix % HAT_SEARCH_RESOL == 0);
+    CV_DbgAssert(iy % HAT_SEARCH_RESOL == 0);
+
+    const float* descs[NGRIDPOINTS]; // descriptor of each grid point
+    int claimed[NGRIDPOINTS];        // cache cell we must fill, -1 if none
+    int nmisses = 0;
+
+    for (int igrid = 0; igrid < NGRIDPOINTS; igrid++)
     {
-        hash_map<unsigned, VEC>:: const_iterator it(cache_g.find(key));
-        if (it != cache_g.end())        // in cache?
+        descs[igrid] = NULL;
+        claimed[igrid] = -1;
+        const int icell =
+            CellIndex_(ix - HAT_MAX_OFFSET + (igrid % NGRID) * HAT_SEARCH_RESOL,
+                       iy - HAT_MAX_OFFSET + (igrid / NGRID) * HAT_SEARCH_RESOL);
+        if (icell >= 0)
         {
-            descbuf = Buf(it->second);  // use cached descriptor
-            if (TRACE_CACHE)
-                nhits_g++;
+            std::atomic<unsigned char>& flag = flags_[icell];
+            unsigned char state = flag.load(std::memory_order_acquire);
+            if (state == CELL_FULL)  // in cache?
+            {
+                descs[igrid] = &slab_[size_t(icell) * HAT_DESC_LEN];
+                continue;
+            }
+            if (state == CELL_EMPTY &&
+                flag.compare_exchange_strong(state, CELL_FILLING,
+                                             std::memory_order_acquire))
+                claimed[igrid] = icell;
         }
+        nmisses++;
     }
-    if (descbuf == NULL)                // descriptor not in cache?
+    if (TRACE_CACHE)
     {
-        const VEC desc(hat_g.Desc_(x, y));
-        #pragma omp critical            // prevent OpenMP concurrent access to cache_g
-        cache_g[key] = desc;            // remember descriptor for possible re-use
-        descbuf = Buf(desc);
+        ncalls_ += NGRIDPOINTS;
+        nhits_  += NGRIDPOINTS - nmisses;
     }
-    return hatfit(descbuf);
-}
-
-#else // not CACHE
+    // The descriptors not in the cache go into the claimed cells, or into
+    // localdescs if they are off the cache grid or another thread is
+    // filling their cell.  localdescs also receives the batch if we use it.
 
-// Get the HAT descriptor at the given ipoint and x,y coords, and return
-// how well the descriptor matches the model.  High fit means good match.
+    float localdescs[NGRIDPOINTS * HAT_DESC_LEN];
+    const bool batch = nmisses >= MIN_GRID_MISSES;
+    if (batch)
+        hat_.GridDescs_(localdescs, ix, iy, HAT_MAX_OFFSET, HAT_SEARCH_RESOL);
 
-static double GetHatFit(
-    int          x,      // in: image x coord (may be off image)
-    int          y,      // in: image y coord (may be off image)
-    const HatFit hatfit) // in: func to estimate descriptor match
-{
-    return hatfit(Buf(hat_g.Desc_(x, y)));
+    for (int igrid = 0; igrid < NGRIDPOINTS && nmisses; igrid++)
+    {
+        if (descs[igrid])
+            continue;
+        const int x = ix - HAT_MAX_OFFSET + (igrid % NGRID) * HAT_SEARCH_RESOL;
+        const int y = iy - HAT_MAX_OFFSET + (igrid / NGRID) * HAT_SEARCH_RESOL;
+        float* const localdesc = localdescs + igrid * HAT_DESC_LEN;
+        if (claimed[igrid] >= 0)
+        {
+            float* const desc = &slab_[size_t(claimed[igrid]) * HAT_DESC_LEN];
+            if (batch)
+                memcpy(desc, localdesc, HAT_DESC_LEN * sizeof(desc[0]));
+            else
+                hat_.Desc_(desc, x, y);
+            flags_[claimed[igrid]].store(CELL_FULL, std::memory_order_release);
+            descs[igrid] = desc;
+        }
+        else
+        {
+            if (!batch)
+                hat_.Desc_(localdesc, x, y);
+            descs[igrid] = localdesc;
+        }
+        nmisses--;
+    }
+    double fit_best = -FLT_MAX;
+    xoffset_best = yoffset_best = 0;
+    for (int igrid = 0; igrid < NGRIDPOINTS; igrid++)
+    {
+        const double fit = hatfit(descs[igrid]);
+        if (fit > fit_best)
+        {
+            fit_best = fit;
+            xoffset_best = (igrid % NGRID) * HAT_SEARCH_RESOL - HAT_MAX_OFFSET;
+            yoffset_best = (igrid / NGRID) * HAT_SEARCH_RESOL - HAT_MAX_OFFSET;
+        }
+    }
 }
 
-#endif // not CACHE
-
 static int round2(double x) // return closest int to x that is divisible by 2
 {
     return 2 * cvRound(x / 2);
@@ -110,42 +167,69 @@ static int PatchWidth( // patchwidth at the given pyramid level
     return HAT_PATCH_WIDTH + round2(ilev * HAT_PATCH_WIDTH_ADJ);
 }
 
-void InitHatLevData(   // init the global HAT data needed for this pyr level
-    const Image& img,  // in
-    int          ilev) // in
+// The HAT internal data (grads and orients etc.) is initialized
+// once for the entire pyramid level.
+
+void HatLevData::Init_( // init the HAT data needed for this pyr level
+    const Image& img,   // in
+    int          ilev)  // in
 {
     if (ilev <= HAT_START_LEV) // we use HATs only at upper pyr levs
     {
-        hat_g.Init_(img, PatchWidth(ilev));
-#if CACHE
+        hat_.Init_(img, PatchWidth(ilev));
+
         if (TRACE_CACHE) // show results from previous run
-            lprintf("[calls %d hitrate %.2f cachesize %d]\n",
-                    ncalls_g, double(nhits_g) / ncalls_g, cache_g.size());
-        cache_g.clear();
-#endif
+        {
+            int nfull = 0;
+            for (int i = 0; i < cachecols_ * cacherows_; i++)
+                if (flags_[i] == CELL_FULL)
+                    nfull++;
+            lprintf("[calls %d hitrate %.2f cachesize %d of %d]\n",
+                    int(ncalls_), double(nhits_) / ncalls_,
+                    nfull, cachecols_ * cacherows_);
+            ncalls_ = nhits_ = 0;
+        }
+        // a cell for every HAT_SEARCH_RESOL'th pixel from -CACHE_BORDER
+        // up to and including img.cols-1+CACHE_BORDER (likewise for rows)
+
+        cachex0_ = cachey0_ = -CACHE_BORDER;
+        cachecols_ = (img.cols - 1 + 2 * CACHE_BORDER) / HAT_SEARCH_RESOL + 1;
+        cacherows_ = (img.rows - 1 + 2 * CACHE_BORDER) / HAT_SEARCH_RESOL + 1;
+        const int ncells = cachecols_ * cacherows_;
+
+        if (NSIZE(flags_) < ncells)
+            vector<std::atomic<unsigned char> >(ncells).swap(flags_); // all empty
+        else
+            for (int i = 0; i < ncells; i++)
+                flags_[i].store(CELL_EMPTY, std::memory_order_relaxed);
+
+        if (slab_.size() < size_t(ncells) * HAT_DESC_LEN)
+            slab_.allocate(size_t(ncells) * HAT_DESC_LEN);
     }
 }
 
-VEC HatDesc( // used only during training new models
-    double x,   // in
-    double y)   // in
+VEC HatLevData::Desc_( // used only during training new models
+    double x,          // in
+    double y)          // in
+const
 {
-    return hat_g.Desc_(cvRound(x), cvRound(y));
+    return hat_.Desc_(cvRound(x), cvRound(y));
 }
 
 // Note 1: The image is not passed directly to this function.  Instead this
 // function accesses the image gradient magnitude and orientation stored in
-// fields of the global variable hat_g and previously initialized by the
-// call to InitHatLevData.
+// hatlev and previously initialized by the call to HatLevData::Init_.
 //
 // Note 2: If OpenMP is enabled, multiple instances of this function will be
 // called concurrently (each call will have a different value of x and y). Thus
-// this function and its callees do not modify any data that is not on the stack.
-
-void HatDescSearch(      // search in a grid around the current landmark
-    double&      x,      // io: (in: old position of landmark, out: new position)
-    double&      y,      // io:
-    const HatFit hatfit) // in: func to estimate descriptor match
+// this function and its callees do not modify any data that is not on the
+// stack, except for the descriptor cache in hatlev (which is lock free).
+
+void HatDescSearch(       // search in a grid around the current landmark
+    double&       x,      // io: (in: old position of landmark, out: new position)
+    double&       y,      // io:
+    const HatFit& hatfit, // in: func to estimate descriptor match
+    HatLevData&   hatlev) // io: HAT data for this pyr lev (cache updated)
 {
     // If HAT_SEARCH_RESOL is 2, force x,y positions to be divisible
     // by 2 to increase cache hit rate. This increases the mean hit rate
@@ -153,27 +237,10 @@ void HatDescSearch(      // search in a grid around the current landmark
     int ix = HAT_SEARCH_RESOL == 2? round2(x): cvRound(x);
     int iy = HAT_SEARCH_RESOL == 2? round2(y): cvRound(y);
 
-    double fit_best = -FLT_MAX;
+    int xoffset_best, yoffset_best; // in pixels
 
-    int xoffset_best = 0, yoffset_best = 0; // in pixels
+    hatlev.Search_(xoffset_best, yoffset_best, ix, iy, hatfit);
 
-    for (int yoffset = -HAT_MAX_OFFSET;
-             yoffset <= HAT_MAX_OFFSET;
-             yoffset += HAT_SEARCH_RESOL)
-    {
-        for (int xoffset = -HAT_MAX_OFFSET;
-                 xoffset <= HAT_MAX_OFFSET;
-                 xoffset += HAT_SEARCH_RESOL)
-        {
-            const double fit = GetHatFit(ix + xoffset, iy + yoffset, hatfit);
-            if (fit > fit_best)
-            {
-                fit_best = fit;
-                xoffset_best = xoffset;
-                yoffset_best = yoffset;
-            }
-        }
-    }
     x += xoffset_best;
     y += yoffset_best;
 }
@@ -6,6 +6,8 @@
 #ifndef STASM_HATPATCH_H
 #define STASM_HATPATCH_H
 
+#include <atomic>
+
 namespace stasm
 {
 static const int HAT_MAX_OFFSET = 4;   // search grid +-4 pixs from current posn
@@ -24,44 +26,92 @@ static const int HAT_PATCH_WIDTH_ADJ = -6;
 static const int HAT_START_LEV = 2;    // HAT descriptors are for pyr levs 0...2
                                        // so no need for Hat::Init_ at pyr lev 3
 
-// define HatFit: a pointer to a func for measuring fit of HAT descriptor
-typedef double(*HatFit)(const double* const);
-
-void InitHatLevData(      // init the global HAT data needed for this pyr level
-    const Image& img,     // in
-    int          ilev);   // in: pyramid level, 0 is full size
-
-VEC HatDesc(              // used only during training new models
-    double x,             // in
-    double y);            // in
+// HatFit measures the fit of a HAT descriptor to the model for one point.
+// The model is a linear regression on the descriptor, with coefficients
+// from the point's row in DescModTab::hat_coefs.
 
-void HatDescSearch(       // search in a grid around the current landmark
-    double&      x,       // io: (in: old posn of landmark, out: new posn)
-    double&      y,       // io
-    const HatFit hatfit); // in: func to estimate descriptor match
-
-class HatDescMod: public BaseDescMod
+class HatFit
 {
 public:
-    virtual void DescSearch_(double& x, double& y,       // io
-                             const Image&, const Shape&, // in
-                             int, int) const             // in
+    double operator()(         // return fit, higher is better
+        const float* const desc) // in: HAT_DESC_LEN elements
+    const
     {
-        HatDescSearch(x, y,
-                      hatfit_);
+        // negative because lowest distance is best fit
+        return -HatLinMod(desc, intercept_, coef_);
     }
 
-    HatDescMod(const HatFit hatfit) // constructor
-        : hatfit_(hatfit)
+    HatFit(double intercept, const double* coef) // constructor
+        : intercept_(intercept),
+          coef_(coef)
     {
     }
 
 private:
-    HatFit const hatfit_; // func to estimate HAT descriptor match
+    const double        intercept_;
+    const double* const coef_; // HAT_DESC_LEN elements
+};
+
+// The HAT data for the current pyramid level of one ASM search: the image
+// gradients and the descriptors computed so far.  This used to be global.
+// It is now owned by the caller (a stasm_ctx), so searches in different
+// contexts can run concurrently with the same (constant) descriptor models.
+//
+// The descriptor cache is a grid with a cell for every HAT_SEARCH_RESOL'th
+// pixel of the image (plus a border), backed by one slab of descriptors.
+// Each cell has an atomic fill flag, so the OpenMP threads in SuggestShape_
+// can look up and fill cells without a critical region.
+
+class HatLevData
+{
+public:
+    void Init_(                   // init the HAT data needed for this pyr level
+        const Image& img,         // in
+        int          ilev);       // in: pyramid level, 0 is full size
+
+    void Search_(                 // find best fit in the search grid around ix,iy
+        int&         xoffset,     // out: x offset of best fit from ix
+        int&         yoffset,     // out: y offset of best fit from iy
+        int          ix,          // in: image x coord (may be off image)
+        int          iy,          // in: image y coord (may be off image)
+        const HatFit& hatfit);    // in: func to estimate descriptor match
+
+    VEC Desc_(                    // used only during training new models
+        double x,                 // in
+        double y)                 // in
+    const;
+
+    HatLevData();                 // constructor
+
+private:
+    int CellIndex_(               // index of the cache cell for x,y, -1 if none
+        int          x,           // in: image x coord (may be off image)
+        int          y)           // in: image y coord (may be off image)
+    const;
+
+    Hat        hat_;              // grads and orients etc. for the current pyr lev
+
+    int        cachex0_, cachey0_;     // image coords of cell 0,0
+    int        cachecols_, cacherows_; // size of the cache grid in cells
+
+    vector<std::atomic<unsigned char> > flags_;
+                                  // CELL_EMPTY, CELL_FILLING, or CELL_FULL
+                                  // (grows as needed, never shrinks)
+
+    cv::AutoBuffer<float> slab_;  // HAT_DESC_LEN floats per cell, not
+                                  // initialized until the cell is filled
+
+    std::atomic<int> ncalls_, nhits_; // only used if TRACE_CACHE
+
+    DISALLOW_COPY_AND_ASSIGN(HatLevData);
 
-    DISALLOW_COPY_AND_ASSIGN(HatDescMod);
+}; // end class HatLevData
 
-}; // end class HatDescMod
+void HatDescSearch(          // search in a grid around the current landmark
+    double&       x,         // io: (in: old posn of landmark, out: new posn)
+    double&       y,         // io
+    const HatFit& hatfit,    // in: func to estimate descriptor match
+    HatLevData&   hatlev);   // io: HAT data for this pyr lev (cache updated)
 
 } // namespace stasm
 #endif // STASM_HATPATCH_H
@@ -16,6 +16,7 @@ using std::string;
 typedef vector<int>      vec_int;
 typedef vector<bool>     vec_bool;
 typedef vector<double>   vec_double;
+typedef vector<float>    vec_float;
 typedef vector<cv::Rect> vec_Rect;
 
 typedef unsigned char byte;
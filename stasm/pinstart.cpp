@@ -1,4 +1,5 @@
 // pinstart.cpp: utilities for creating a start shape from manually pinned points
+//               or from a prior shape
 //
 // Copyright (C) 2005-2013, Stephen Milborrow
 
@@ -247,45 +248,53 @@ static DetPar PseudoDetParFromStartShape(
     return detpar;
 }
 
-// Use the given pinned face landmarks to init the start shape.  The
-// current implementation works best if the pinned landmarks are the five
-// canonical pinned landmarks (viz. LEyeOuter, REyeOuter, CNoseTip,
-// LMouthCorner, RMouthCorner).  This is because it was trained on those
-// points.  But the routine also works if any two or more points are pinned.
+// Common code for PinnedStartShapeAndRoi and PriorStartShapeAndRoi.
+// If isprior, points is a full shape that becomes the start shape as is.
+// Else points are pinned landmarks, and the start shape is the mean shape
+// aligned to them.
 
-void PinnedStartShapeAndRoi(   // use the pinned landmarks to init the start shape
+static void StartShapeAndRoi(  // init the start shape and ROI from given points
     Shape&         startshape, // out: the start shape (in ROI frame)
     Image&         face_roi,   // out: ROI around face, possibly rotated upright
     DetPar&        detpar_roi, // out: detpar wrt to face_roi
     DetPar&        detpar,     // out: detpar wrt to img
-    Shape&         pinned_roi, // out: pinned arg translated to ROI frame
+    Shape*         points_roi, // out: points arg translated to ROI frame,
+                               //      NULL if not needed (only allowed if isprior)
     const Image&   img,        // in: the image (grayscale)
     const vec_Mod& mods,       // in: a vector of models, one for each yaw range
-    const Shape&   pinned)     // in: manually pinned landmarks
+    const Shape&   points,     // in: pinned landmarks, or the prior shape
+    bool           isprior)    // in: true if points is a prior shape
 {
+    CV_Assert(points_roi || isprior);
     double rot, yaw;
     EstRotAndYawFrom5PointShape(rot, yaw,
-                                Shape5(pinned, mods[0]->MeanShape_()));
+                                Shape5(points, mods[0]->MeanShape_()));
     const EYAW eyaw = DegreesAsEyaw(yaw, NSIZE(mods));
     const int imod = EyawAsModIndex(eyaw, mods); // select ASM model based on yaw
     if (trace_g)
         lprintf("%-6.6s yaw %3.0f rot %3.0f ", EyawAsString(eyaw), yaw, rot);
-    pinned_roi = pinned;    // use pinned_roi as a temp shape we can change
-    Image workimg(img);     // possibly flipped image
-    if (IsLeftFacing(eyaw)) // left facing? (our models are for right facing faces)
+    Shape workpoints(points); // possibly flipped points
+    Image workimg(img);       // possibly flipped image
+    if (IsLeftFacing(eyaw))   // left facing? (our models are for right facing faces)
     {
-        pinned_roi = FlipShape(pinned_roi, workimg.cols);
+        workpoints = FlipShape(workpoints, workimg.cols);
         FlipImgInPlace(workimg);
     }
     const Mod* mod = mods[ABS(imod)];
-    startshape = PinMeanShape(pinned_roi, mod->MeanShape_());
-    startshape = mod->ConformShapeToMod_Pinned_(startshape, pinned_roi);
+    if (isprior)
+        startshape = JitterPointsAt00(workpoints);
+    else
+    {
+        startshape = PinMeanShape(workpoints, mod->MeanShape_());
+        startshape = mod->ConformShapeToMod_Pinned_(startshape, workpoints);
+    }
     detpar = PseudoDetParFromStartShape(startshape, rot, yaw, NSIZE(mods));
     if (IsLeftFacing(eyaw))
         detpar.rot *= -1;
     FaceRoiAndDetPar(face_roi, detpar_roi, workimg, detpar, false);
     startshape = ImgShapeToRoiFrame(startshape, detpar_roi, detpar);
-    pinned_roi = ImgShapeToRoiFrame(pinned_roi, detpar_roi, detpar);
+    if (points_roi)
+        *points_roi = ImgShapeToRoiFrame(workpoints, detpar_roi, detpar);
     // following line not strictly necessary because don't actually need eyes/mouth
     InitDetParEyeMouthFromShape(detpar_roi, startshape);
     if (IsLeftFacing(eyaw))
@@ -296,4 +305,69 @@ void PinnedStartShapeAndRoi(   // use the pinned landmarks to init the start sha
     }
 }
 
+// Use the given pinned face landmarks to init the start shape.  The
+// current implementation works best if the pinned landmarks are the five
+// canonical pinned landmarks (viz. LEyeOuter, REyeOuter, CNoseTip,
+// LMouthCorner, RMouthCorner).  This is because it was trained on those
+// points.  But the routine also works if any two or more points are pinned.
+
+void PinnedStartShapeAndRoi(   // use the pinned landmarks to init the start shape
+    Shape&         startshape, // out: the start shape (in ROI frame)
+    Image&         face_roi,   // out: ROI around face, possibly rotated upright
+    DetPar&        detpar_roi, // out: detpar wrt to face_roi
+    DetPar&        detpar,     // out: detpar wrt to img
+    Shape&         pinned_roi, // out: pinned arg translated to ROI frame
+    const Image&   img,        // in: the image (grayscale)
+    const vec_Mod& mods,       // in: a vector of models, one for each yaw range
+    const Shape&   pinned)     // in: manually pinned landmarks
+{
+    StartShapeAndRoi(startshape, face_roi, detpar_roi, detpar, &pinned_roi,
+                     img, mods, pinned, false);
+}
+
+// A prior from an earlier search may be stale (from another image, or an
+// earlier failed search) or degenerate (e.g. all zeros), and the ROI and
+// image scale are derived from it.  So check it is a plausible face in img.
+
+static const double MIN_PRIOR_EYEMOUTH = 10; // min eye-mouth dist in pixels, arb
+
+static void CheckPrior(  // call Err if prior can't be a face in img
+    const Shape& prior,  // in: all stasm_NLANDMARKS landmarks
+    const Image& img)    // in
+{
+    for (int i = 0; i < prior.rows; i++)
+    {
+        const double x = prior(i, IX), y = prior(i, IY);
+        if (cvIsNaN(x) || cvIsNaN(y))
+            Err("Prior landmark %d is not a number", i);
+        if (x < 0 || x > img.cols-1 || y < 0 || y > img.rows-1)
+            Err("Prior landmark %d (%.1f,%.1f) is outside the %dx%d image "
+                "(stasm_force_points_into_image can fix that)",
+                i, x, y, img.cols, img.rows);
+    }
+    const double eyemouth = EyeMouthDist(prior);
+    if (eyemouth < MIN_PRIOR_EYEMOUTH)
+        Err("Prior eye-mouth distance %.1f is less than %g pixels, "
+            "the prior is not a face", eyemouth, MIN_PRIOR_EYEMOUTH);
+}
+
+// Use a full shape from an earlier search (typically from the previous
+// frame of a video) as the start shape.  The face detector isn't needed,
+// and the pose and ROI come from the prior shape itself.
+
+void PriorStartShapeAndRoi(    // use a prior shape as the start shape
+    Shape&         startshape, // out: the start shape (in ROI frame)
+    Image&         face_roi,   // out: ROI around face, possibly rotated upright
+    DetPar&        detpar_roi, // out: detpar wrt to face_roi
+    DetPar&        detpar,     // out: detpar wrt to img
+    const Image&   img,        // in: the image (grayscale)
+    const vec_Mod& mods,       // in: a vector of models, one for each yaw range
+    const Shape&   prior)      // in: all stasm_NLANDMARKS landmarks
+{
+    CV_Assert(prior.rows == stasm_NLANDMARKS);
+    CheckPrior(prior, img);
+    StartShapeAndRoi(startshape, face_roi, detpar_roi, detpar, NULL,
+                     img, mods, prior, true);
+}
+
 } // namespace stasm
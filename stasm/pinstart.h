@@ -1,4 +1,5 @@
 // pinstart.h: utilities for creating a start shape from manually pinned points
+//             or from a prior shape
 //
 // Copyright (C) 2005-2013, Stephen Milborrow
 
@@ -18,5 +19,14 @@ void PinnedStartShapeAndRoi(   // use the pinned landmarks to init the start sha
     const vec_Mod& mods,       // in: a vector of models, one for each yaw range
     const Shape&   pinned);    // in: manually pinned landmarks
 
+void PriorStartShapeAndRoi(    // use a prior shape as the start shape
+    Shape&         startshape, // out: the start shape (in ROI frame)
+    Image&         face_roi,   // out: ROI around face, possibly rotated upright
+    DetPar&        detpar_roi, // out: detpar wrt to face_roi
+    DetPar&        detpar,     // out: detpar wrt to img
+    const Image&   img,        // in: the image (grayscale)
+    const vec_Mod& mods,       // in: a vector of models, one for each yaw range
+    const Shape&   prior);     // in: all stasm_NLANDMARKS landmarks
+
 } // namespace stasm
 #endif // STASM_PINSTART_H
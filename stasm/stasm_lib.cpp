@@ -17,20 +17,108 @@ using namespace stasm;
 
 const char* const stasm_VERSION = STASM_VERSION;
 
-static vec_Mod mods_g;    // the ASM model(s)
-static FaceDet facedet_g; // the face detector
+static vec_Mod mods_g;        // the ASM model(s), shared by all contexts
+
+static cv::Mutex initmutex_g; // serializes reading the models
+
+// Everything that changes during a search.  The models in mods_g are
+// constant after initialization, so searches in different contexts
+// can run concurrently.
+
+struct stasm_ctx
+{
+    Image      img;       // the current image
+    FaceDet    facedet;   // the face detector and the faces found in img
+    ImgPyr     pyr;       // image pyramid of the current ASM search
+    HatLevData hatlev;    // HAT data for the current pyr lev of the ASM search
+    double     convergedist; // 0 for fixed iters, see stasm_ctx_set_convergence
+    int        niters[N_PYR_LEVS]; // iters at each pyr lev in the last ASM search
+    char       err[SBIG]; // last error, for stasm_ctx_lasterr
+
+    stasm_ctx() : convergedist(0)
+    {
+        for (int ilev = 0; ilev < N_PYR_LEVS; ilev++)
+            niters[ilev] = 0;
+        err[0] = 0;
+    }
+};
+
+static stasm_ctx* ctx_g;      // default context, used by the non-ctx functions
 
 //-----------------------------------------------------------------------------
 
 namespace stasm
 {
-static Image img_g;     // the current image
 static void CheckStasmInit(void)
 {
     if (mods_g.empty())
         Err("Models not initialized (missing call to stasm_init?)");
 }
 
+static void CheckCtx(      // check that the models and the context are ready
+    const stasm_ctx* ctx)  // in
+{
+    CheckStasmInit();
+    if (ctx == NULL)
+        Err("No stasm context (missing call to stasm_init or stasm_ctx_create?)");
+}
+
+static void ClearErr( // forget any err msg from a previous call with this ctx
+    stasm_ctx* ctx)   // io: may be NULL
+{
+    if (ctx)
+        ctx->err[0] = 0;
+}
+
+static void SaveErr(  // save the err msg (if any) in ctx for stasm_ctx_lasterr
+    stasm_ctx* ctx)   // io: may be NULL
+{
+    if (ctx)
+        STRCPY(ctx->err, LastErr());
+}
+
+static void InitMods1(   // read the models if not yet read, may throw
+    const char* datadir, // in: directory of face detector files
+    int         trace)   // in: 0 normal use, 1 trace to stdout and stasm.log
+{
+    cv::AutoLock lock(initmutex_g);
+    print_g = (trace != 0);
+    trace_g = (trace != 0);
+    if (mods_g.empty()) // not yet initialized?
+    {
+        if (trace)
+        {
+            // Open a log file in the current directory (if possible).
+            // After the log file is opened, lprintf and stasm_printf
+            // will print to stasm.log (as well as to stdout).
+            OpenLogFile();
+        }
+        lprintf("Stasm version %s%s\n",
+                stasm_VERSION, trace? "  Logging to stasm.log": "");
+        CV_Assert(datadir && datadir[0] && STRNLEN(datadir, SLEN) < SLEN);
+        InitMods(mods_g, datadir); // init ASM model(s)
+        OpenEyeMouthDetectors(mods_g, datadir);
+    }
+    CheckStasmInit();
+}
+
+static stasm_ctx* NewCtx(  // new context with its own face detector, may throw
+    const char* datadir,   // in: directory of face detector files
+    void*       detparams) // in: NULL or face detector parameters
+{
+    stasm_ctx* ctx = new stasm_ctx;
+    try
+    {
+        ctx->facedet.OpenFaceDetector_(datadir, detparams);
+    }
+    catch(...)
+    {
+        delete ctx;
+        throw;
+    }
+    return ctx;
+}
+
 static void ShapeToLandmarks( // convert Shape to landmarks (float *)
     float*       landmarks,   // out
     const Shape& shape)       // in
@@ -62,55 +150,8 @@ static const Shape LandmarksAsShape( // return a Shape
     return shape;
 }
 
-} // namespace stasm
-
-//-----------------------------------------------------------------------------
-
-int stasm_init_ext(        // extended version of stasm_init
-    const char* datadir,   // in: directory of face detector files
-    int         trace,     // in: 0 normal use, 1 trace to stdout and stasm.log
-    void*       detparams) // in: NULL or face detector parameters
-{
-    int returnval = 1;     // assume success
-    CatchOpenCvErrs();
-    try
-    {
-        print_g = (trace != 0);
-        trace_g = (trace != 0);
-        if (mods_g.empty()) // not yet initialized?
-        {
-            if (trace)
-            {
-                // Open a log file in the current directory (if possible).
-                // After the log file is opened, lprintf and stasm_printf
-                // will print to stasm.log (as well as to stdout).
-                OpenLogFile();
-            }
-            lprintf("Stasm version %s%s\n",
-                    stasm_VERSION, trace? "  Logging to stasm.log": "");
-            CV_Assert(datadir && datadir[0] && STRNLEN(datadir, SLEN) < SLEN);
-            InitMods(mods_g, datadir); // init ASM model(s)
-            facedet_g.OpenFaceDetector_(datadir, detparams);
-            OpenEyeMouthDetectors(mods_g, datadir);
-        }
-        CheckStasmInit();
-    }
-    catch(...)
-    {
-        returnval = 0; // a call was made to Err or a CV_Assert failed
-    }
-    UncatchOpenCvErrs();
-    return returnval;
-}
-
-int stasm_init(            // call once, at bootup (to read models from disk)
-    const char* datadir,   // in: directory of face detector files
-    int         trace)     // in: 0 normal use, 1 trace to stdout and stasm.log
-{
-    return stasm_init_ext(datadir, trace, NULL);
-}
-
-int stasm_open_image_ext(  // extended version of stasm_open_image
+static int OpenImage(      // common code for stasm_open_image_ext and stasm_ctx_open_image
+    stasm_ctx*  ctx,       // io
     const char* img,       // in: gray image data, top left corner at 0,0
     int         width,     // in: image width
     int         height,    // in: image height
@@ -121,55 +162,47 @@ int stasm_open_image_ext(  // extended version of stasm_open_image
 {
     int returnval = 1;     // assume success
     CatchOpenCvErrs();
+    ClearErr(ctx);
     try
     {
         CV_Assert(imgpath && STRNLEN(imgpath, SLEN) < SLEN);
         CV_Assert(multiface == 0 || multiface == 1);
         CV_Assert(minwidth >= 1 && minwidth <= 100);
 
-        CheckStasmInit();
+        CheckCtx(ctx);
 
-        img_g = Image(height, width,(unsigned char*)img);
+        ctx->img = Image(height, width,(unsigned char*)img);
 
 #if TRACE_IMAGES
         strcpy(imgpath_g, imgpath); // save the image path (for naming debug images)
 #endif
         // call the face detector to detect the face rectangle(s)
-        facedet_g.DetectFaces_(img_g, imgpath, multiface == 1, minwidth, user);
+        ctx->facedet.DetectFaces_(ctx->img, imgpath, multiface == 1, minwidth, user);
     }
     catch(...)
     {
         returnval = 0; // a call was made to Err or a CV_Assert failed
+        SaveErr(ctx);
     }
     UncatchOpenCvErrs();
     return returnval;
 }
 
-int stasm_open_image(      // call once per image, detect faces
-    const char* img,       // in: gray image data, top left corner at 0,0
-    int         width,     // in: image width
-    int         height,    // in: image height
-    const char* imgpath,   // in: image path, used only for err msgs and debug
-    int         multiface, // in: 0=return only one face, 1=allow multiple faces
-    int         minwidth)  // in: min face width as percentage of img width
-{
-    return stasm_open_image_ext(img, width, height, imgpath,
-                                multiface, minwidth, NULL);
-}
-
-int stasm_search_auto_ext( // extended version of stasm_search_auto
-    int*   foundface,      // out: 0=no more faces, 1=found face
-    float* landmarks,      // out: x0, y0, x1, y1, ..., caller must allocate
-    float* estyaw)         // out: NULL or pointer to estimated yaw
+static int SearchAuto(     // common code for stasm_search_auto_ext and stasm_ctx_search
+    stasm_ctx* ctx,        // io
+    int*       foundface,  // out: 0=no more faces, 1=found face
+    float*     landmarks,  // out: x0, y0, x1, y1, ..., caller must allocate
+    float*     estyaw)     // out: NULL or pointer to estimated yaw
 {
     int returnval = 1;     // assume success
     *foundface = 0;        // but assume no face found
     CatchOpenCvErrs();
+    ClearErr(ctx);
     try
     {
-        CheckStasmInit();
+        CheckCtx(ctx);
 
-        if (img_g.rows == 0 || img_g.cols == 0)
+        if (ctx->img.rows == 0 || ctx->img.cols == 0)
             Err("Image not open (missing call to stasm_open_image?)");
 
         Shape shape;       // the shape with landmarks
@@ -180,7 +213,7 @@ int stasm_search_auto_ext( // extended version of stasm_search_auto
         // Get the start shape for the next face in the image, and the ROI around it.
         // The shape will be wrt the ROI frame.
         if (NextStartShapeAndRoi(shape, face_roi, detpar_roi, detpar,
-                                 img_g, mods_g, facedet_g))
+                                 ctx->img, mods_g, ctx->facedet))
         {
             // now working with maybe flipped ROI and start shape in ROI frame
             *foundface = 1;
@@ -192,7 +225,9 @@ int stasm_search_auto_ext( // extended version of stasm_search_auto
             const int imod = ABS(EyawAsModIndex(detpar.eyaw, mods_g));
 
             // do the actual ASM search
-            shape = mods_g[imod]->ModSearch_(shape, face_roi);
+            shape = mods_g[imod]->ModSearch_(shape, face_roi,
+                                             ctx->pyr, ctx->hatlev,
+                                             ctx->convergedist, ctx->niters);
 #if TRACE_IMAGES
             CImage cimg; cvtColor(face_roi, cimg, CV_GRAY2BGR); // color image
             DrawShape(cimg, shape);
@@ -211,38 +246,14 @@ int stasm_search_auto_ext( // extended version of stasm_search_auto
     catch(...)
     {
         returnval = 0; // a call was made to Err or a CV_Assert failed
+        SaveErr(ctx);
     }
     UncatchOpenCvErrs();
     return returnval;
 }
 
-int stasm_search_auto( // call repeatedly to find all faces
-    int*   foundface,  // out: 0=no more faces, 1=found face
-    float* landmarks)  // out: x0, y0, x1, y1, ..., caller must allocate
-{
-    return stasm_search_auto_ext(foundface, landmarks, NULL);
-}
-
-int stasm_search_single(   // wrapper for stasm_search_auto and friends
-    int*        foundface, // out: 0=no face, 1=found face
-    float*      landmarks, // out: x0, y0, x1, y1, ..., caller must allocate
-    const char* img,       // in: gray image data, top left corner at 0,0
-    int         width,     // in: image width
-    int         height,    // in: image height
-    const char* imgpath,   // in: image path, used only for err msgs and debug
-    const char* datadir)   // in: directory of face detector files
-{
-    if (!stasm_init(datadir, 0 /*trace*/))
-        return false;
-
-    if (!stasm_open_image(img, width, height, imgpath,
-                          0 /*multiface*/, 10 /*minwidth*/))
-        return false;
-
-    return stasm_search_auto(foundface, landmarks);
-}
-
-int stasm_search_pinned(    // call after the user has pinned some points
+static int SearchPinned(    // common code for stasm_search_pinned and stasm_ctx_search_pinned
+    stasm_ctx*   ctx,       // io
     float*       landmarks, // out: x0, y0, x1, y1, ..., caller must allocate
     const float* pinned,    // in: pinned landmarks (0,0 points not pinned)
     const char*  img,       // in: gray image data, top left corner at 0,0
@@ -252,12 +263,13 @@ int stasm_search_pinned(    // call after the user has pinned some points
 {
     int returnval = 1;     // assume success
     CatchOpenCvErrs();
+    ClearErr(ctx);
     try
     {
         CV_Assert(imgpath && STRNLEN(imgpath, SLEN) < SLEN);
-        CheckStasmInit();
+        CheckCtx(ctx);
 
-        img_g = Image(height, width, (unsigned char*)img);
+        ctx->img = Image(height, width, (unsigned char*)img);
 
         const Shape pinnedshape(LandmarksAsShape(pinned));
 
@@ -268,12 +280,15 @@ int stasm_search_pinned(    // call after the user has pinned some points
         DetPar detpar;     // params returned by pseudo face det, in img frame
 
         PinnedStartShapeAndRoi(shape, face_roi, detpar_roi, detpar, pinned_roi,
-                               img_g, mods_g, pinnedshape);
+                               ctx->img, mods_g, pinnedshape);
 
         // now working with maybe flipped ROI and start shape in ROI frame
         const int imod = ABS(EyawAsModIndex(detpar.eyaw, mods_g));
 
-        shape = mods_g[imod]->ModSearch_(shape, face_roi, &pinned_roi); // ASM search
+        shape = mods_g[imod]->ModSearch_(shape, face_roi, // ASM search
+                                         ctx->pyr, ctx->hatlev,
+                                         ctx->convergedist, ctx->niters,
+                                         &pinned_roi);
 
         shape = RoundMat(RoiShapeToImgFrame(shape, face_roi, detpar_roi, detpar));
         // now working with non flipped start shape in image frame
@@ -285,11 +300,180 @@ int stasm_search_pinned(    // call after the user has pinned some points
     catch(...)
     {
         returnval = 0; // a call was made to Err or a CV_Assert failed
+        SaveErr(ctx);
     }
     UncatchOpenCvErrs();
     return returnval;
 }
 
+static int SearchPrior(      // common code for stasm_search_prior and stasm_ctx_search_prior
+    stasm_ctx*   ctx,       // io
+    float*       landmarks, // out: x0, y0, x1, y1, ..., caller must allocate
+    const float* prior,     // in: prior landmarks (e.g. from the previous frame)
+    const char*  img,       // in: gray image data, top left corner at 0,0
+    int          width,     // in: image width
+    int          height,    // in: image height
+    const char*  imgpath,   // in: image path, used only for err msgs and debug
+    int          startlev)  // in: pyr lev to start the search at
+{
+    int returnval = 1;     // assume success
+    CatchOpenCvErrs();
+    ClearErr(ctx);
+    try
+    {
+        CV_Assert(imgpath && STRNLEN(imgpath, SLEN) < SLEN);
+        CheckCtx(ctx);
+        if (startlev < 0 || startlev >= N_PYR_LEVS)
+            Err("startlev %d is out of range, must be 0 to %d",
+                startlev, N_PYR_LEVS-1);
+
+        ctx->img = Image(height, width, (unsigned char*)img);
+
+        Shape shape;       // the shape with landmarks
+        Image face_roi;    // img cropped to startshape area and maybe rotated
+        DetPar detpar_roi; // detpar translated to ROI frame
+        DetPar detpar;     // params derived from the prior shape, in img frame
+
+        PriorStartShapeAndRoi(shape, face_roi, detpar_roi, detpar,
+                              ctx->img, mods_g, LandmarksAsShape(prior));
+
+        // now working with maybe flipped ROI and start shape in ROI frame
+        const int imod = ABS(EyawAsModIndex(detpar.eyaw, mods_g));
+
+        shape = mods_g[imod]->ModSearch_(shape, face_roi, // ASM search
+                                         ctx->pyr, ctx->hatlev,
+                                         ctx->convergedist, ctx->niters,
+                                         NULL, startlev);
+
+        shape = RoundMat(RoiShapeToImgFrame(shape, face_roi, detpar_roi, detpar));
+        // now working with non flipped start shape in image frame
+        ShapeToLandmarks(landmarks, shape);
+        if (trace_g)
+            lprintf("\n");
+    }
+    catch(...)
+    {
+        returnval = 0; // a call was made to Err or a CV_Assert failed
+        SaveErr(ctx);
+    }
+    UncatchOpenCvErrs();
+    return returnval;
+}
+
+} // namespace stasm
+
+//-----------------------------------------------------------------------------
+
+int stasm_init_ext(        // extended version of stasm_init
+    const char* datadir,   // in: directory of face detector files
+    int         trace,     // in: 0 normal use, 1 trace to stdout and stasm.log
+    void*       detparams) // in: NULL or face detector parameters
+{
+    int returnval = 1;     // assume success
+    CatchOpenCvErrs();
+    try
+    {
+        InitMods1(datadir, trace);
+        cv::AutoLock lock(initmutex_g);
+        if (ctx_g == NULL) // default context not yet created?
+            ctx_g = NewCtx(datadir, detparams);
+    }
+    catch(...)
+    {
+        returnval = 0; // a call was made to Err or a CV_Assert failed
+    }
+    UncatchOpenCvErrs();
+    return returnval;
+}
+
+int stasm_init(            // call once, at bootup (to read models from disk)
+    const char* datadir,   // in: directory of face detector files
+    int         trace)     // in: 0 normal use, 1 trace to stdout and stasm.log
+{
+    return stasm_init_ext(datadir, trace, NULL);
+}
+
+int stasm_open_image_ext(  // extended version of stasm_open_image
+    const char* img,       // in: gray image data, top left corner at 0,0
+    int         width,     // in: image width
+    int         height,    // in: image height
+    const char* imgpath,   // in: image path, used only for err msgs and debug
+    int         multiface, // in: 0=return only one face, 1=allow multiple faces
+    int         minwidth,  // in: min face width as percentage of img width
+    void*       user)      // in: NULL or pointer to user abort func
+{
+    return OpenImage(ctx_g, img, width, height, imgpath, multiface, minwidth, user);
+}
+
+int stasm_open_image(      // call once per image, detect faces
+    const char* img,       // in: gray image data, top left corner at 0,0
+    int         width,     // in: image width
+    int         height,    // in: image height
+    const char* imgpath,   // in: image path, used only for err msgs and debug
+    int         multiface, // in: 0=return only one face, 1=allow multiple faces
+    int         minwidth)  // in: min face width as percentage of img width
+{
+    return stasm_open_image_ext(img, width, height, imgpath,
+                                multiface, minwidth, NULL);
+}
+
+int stasm_search_auto_ext( // extended version of stasm_search_auto
+    int*   foundface,      // out: 0=no more faces, 1=found face
+    float* landmarks,      // out: x0, y0, x1, y1, ..., caller must allocate
+    float* estyaw)         // out: NULL or pointer to estimated yaw
+{
+    return SearchAuto(ctx_g, foundface, landmarks, estyaw);
+}
+
+int stasm_search_auto( // call repeatedly to find all faces
+    int*   foundface,  // out: 0=no more faces, 1=found face
+    float* landmarks)  // out: x0, y0, x1, y1, ..., caller must allocate
+{
+    return stasm_search_auto_ext(foundface, landmarks, NULL);
+}
+
+int stasm_search_single(   // wrapper for stasm_search_auto and friends
+    int*        foundface, // out: 0=no face, 1=found face
+    float*      landmarks, // out: x0, y0, x1, y1, ..., caller must allocate
+    const char* img,       // in: gray image data, top left corner at 0,0
+    int         width,     // in: image width
+    int         height,    // in: image height
+    const char* imgpath,   // in: image path, used only for err msgs and debug
+    const char* datadir)   // in: directory of face detector files
+{
+    if (!stasm_init(datadir, 0 /*trace*/))
+        return false;
+
+    if (!stasm_open_image(img, width, height, imgpath,
+                          0 /*multiface*/, 10 /*minwidth*/))
+        return false;
+
+    return stasm_search_auto(foundface, landmarks);
+}
+
+int stasm_search_pinned(    // call after the user has pinned some points
+    float*       landmarks, // out: x0, y0, x1, y1, ..., caller must allocate
+    const float* pinned,    // in: pinned landmarks (0,0 points not pinned)
+    const char*  img,       // in: gray image data, top left corner at 0,0
+    int          width,     // in: image width
+    int          height,    // in: image height
+    const char*  imgpath)   // in: image path, used only for err msgs and debug
+{
+    return SearchPinned(ctx_g, landmarks, pinned, img, width, height, imgpath);
+}
+
+int stasm_search_prior(     // find landmarks starting from a prior shape
+    float*       landmarks, // out: x0, y0, x1, y1, ..., caller must allocate
+    const float* prior,     // in: prior landmarks (e.g. from the previous frame)
+    const char*  img,       // in: gray image data, top left corner at 0,0
+    int          width,     // in: image width
+    int          height,    // in: image height
+    const char*  imgpath,   // in: image path, used only for err msgs and debug
+    int          startlev)  // in: pyr lev to start at, 0 to 3 (3 is a full search)
+{
+    return SearchPrior(ctx_g, landmarks, prior, img, width, height, imgpath, startlev);
+}
+
 const char* stasm_lasterr(void) // same as LastErr but not in stasm namespace
 {
     return LastErr(); // return the last error message (stashed in sgErr)
@@ -330,3 +514,131 @@ void stasm_printf(      // print to stdout and to the stasm.log file if it is op
     va_end(args);
     lputs(s);
 }
+
+//-----------------------------------------------------------------------------
+// Reentrant interface, see the end of stasm_lib.h
+
+stasm_ctx* stasm_ctx_create( // create a context, reads the models on first call
+    const char* datadir,     // in: directory of face detector files
+    int         trace)       // in: 0 normal use, 1 trace to stdout and stasm.log
+{
+    stasm_ctx* ctx = NULL;
+    CatchOpenCvErrs();
+    try
+    {
+        InitMods1(datadir, trace);
+        ctx = NewCtx(datadir, NULL);
+    }
+    catch(...)
+    {
+        ctx = NULL; // a call was made to Err or a CV_Assert failed
+    }
+    UncatchOpenCvErrs();
+    return ctx;
+}
+
+void stasm_ctx_free( // release a context created by stasm_ctx_create
+    stasm_ctx* ctx)  // in: may be NULL
+{
+    if (ctx != ctx_g) // the default context lives until program exit
+        delete ctx;
+}
+
+int stasm_ctx_open_image(  // like stasm_open_image
+    stasm_ctx*  ctx,       // io
+    const char* img,       // in: gray image data, top left corner at 0,0
+    int         width,     // in: image width
+    int         height,    // in: image height
+    const char* imgpath,   // in: image path, used only for err msgs and debug
+    int         multiface, // in: 0=return only one face, 1=allow multiple faces
+    int         minwidth)  // in: min face width as percentage of img width
+{
+    return OpenImage(ctx, img, width, height, imgpath, multiface, minwidth, NULL);
+}
+
+int stasm_ctx_search(      // like stasm_search_auto
+    stasm_ctx* ctx,        // io
+    int*       foundface,  // out: 0=no more faces, 1=found face
+    float*     landmarks)  // out: x0, y0, x1, y1, ..., caller must allocate
+{
+    return SearchAuto(ctx, foundface, landmarks, NULL);
+}
+
+int stasm_ctx_search_pinned( // like stasm_search_pinned
+    stasm_ctx*   ctx,        // io
+    float*       landmarks,  // out: x0, y0, x1, y1, ..., caller must allocate
+    const float* pinned,     // in: pinned landmarks (0,0 points not pinned)
+    const char*  img,        // in: gray image data, top left corner at 0,0
+    int          width,      // in: image width
+    int          height,     // in: image height
+    const char*  imgpath)    // in: image path, used only for err msgs and debug
+{
+    return SearchPinned(ctx, landmarks, pinned, img, width, height, imgpath);
+}
+
+int stasm_ctx_search_prior(  // like stasm_search_prior
+    stasm_ctx*   ctx,        // io
+    float*       landmarks,  // out: x0, y0, x1, y1, ..., caller must allocate
+    const float* prior,      // in: prior landmarks (e.g. from the previous frame)
+    const char*  img,        // in: gray image data, top left corner at 0,0
+    int          width,      // in: image width
+    int          height,     // in: image height
+    const char*  imgpath,    // in: image path, used only for err msgs and debug
+    int          startlev)   // in: pyr lev to start at, 0 to 3 (3 is a full search)
+{
+    return SearchPrior(ctx, landmarks, prior, img, width, height, imgpath, startlev);
+}
+
+int stasm_ctx_set_convergence( // stop each pyr lev early once the shape settles
+    stasm_ctx* ctx,             // io
+    float      mindist)         // in: see stasm_lib.h, 0 (the default) to disable
+{
+    int returnval = 1;          // assume success
+    CatchOpenCvErrs();
+    ClearErr(ctx);
+    try
+    {
+        CheckCtx(ctx);
+        if (mindist < 0)
+            Err("stasm_ctx_set_convergence: mindist %g is negative", mindist);
+        ctx->convergedist = mindist;
+    }
+    catch(...)
+    {
+        returnval = 0; // a call was made to Err or a CV_Assert failed
+        SaveErr(ctx);
+    }
+    UncatchOpenCvErrs();
+    return returnval;
+}
+
+int stasm_ctx_iters(     // iterations at each pyr lev in the last search
+    stasm_ctx* ctx,      // in: NULL for the default context
+    int*       niters)   // out: stasm_NPYRLEVS ints, niters[0] is the finest lev
+{
+    int returnval = 1;   // assume success
+    if (!ctx)
+        ctx = ctx_g;
+    CatchOpenCvErrs();
+    ClearErr(ctx);
+    try
+    {
+        CheckCtx(ctx);
+        CV_Assert(niters && stasm_NPYRLEVS == N_PYR_LEVS);
+        for (int ilev = 0; ilev < N_PYR_LEVS; ilev++)
+            niters[ilev] = ctx->niters[ilev];
+    }
+    catch(...)
+    {
+        returnval = 0; // a call was made to Err or a CV_Assert failed
+        SaveErr(ctx);
+    }
+    UncatchOpenCvErrs();
+    return returnval;
+}
+
+const char* stasm_ctx_lasterr( // return string describing last error in ctx
+    const stasm_ctx* ctx)      // in
+{
+    return ctx? ctx->err: LastErr();
+}
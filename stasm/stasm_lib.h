@@ -23,6 +23,12 @@
 // The interface is defined in vanilla C so can be used by code
 // in "any" language.
 //
+// Multiple threads: the functions above work on a single default context
+// created by stasm_init.  To search images concurrently, give each thread
+// its own context with stasm_ctx_create and use the stasm_ctx_ functions
+// (see the end of this file).  The ASM models are read only and shared by
+// all contexts, so an extra context costs little more than its face detector.
+//
 //-----------------------------------------------------------------------------
 //
 //               Stasm License Agreement
@@ -64,6 +70,8 @@
 
 static const int stasm_NLANDMARKS = 77; // number of landmarks
 
+static const int stasm_NPYRLEVS = 4;     // number of levels in the image pyramid
+
 extern const char* const stasm_VERSION;
 
 extern "C"
@@ -104,6 +112,26 @@ int stasm_search_pinned(     // call after the user has pinned some points
     int          height,     // in: image height
     const char*  imgpath);   // in: image path, used only for err msgs and debug
 
+// stasm_search_prior starts the search from a full prior shape, typically
+// the landmarks found in the previous frame of a video, or cached or lightly
+// edited landmarks.  There is no face or eye/mouth detection; the ROI and
+// pose come from the prior shape.  Because the prior is already close to
+// the face, the search can start at a finer pyramid level than usual: 3
+// does a full search, 1 or 0 just refines the prior (and is faster).
+// It is an error if the prior isn't a plausible face in the image: all
+// landmarks must be inside the image (see stasm_force_points_into_image)
+// and the eye-mouth distance must be at least 10 pixels.
+
+extern "C"                   // find landmarks, no OpenCV face detect
+int stasm_search_prior(      // call with landmarks from an earlier search
+    float*       landmarks,  // out: x0, y0, x1, y1, ..., caller must allocate
+    const float* prior,      // in: prior landmarks (e.g. from the previous frame)
+    const char*  img,        // in: gray image data, top left corner at 0,0
+    int          width,      // in: image width
+    int          height,     // in: image height
+    const char*  imgpath,    // in: image path, used only for err msgs and debug
+    int          startlev);  // in: pyr lev to start at, 0 to 3 (3 is a full search)
+
 extern "C"
 const char* stasm_lasterr(void); // return string describing last error
 
@@ -126,4 +154,81 @@ void stasm_convert_shape( // convert stasm_NLANDMARKS points to given number of
 extern "C"
 void stasm_printf(const char* format, ...); // print to stdout and stasm.log
 
+// Reentrant interface.  A stasm_ctx owns everything that changes during a
+// search: the current image, the faces found in it, the ASM per-level search
+// data, and the last error.  Don't use one stasm_ctx in two threads at once.
+// The functions return 1 on success, 0 on error (stasm_ctx_create returns
+// NULL on error).  Use stasm_ctx_lasterr (or stasm_lasterr if ctx is NULL).
+
+typedef struct stasm_ctx stasm_ctx;
+
+extern "C"
+stasm_ctx* stasm_ctx_create( // create a context, reads the models on first call
+    const char*  datadir,    // in: directory of face detector files
+    int          trace);     // in: 0 normal use, 1 trace to stdout and stasm.log
+
+extern "C"
+void stasm_ctx_free(         // release a context created by stasm_ctx_create
+    stasm_ctx*   ctx);       // in: may be NULL
+
+extern "C"
+int stasm_ctx_open_image(    // like stasm_open_image
+    stasm_ctx*   ctx,        // io
+    const char*  img,        // in: gray image data, top left corner at 0,0
+    int          width,      // in: image width
+    int          height,     // in: image height
+    const char*  imgpath,    // in: image path, used only for err msgs and debug
+    int          multiface,  // in: 0=return only one face, 1=allow multiple faces
+    int          minwidth);  // in: min face width as percentage of img width
+
+extern "C"
+int stasm_ctx_search(        // like stasm_search_auto
+    stasm_ctx*   ctx,        // io
+    int*         foundface,  // out: 0=no more faces, 1=found face
+    float*       landmarks); // out: x0, y0, x1, y1, ..., caller must allocate
+
+extern "C"
+int stasm_ctx_search_pinned( // like stasm_search_pinned
+    stasm_ctx*   ctx,        // io
+    float*       landmarks,  // out: x0, y0, x1, y1, ..., caller must allocate
+    const float* pinned,     // in: pinned landmarks (0,0 points not pinned)
+    const char*  img,        // in: gray image data, top left corner at 0,0
+    int          width,      // in: image width
+    int          height,     // in: image height
+    const char*  imgpath);   // in: image path, used only for err msgs and debug
+
+extern "C"
+int stasm_ctx_search_prior(  // like stasm_search_prior
+    stasm_ctx*   ctx,        // io
+    float*       landmarks,  // out: x0, y0, x1, y1, ..., caller must allocate
+    const float* prior,      // in: prior landmarks (e.g. from the previous frame)
+    const char*  img,        // in: gray image data, top left corner at 0,0
+    int          width,      // in: image width
+    int          height,     // in: image height
+    const char*  imgpath,    // in: image path, used only for err msgs and debug
+    int          startlev);  // in: pyr lev to start at, 0 to 3 (3 is a full search)
+
+// By default each search does a fixed number of iterations at each level of
+// the image pyramid.  With stasm_ctx_set_convergence, the search instead
+// moves on to the next level once the landmarks move less than mindist
+// pixels on average in an iteration (distances are in pixels at the current
+// pyramid level, where the face is scaled to a standard size).  This saves
+// most of the time when the start shape is already close, as in tracking.
+// A bigger mindist is faster but may stop before the landmarks have settled.
+// stasm_ctx_iters gives the number of iterations done at each level.
+
+extern "C"
+int stasm_ctx_set_convergence( // stop each pyr lev early once the shape settles
+    stasm_ctx*   ctx,          // io
+    float        mindist);     // in: mean landmark movement in pixels, 0 to disable
+
+extern "C"
+int stasm_ctx_iters(           // iterations at each pyr lev in the last search
+    stasm_ctx*   ctx,          // in: NULL for the default context (stasm_search_auto etc.)
+    int*         niters);      // out: stasm_NPYRLEVS ints, niters[0] is the finest lev
+
+extern "C"
+const char* stasm_ctx_lasterr( // return string describing last error in ctx
+    const stasm_ctx* ctx);     // in
+
 #endif // STASM_LIB_H